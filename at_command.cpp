@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <string.h>
+#include <strings.h>
+
+#include "at_command.h"
+
+at_command_parser::at_command_parser(const at_command_handlers &handlers)
+{
+    this->handlers = handlers;
+
+    for (int i = 0; i < S_REGISTER_NUM; i++) {
+        s_register_defaults[i] = 0;
+    }
+    s_register_defaults[S_REGISTER_ESCAPE_CHAR] = '+';
+    s_register_defaults[S_REGISTER_CR] = '\r';
+    s_register_defaults[S_REGISTER_LF] = '\n';
+    s_register_defaults[S_REGISTER_BS] = '\b';
+    s_register_defaults[S_REGISTER_WAIT_CARRIER] = 50;
+    s_register_defaults[S_REGISTER_GUARD_TIME] = 50;
+
+    last_line[0] = '\0';
+    reset();
+    clear_line();
+}
+
+// ATZ / AT&F; echo stays off by default as the host software expects no echo
+void at_command_parser::reset(void)
+{
+    echo = false;
+    verbose = true;
+    quiet = false;
+    for (int i = 0; i < S_REGISTER_NUM; i++) {
+        s_registers[i] = s_register_defaults[i];
+    }
+}
+
+void at_command_parser::set_s_register_default(const int reg, const uint8_t value)
+{
+    s_register_defaults[reg] = value;
+    s_registers[reg] = value;
+}
+
+// Drop a partially received command line
+void at_command_parser::clear_line(void)
+{
+    line_len = 0;
+    prev = 0;
+    in_line = false;
+    overflow = false;
+}
+
+// Returns false when a command changed the modem state and the caller should
+// stop feeding input for now.
+bool at_command_parser::input(const char c)
+{
+    if (echo) {handlers.write(&c, 1);}
+
+    if (!in_line) {
+        // Wait for "AT", or "A/" to repeat the last command line
+        const auto prev_upper = toupper(static_cast<unsigned char>(prev));
+        prev = c;
+        if (prev_upper != 'A') {return true;}
+        if (toupper(static_cast<unsigned char>(c)) == 'T') {
+            in_line = true;
+            line_len = 0;
+            overflow = false;
+        } else if (c == '/') {
+            prev = 0;
+            return execute(last_line);
+        }
+        return true;
+    }
+
+    if (c == static_cast<char>(s_registers[S_REGISTER_CR])) {
+        in_line = false;
+        prev = 0;
+        if (overflow) {
+            result(AT_RESULT_ERROR);
+            return true;
+        }
+        line[line_len] = '\0';
+        memcpy(last_line, line, line_len + 1);
+        return execute(line);
+    }
+    if (c == static_cast<char>(s_registers[S_REGISTER_BS])) {
+        if (line_len > 0) {line_len--;}
+        return true;
+    }
+    if (c == ' ' || iscntrl(static_cast<unsigned char>(c))) {return true;}
+
+    if (line_len < LINE_SIZE - 1) {
+        line[line_len++] = c;
+    } else {
+        overflow = true;
+    }
+    return true;
+}
+
+bool at_command_parser::execute(const char *cmd_line)
+{
+    const char *p = cmd_line;
+    AT_RESULT res = AT_RESULT_OK;
+
+    while (*p != '\0' && res == AT_RESULT_OK) {
+        const auto *cmd = find_command(p);
+        if (cmd == nullptr) {
+            skip_command(&p);
+            continue;
+        }
+        p += strlen(cmd->name);
+        res = cmd->execute(this, &p);
+    }
+
+    if (res == AT_RESULT_NONE) {return false;}
+    result(res);
+    return true;
+}
+
+// Longest name matching at p, case-insensitive
+const at_command_parser::command *at_command_parser::find_command(const char *p)
+{
+    const command *found = nullptr;
+    size_t found_len = 0;
+
+    for (const auto &cmd : commands) {
+        const auto len = strlen(cmd.name);
+        if (len > found_len && strncasecmp(p, cmd.name, len) == 0) {
+            found = &cmd;
+            found_len = len;
+        }
+    }
+
+    return found;
+}
+
+int at_command_parser::parse_number(const char **p, const int default_value)
+{
+    if (!isdigit(static_cast<unsigned char>(**p))) {return default_value;}
+
+    int value = 0;
+    while (isdigit(static_cast<unsigned char>(**p))) {
+        value = std::min(value * 10 + (**p - '0'), 99999);
+        (*p)++;
+    }
+
+    return value;
+}
+
+// A command not in the table: an optional &, \ or % prefix, one character
+// and its parameter (n, =n or ?)
+void at_command_parser::skip_command(const char **p)
+{
+    if ((**p == '&' || **p == '\\' || **p == '%') && (*p)[1] != '\0') {(*p)++;}
+    (*p)++;
+    parse_number(p, 0);
+    if (**p == '=') {
+        (*p)++;
+        parse_number(p, 0);
+    }
+    if (**p == '?') {(*p)++;}
+}
+
+void at_command_parser::write_line(const char *text)
+{
+    handlers.write(text, strlen(text));
+    handlers.write("\r\n", 2);
+}
+
+void at_command_parser::result(const AT_RESULT code, const char *detail)
+{
+    static const char *const texts[] = {
+        "OK",
+        "CONNECT",
+        "RING",
+        "NO CARRIER",
+        "ERROR",
+        nullptr,
+        "NO DIALTONE",
+        "BUSY",
+        "NO ANSWER",
+    };
+    if (quiet || code < 0 || code >= static_cast<int>(sizeof(texts) / sizeof(texts[0])) || texts[code] == nullptr) {return;}
+
+    char buf[64];
+    int len;
+    if (verbose) {
+        len = snprintf(buf, sizeof(buf), "%s%s\r\n", texts[code], detail != nullptr ? detail : "");
+    } else {
+        len = snprintf(buf, sizeof(buf), "%d\r", code);
+    }
+    handlers.write(buf, std::min(static_cast<size_t>(len), sizeof(buf) - 1));
+}
+
+AT_RESULT at_command_parser::cmd_dial(at_command_parser *parser, const char **args)
+{
+    // The rest of the line is the dial string
+    const char *dial_string = *args;
+    *args += strlen(*args);
+
+    // DSn or DS=n dials stored number n
+    if (toupper(static_cast<unsigned char>(*dial_string)) == 'S') {
+        const char *p = dial_string + 1;
+        if (*p == '=') {p++;}
+        const auto index = parse_number(&p, -1);
+        if (index >= 0 && *p == '\0') {
+            const auto *stored = parser->handlers.recall(index);
+            return stored != nullptr ? parser->handlers.dial(stored) : AT_RESULT_ERROR;
+        }
+    }
+
+    // A leading T (tone) or P (pulse) is dropped before an address. Before a
+    // letter it may just as well start a host name, so it is left to dial()
+    const auto mode = toupper(static_cast<unsigned char>(dial_string[0]));
+    const auto next = static_cast<unsigned char>(dial_string[1]);
+    if ((mode == 'T' || mode == 'P') && (isdigit(next) || next == '*' || next == '\0')) {
+        dial_string++;
+    }
+
+    return parser->handlers.dial(dial_string);
+}
+
+AT_RESULT at_command_parser::cmd_answer(at_command_parser *parser, const char **args)
+{
+    return parser->handlers.answer();
+}
+
+AT_RESULT at_command_parser::cmd_hangup(at_command_parser *parser, const char **args)
+{
+    if (parse_number(args, 0) != 0) {return AT_RESULT_ERROR;}
+
+    return parser->handlers.hangup();
+}
+
+AT_RESULT at_command_parser::cmd_online(at_command_parser *parser, const char **args)
+{
+    if (parse_number(args, 0) != 0) {return AT_RESULT_ERROR;}
+
+    return parser->handlers.online();
+}
+
+AT_RESULT at_command_parser::cmd_reset(at_command_parser *parser, const char **args)
+{
+    parse_number(args, 0);
+    parser->reset();
+
+    return AT_RESULT_OK;
+}
+
+// &Zn=s stores dial string s as number n (empty deletes it), &Zn? shows it
+AT_RESULT at_command_parser::cmd_store(at_command_parser *parser, const char **args)
+{
+    const auto index = parse_number(args, 0);
+
+    if (**args == '?') {
+        (*args)++;
+        const auto *stored = parser->handlers.recall(index);
+        parser->write_line(stored != nullptr ? stored : "");
+        return AT_RESULT_OK;
+    }
+    if (**args != '=') {return AT_RESULT_ERROR;}
+
+    const char *dial_string = *args + 1;
+    *args += strlen(*args);
+
+    return parser->handlers.store(index, dial_string);
+}
+
+// I0: product code, I6: link diagnostics, others: firmware name
+AT_RESULT at_command_parser::cmd_info(at_command_parser *parser, const char **args)
+{
+    const auto value = parse_number(args, 0);
+    if (value == 6) {
+        parser->handlers.report();
+    } else {
+        parser->write_line(value == 0 ? "ME56PS2" : "me56ps2-emulator-rp2040");
+    }
+
+    return AT_RESULT_OK;
+}
+
+AT_RESULT at_command_parser::cmd_echo(at_command_parser *parser, const char **args)
+{
+    const auto value = parse_number(args, 0);
+    if (value > 1) {return AT_RESULT_ERROR;}
+    parser->echo = value == 1;
+
+    return AT_RESULT_OK;
+}
+
+AT_RESULT at_command_parser::cmd_verbose(at_command_parser *parser, const char **args)
+{
+    const auto value = parse_number(args, 0);
+    if (value > 1) {return AT_RESULT_ERROR;}
+    parser->verbose = value == 1;
+
+    return AT_RESULT_OK;
+}
+
+AT_RESULT at_command_parser::cmd_quiet(at_command_parser *parser, const char **args)
+{
+    const auto value = parse_number(args, 0);
+    if (value > 1) {return AT_RESULT_ERROR;}
+    parser->quiet = value == 1;
+
+    return AT_RESULT_OK;
+}
+
+// Sn=v sets, Sn? reports the value. Registers this firmware does not use
+// (up to S255) take any value and read back as 0.
+AT_RESULT at_command_parser::cmd_s_register(at_command_parser *parser, const char **args)
+{
+    const auto reg = parse_number(args, -1);
+    if (reg < 0 || reg > UINT8_MAX) {return AT_RESULT_ERROR;}
+    const auto modelled = reg < S_REGISTER_NUM;
+
+    if (**args == '=') {
+        (*args)++;
+        const auto value = parse_number(args, -1);
+        if (value < 0 || value > UINT8_MAX) {return AT_RESULT_ERROR;}
+        if (modelled) {parser->s_registers[reg] = value;}
+    } else if (**args == '?') {
+        (*args)++;
+        char buf[8];
+        snprintf(buf, sizeof(buf), "%03u", modelled ? parser->s_registers[reg] : 0);
+        parser->write_line(buf);
+    }
+
+    return AT_RESULT_OK;
+}
+
+// AT+xxx: everything up to the next ';' belongs to the extended command
+AT_RESULT at_command_parser::cmd_extended(at_command_parser *parser, const char **args)
+{
+    while (**args != '\0' && **args != ';') {(*args)++;}
+    if (**args == ';') {(*args)++;}
+
+    return AT_RESULT_OK;
+}
+
+void escape_sequence_detector::input(const char *data, const size_t len, const uint32_t now_ms, const char escape_char, const uint32_t guard_ms)
+{
+    if (len > 3) {
+        count = 0;
+        last_time_ms = now_ms;
+        return;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        // The first one needs a guard time before it, the others must follow within one
+        const auto quiet = now_ms - last_time_ms >= guard_ms;
+        if (data[i] == escape_char && count < 3 && (count == 0 ? quiet : !quiet)) {
+            count++;
+        } else {
+            count = 0;
+        }
+        last_time_ms = now_ms;
+    }
+}
+
+// True once, when the guard time after the third escape character has passed
+bool escape_sequence_detector::poll(const uint32_t now_ms, const uint32_t guard_ms)
+{
+    if (count < 3 || now_ms - last_time_ms < guard_ms) {return false;}
+    count = 0;
+
+    return true;
+}
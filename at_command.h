@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+enum S_REGISTER {
+    S_REGISTER_AUTO_ANSWER  = 0,  // rings before answering, 0: disabled
+    S_REGISTER_RING_COUNT   = 1,  // rings of the current incoming call
+    S_REGISTER_ESCAPE_CHAR  = 2,
+    S_REGISTER_CR           = 3,
+    S_REGISTER_LF           = 4,
+    S_REGISTER_BS           = 5,
+    S_REGISTER_WAIT_CARRIER = 7,  // seconds a UDP caller keeps calling before NO CARRIER
+    S_REGISTER_GUARD_TIME   = 12, // 1/50 s
+    S_REGISTER_LINE_RATE    = 37, // emulated line rate in 2400 bps units (up to 14), 0: not paced
+    S_REGISTER_TX_COALESCE  = 40, // 0: send immediately, 1: adaptive IN packet coalescing
+    S_REGISTER_TRANSPORT    = 41, // 0: TCP, 1: UDP with selective ACK
+    S_REGISTER_COMPRESSION  = 46, // 0: send raw, 1: compress what is sent if the peer can decode it
+    S_REGISTER_NUM,
+};
+
+// Hayes numeric result codes
+enum AT_RESULT : int8_t {
+    AT_RESULT_NONE        = -1, // no result code now; stop reading commands (state changed)
+    AT_RESULT_OK          = 0,
+    AT_RESULT_CONNECT     = 1,
+    AT_RESULT_RING        = 2,
+    AT_RESULT_NO_CARRIER  = 3,
+    AT_RESULT_ERROR       = 4,
+    AT_RESULT_NO_DIALTONE = 6,
+    AT_RESULT_BUSY        = 7,
+    AT_RESULT_NO_ANSWER   = 8,
+};
+
+struct at_command_handlers {
+    AT_RESULT (*dial)(const char *dial_string);
+    AT_RESULT (*answer)(void);
+    AT_RESULT (*hangup)(void);
+    AT_RESULT (*online)(void);
+    AT_RESULT (*store)(const int index, const char *dial_string); // AT&Zn=
+    const char *(*recall)(const int index);                       // nullptr if not stored
+    void (*write)(const char *data, size_t len);
+    void (*report)(void);                                         // ATI6, through write()
+};
+
+// Command-mode parser. Input is consumed as a stream: each character is
+// looked at once, so a line dribbling in costs nothing extra. Commands in a
+// line ("ATE0V1S0=1") are dispatched through a constant table; anything
+// not in it is accepted and ignored, as init strings are full of settings
+// that mean nothing here (L, M, X, &C, &K, \N, %C...).
+// process() and input() must be called from a single context; result() may
+// be called from any context as long as write() is safe there.
+class at_command_parser
+{
+    private:
+        struct command {
+            const char *name;
+            AT_RESULT (*execute)(at_command_parser *parser, const char **args);
+        };
+        static AT_RESULT cmd_dial(at_command_parser *parser, const char **args);
+        static AT_RESULT cmd_answer(at_command_parser *parser, const char **args);
+        static AT_RESULT cmd_hangup(at_command_parser *parser, const char **args);
+        static AT_RESULT cmd_online(at_command_parser *parser, const char **args);
+        static AT_RESULT cmd_reset(at_command_parser *parser, const char **args);
+        static AT_RESULT cmd_store(at_command_parser *parser, const char **args);
+        static AT_RESULT cmd_info(at_command_parser *parser, const char **args);
+        static AT_RESULT cmd_echo(at_command_parser *parser, const char **args);
+        static AT_RESULT cmd_verbose(at_command_parser *parser, const char **args);
+        static AT_RESULT cmd_quiet(at_command_parser *parser, const char **args);
+        static AT_RESULT cmd_s_register(at_command_parser *parser, const char **args);
+        static AT_RESULT cmd_extended(at_command_parser *parser, const char **args);
+        static constexpr command commands[] = {
+            {"D", cmd_dial},
+            {"A", cmd_answer},
+            {"H", cmd_hangup},
+            {"O", cmd_online},
+            {"Z", cmd_reset},
+            {"&F", cmd_reset},
+            {"&Z", cmd_store},
+            {"I", cmd_info},
+            {"E", cmd_echo},
+            {"V", cmd_verbose},
+            {"Q", cmd_quiet},
+            {"S", cmd_s_register},
+            {"+", cmd_extended},
+        };
+        static constexpr size_t LINE_SIZE = 256;
+
+        at_command_handlers handlers;
+        char line[LINE_SIZE];
+        char last_line[LINE_SIZE];
+        size_t line_len;
+        char prev;
+        bool in_line;
+        bool overflow;
+        volatile bool echo, verbose, quiet;
+        volatile uint8_t s_registers[S_REGISTER_NUM];
+        uint8_t s_register_defaults[S_REGISTER_NUM];
+
+        static int parse_number(const char **p, const int default_value);
+        static void skip_command(const char **p);
+        const command *find_command(const char *p);
+        bool execute(const char *cmd_line);
+        void write_line(const char *text);
+    public:
+        at_command_parser(const at_command_handlers &handlers);
+        void reset(void);
+        void clear_line(void);
+        bool input(const char c);
+        template <typename T>
+        void process(T *rx_buffer);
+        void result(const AT_RESULT code, const char *detail = nullptr);
+        void set_s_register_default(const int reg, const uint8_t value);
+        uint8_t get_s_register(const int reg) {return s_registers[reg];}
+        void set_s_register(const int reg, const uint8_t value) {s_registers[reg] = value;}
+};
+
+// Hayes escape: guard time, three escape characters, guard time. Works on
+// whole packets as they pass so that normal data is not delayed; a packet
+// longer than the sequence itself can never be part of it. input() and
+// poll() must run in the same context (or with its interrupts disabled).
+class escape_sequence_detector
+{
+    private:
+        uint32_t last_time_ms; // last data received
+        uint8_t count;         // escape characters seen after a guard time
+    public:
+        escape_sequence_detector() : last_time_ms(0), count(0) {}
+        void input(const char *data, const size_t len, const uint32_t now_ms, const char escape_char, const uint32_t guard_ms);
+        bool poll(const uint32_t now_ms, const uint32_t guard_ms);
+        void reset(void) {count = 0;}
+};
+
+// Feed everything buffered to input(); stops early, leaving the rest in the
+// buffer, when a command changed the modem state (dial, answer).
+template <typename T>
+void at_command_parser::process(T *rx_buffer)
+{
+    const char *span;
+    size_t len;
+    while ((len = rx_buffer->peek_read_span(&span)) > 0) {
+        size_t i = 0;
+        bool more = true;
+        while (more && i < len) {
+            more = input(span[i++]);
+        }
+        rx_buffer->consume(i);
+        if (!more) {break;}
+    }
+}
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <IPAddress.h>
 
 namespace config {
@@ -16,24 +18,74 @@ namespace config {
     // 対戦用待ち受けポート
     constexpr uint16_t listen_port = 10023;
 
+    // 通話中に着信した相手を待たせておく数 (W5500の空きソケットを使用)
+    constexpr int max_queued_calls = 2;
+
+    // 待たせておいた着信に、切断後自動で応答する
+    constexpr bool auto_answer_queued_calls = false;
+
+    // 待ちきれない着信に送るメッセージ (空文字列なら送らずに切断)
+    constexpr char busy_message[] = "BUSY\r\n";
+
     // 対戦接続時デフォルトポート
     constexpr uint16_t default_port = 10023;
 
     // ログ出力を有効にする
     constexpr bool enable_log = false;
 
+    // USB・データ経路のイベントをトレースとして記録し、ログポートへ出力する (UARTへは出力しない)
+    constexpr bool enable_trace = false;
+
     // ログ出力待ち受けポート (デバッグ用)
     constexpr uint16_t log_listen_port = 23;
 
     // MACアドレス
-    uint8_t mac_addr[6] = {0x02, 0x20, 0x40, 0x00, 0x00, 0x00};
+    inline uint8_t mac_addr[6] = {0x02, 0x20, 0x40, 0x00, 0x00, 0x00};
 
     // Board Unique ID を元に MAC アドレスの下位 3-octets を自動生成する
     constexpr bool use_board_unique_id = true;
 
+    // リングバッファの大きさ (バイト数、2のべき乗)
+    // 静的に確保されるため、合計がそのままRAMの使用量になります
+    namespace buffer_size {
+        constexpr size_t usb_rx = 1024; // ホストからのATコマンド (オンライン中のデータは通らない)
+        constexpr size_t usb_tx = 2048; // ホストへの結果コードとエコー
+        constexpr size_t net_rx = 8192; // 相手から受信した対戦データ
+        constexpr size_t net_tx = 8192; // 相手へ送信する対戦データ
+        constexpr size_t log_tx = 2048; // ログ出力
+    }
+
     // 非アクティブ時の通信間隔
     constexpr int report_interval_ms = 40;
 
+    // USB送信パケットの結合モード (S40の初期値)
+    // 0: 常に直ちに送信する
+    // 1: 送信中のパケットがある間は、受信間隔に応じて1パケット分までデータをためる
+    constexpr uint8_t tx_coalesce_mode = 0;
+
+    // 模擬する回線速度 (S37の初期値、2400bps単位: 4で9600bps、12で28800bps、14で33600bps)
+    // 0: 模擬せず、イーサネットの速度のまま送受信する (CONNECTは33600bpsと報告)
+    constexpr uint8_t line_rate = 0;
+
+    // 対戦データの転送方式 (S41の初期値)
+    // 0: TCP
+    // 1: UDP (順序番号と選択的確認応答で、失われたデータを直ちに再送する)
+    // UDPは相手も同じ設定である必要があります
+    constexpr uint8_t transport_mode = 0;
+
+    // UDP転送時、確認応答を待っている直前のデータを何個まで重ねて送るか
+    // 1個以上にすると単発のパケット損失で遅延しなくなる代わりに、通信量が増える
+    constexpr uint8_t udp_redundancy = 1;
+
+    // 対戦データの圧縮 (S46の初期値)
+    // 0: 圧縮せずに送信する
+    // 1: 接続直後に相手と交渉し、相手が展開できる場合は圧縮して送信する
+    // 相手が本ファームウェアでない場合、交渉用の6バイトがデータとして届くため、
+    // 相手も本ファームウェアである場合にのみ有効にしてください
+    // 圧縮・展開用の辞書 (送信側 約8KB、受信側 約4KB、計 約12KB のRAM) は、
+    // 0の場合も相手からの圧縮データを展開するため、設定に関係なく静的に確保されます
+    constexpr uint8_t compression = 0;
+
     // 再送間隔 (0.1ms単位)
     constexpr uint16_t retry_time_value = 2000;
 
@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <string.h>
+#include <strings.h>
+
+#include <Arduino.h>
+
+#include "dns_resolver.h"
+
+dns_resolver::dns_resolver()
+{
+    for (auto &entry : cache) {
+        entry.name[0] = '\0';
+        entry.valid = false;
+    }
+    cache_next = 0;
+    name[0] = '\0';
+    query_id = 0;
+    attempts = 0;
+    sent_time_ms = 0;
+    current = status::Idle;
+}
+
+// Cached address, if any that has not expired yet
+bool dns_resolver::lookup(const char *name, IPAddress *ip_addr)
+{
+    const auto now = millis();
+    for (auto &entry : cache) {
+        if (!entry.valid || strcasecmp(entry.name, name) != 0) {continue;}
+        if (static_cast<long>(entry.expires_ms - now) <= 0) {
+            entry.valid = false;
+            continue;
+        }
+        *ip_addr = entry.ip_addr;
+        return true;
+    }
+
+    return false;
+}
+
+void dns_resolver::start(const IPAddress &server, const char *name)
+{
+    cancel();
+
+    this->server = server;
+    strncpy(this->name, name, sizeof(this->name) - 1);
+    this->name[sizeof(this->name) - 1] = '\0';
+    attempts = 0;
+
+    if (udp.begin(1024 + (millis() & 0x3fff)) == 0) {
+        current = status::Failed;
+        return;
+    }
+    current = send_query() ? status::Busy : status::Failed;
+}
+
+dns_resolver::status dns_resolver::poll(IPAddress *ip_addr)
+{
+    if (current != status::Busy) {return current;}
+
+    if (udp.parsePacket() > 0) {
+        uint8_t msg[512];
+        const auto len = udp.read(msg, sizeof(msg));
+        uint32_t ttl_s;
+        if (len > 0 && parse_response(msg, len, ip_addr, &ttl_s)) {
+            store(*ip_addr, ttl_s);
+            finish(status::Resolved);
+        } else if (len >= 4 && ((msg[0] << 8) | msg[1]) == query_id) {
+            // Our query, but no usable answer (NXDOMAIN, no A record, ...)
+            finish(status::Failed);
+        }
+        return current;
+    }
+
+    if (millis() - sent_time_ms >= RETRY_INTERVAL_MS) {
+        if (attempts >= MAX_ATTEMPTS || !send_query()) {
+            finish(status::Failed);
+        }
+    }
+
+    return current;
+}
+
+void dns_resolver::cancel(void)
+{
+    if (current == status::Busy) {udp.stop();}
+    current = status::Idle;
+}
+
+void dns_resolver::finish(const status result)
+{
+    udp.stop();
+    current = result;
+}
+
+bool dns_resolver::send_query(void)
+{
+    uint8_t msg[12 + NAME_SIZE + 2 + 4];
+    size_t len = 0;
+
+    query_id = static_cast<uint16_t>(micros());
+    const uint8_t header[12] = {
+        static_cast<uint8_t>(query_id >> 8), static_cast<uint8_t>(query_id & 0xff),
+        0x01, 0x00, // standard query, recursion desired
+        0x00, 0x01, // QDCOUNT
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    };
+    memcpy(msg, header, sizeof(header));
+    len += sizeof(header);
+
+    // QNAME as length-prefixed labels
+    const char *label = name;
+    while (*label != '\0') {
+        const auto *dot = strchr(label, '.');
+        const size_t label_len = dot != nullptr ? dot - label : strlen(label);
+        if (label_len == 0 || label_len > 63) {return false;}
+        msg[len++] = label_len;
+        memcpy(&msg[len], label, label_len);
+        len += label_len;
+        label += label_len + (dot != nullptr ? 1 : 0);
+    }
+    msg[len++] = 0;
+    const uint8_t question[4] = {0x00, 0x01, 0x00, 0x01}; // QTYPE A, QCLASS IN
+    memcpy(&msg[len], question, sizeof(question));
+    len += sizeof(question);
+
+    attempts++;
+    sent_time_ms = millis();
+    if (udp.beginPacket(server, DNS_PORT) == 0) {return false;}
+    udp.write(msg, len);
+    return udp.endPacket() != 0;
+}
+
+// Skip a (possibly compressed) domain name, 0 if malformed
+static size_t skip_name(const uint8_t *msg, const size_t len, size_t pos)
+{
+    while (pos < len) {
+        const auto label_len = msg[pos];
+        if (label_len == 0) {return pos + 1;}
+        if ((label_len & 0xc0) == 0xc0) {return pos + 2 <= len ? pos + 2 : 0;}
+        pos += 1 + label_len;
+    }
+
+    return 0;
+}
+
+bool dns_resolver::parse_response(const uint8_t *msg, const size_t len, IPAddress *ip_addr, uint32_t *ttl_s)
+{
+    if (len < 12) {return false;}
+    if (((msg[0] << 8) | msg[1]) != query_id) {return false;}
+    if ((msg[2] & 0x80) == 0 || (msg[3] & 0x0f) != 0) {return false;} // not a response, or an error
+
+    const int qdcount = (msg[4] << 8) | msg[5];
+    const int ancount = (msg[6] << 8) | msg[7];
+    size_t pos = 12;
+    for (int i = 0; i < qdcount; i++) {
+        pos = skip_name(msg, len, pos);
+        if (pos == 0 || pos + 4 > len) {return false;}
+        pos += 4;
+    }
+
+    for (int i = 0; i < ancount; i++) {
+        pos = skip_name(msg, len, pos);
+        if (pos == 0 || pos + 10 > len) {return false;}
+        const auto type = (msg[pos] << 8) | msg[pos + 1];
+        const auto cls = (msg[pos + 2] << 8) | msg[pos + 3];
+        const uint32_t ttl = (static_cast<uint32_t>(msg[pos + 4]) << 24) | (msg[pos + 5] << 16) | (msg[pos + 6] << 8) | msg[pos + 7];
+        const size_t rdlength = (msg[pos + 8] << 8) | msg[pos + 9];
+        pos += 10;
+        if (pos + rdlength > len) {return false;}
+        if (type == 1 && cls == 1 && rdlength == 4) {
+            *ip_addr = IPAddress(msg[pos], msg[pos + 1], msg[pos + 2], msg[pos + 3]);
+            *ttl_s = ttl;
+            return true;
+        }
+        pos += rdlength; // CNAME etc.
+    }
+
+    return false;
+}
+
+void dns_resolver::store(const IPAddress &ip_addr, const uint32_t ttl_s)
+{
+    if (ttl_s == 0) {return;}
+
+    // Replace an expired entry for the same name, otherwise the oldest one
+    auto *entry_ptr = &cache[cache_next];
+    for (auto &entry : cache) {
+        if (strcasecmp(entry.name, name) == 0) {entry_ptr = &entry;}
+    }
+    if (entry_ptr == &cache[cache_next]) {cache_next = (cache_next + 1) % CACHE_SIZE;}
+    auto &entry = *entry_ptr;
+    strcpy(entry.name, name);
+    entry.ip_addr = ip_addr;
+    entry.expires_ms = millis() + std::min(ttl_s, MAX_TTL_S) * 1000;
+    entry.valid = true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <IPAddress.h>
+#include <EthernetUdp.h>
+
+// Non-blocking DNS A record lookup with a small cache honouring the TTL.
+// start() sends the query and poll() is called from the network loop until
+// it returns Resolved or Failed, so the caller never waits for the server.
+// Single context (core1) only.
+class dns_resolver
+{
+    public:
+        enum class status {
+            Idle,
+            Busy,
+            Resolved,
+            Failed,
+        };
+        static constexpr size_t NAME_SIZE = 64;
+    private:
+        static constexpr int CACHE_SIZE = 4;
+        static constexpr uint16_t DNS_PORT = 53;
+        static constexpr unsigned long RETRY_INTERVAL_MS = 1000;
+        static constexpr int MAX_ATTEMPTS = 3;
+        static constexpr uint32_t MAX_TTL_S = 24 * 60 * 60;
+
+        struct cache_entry {
+            char name[NAME_SIZE];
+            IPAddress ip_addr;
+            unsigned long expires_ms;
+            bool valid;
+        };
+        cache_entry cache[CACHE_SIZE];
+        int cache_next;
+
+        EthernetUDP udp;
+        IPAddress server;
+        char name[NAME_SIZE];
+        uint16_t query_id;
+        int attempts;
+        unsigned long sent_time_ms;
+        status current;
+
+        bool send_query(void);
+        bool parse_response(const uint8_t *msg, const size_t len, IPAddress *ip_addr, uint32_t *ttl_s);
+        void store(const IPAddress &ip_addr, const uint32_t ttl_s);
+        void finish(const status result);
+    public:
+        dns_resolver();
+        bool lookup(const char *name, IPAddress *ip_addr);
+        void start(const IPAddress &server, const char *name);
+        status poll(IPAddress *ip_addr);
+        void cancel(void);
+};
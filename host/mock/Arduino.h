@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "pico.h"
+#include "pico/time.h"
+#include "hardware/sync.h"
+#include "WString.h"
+#include "IPAddress.h"
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(const unsigned long ms);
+void delayMicroseconds(const unsigned int us);
+void yield(void);
+
+void pinMode(const int pin, const int mode);
+void digitalWrite(const int pin, const int value);
+int digitalRead(const int pin);
+int digitalPinToInterrupt(const int pin);
+void attachInterrupt(const int interrupt, void (*callback)(void), const int mode);
+
+void noInterrupts(void);
+void interrupts(void);
+
+// UART0 on the board; on the host its output goes nowhere unless echoed (see host.h)
+class SerialUART
+{
+    public:
+        void begin(const unsigned long baud = 115200);
+        size_t write(const uint8_t *buffer, const size_t size);
+        size_t print(const char *str);
+        size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+        int availableForWrite(void);
+};
+
+extern SerialUART Serial1;
+
+// Core control used around flash writes
+class RP2040
+{
+    public:
+        void idleOtherCore(void);
+        void resumeOtherCore(void);
+};
+
+extern RP2040 rp2040;
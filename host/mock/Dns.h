@@ -0,0 +1,11 @@
+#pragma once
+
+#include "Ethernet.h"
+
+// The library's blocking resolver; the firmware has its own (dns_resolver)
+class DNSClient
+{
+    public:
+        void begin(const IPAddress &dns_server) {}
+        int getHostByName(const char *host_name, IPAddress &result, const uint16_t timeout = 5000) {return 0;}
+};
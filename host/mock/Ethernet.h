@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Arduino.h"
+#include "IPAddress.h"
+
+#define MAX_SOCK_NUM 8
+
+enum EthernetLinkStatus {
+    Unknown,
+    LinkON,
+    LinkOFF,
+};
+
+enum EthernetHardwareStatus {
+    EthernetNoHardware,
+    EthernetW5100,
+    EthernetW5200,
+    EthernetW5500,
+};
+
+// A W5x00 with MAX_SOCK_NUM sockets shared by TCP and UDP, each with 2 KB
+// of receive and transmit buffer. TCP sockets are loopback connections of
+// the host (see host::host_port()); every address reaches this host. UDP
+// datagrams go between the process's own mock sockets only. It reports a
+// W5100, which has no interrupt line, so the firmware polls without DMA.
+class EthernetClass
+{
+    public:
+        void init(const uint8_t ss_pin);
+        int begin(uint8_t *mac, const unsigned long timeout = 60000, const unsigned long response_timeout = 4000);
+        void begin(uint8_t *mac, const IPAddress ip, const IPAddress dns, const IPAddress gateway, const IPAddress subnet);
+        int maintain(void);
+        EthernetLinkStatus linkStatus(void);
+        EthernetHardwareStatus hardwareStatus(void);
+        IPAddress localIP(void);
+        IPAddress dnsServerIP(void);
+};
+
+extern EthernetClass Ethernet;
+
+class EthernetClient
+{
+    private:
+        uint8_t sockindex;
+    public:
+        EthernetClient() : sockindex(MAX_SOCK_NUM) {}
+        EthernetClient(const uint8_t s) : sockindex(s) {}
+        uint8_t status(void);
+        int connect(const IPAddress ip, const uint16_t port);
+        int connect(const char *host, const uint16_t port);
+        size_t write(const uint8_t b);
+        size_t write(const uint8_t *buf, const size_t size);
+        size_t write(const char *buf, const size_t size) {return write(reinterpret_cast<const uint8_t *>(buf), size);}
+        int availableForWrite(void);
+        int available(void);
+        int read(void);
+        int read(uint8_t *buf, const size_t size);
+        int peek(void);
+        void flush(void);
+        void stop(void);
+        uint8_t connected(void);
+        operator bool() {return sockindex < MAX_SOCK_NUM;}
+        bool operator==(const EthernetClient &other) const {return sockindex == other.sockindex;}
+        uint8_t getSocketNumber() const {return sockindex;}
+        uint16_t localPort(void);
+        IPAddress remoteIP(void);
+        uint16_t remotePort(void);
+        void setConnectionTimeout(const uint16_t timeout) {}
+};
+
+class EthernetServer
+{
+    private:
+        uint16_t port;
+    public:
+        EthernetServer(const uint16_t port) : port(port) {}
+        void begin(void);
+        EthernetClient available(void);
+        EthernetClient accept(void);
+};
+
+class EthernetUDP
+{
+    private:
+        uint8_t sockindex;
+        uint16_t port;
+        IPAddress remote_ip;
+        uint16_t remote_port;
+        std::vector<uint8_t> rx_packet;
+        size_t rx_pos;
+        IPAddress tx_ip;
+        uint16_t tx_port;
+        std::vector<uint8_t> tx_packet;
+    public:
+        EthernetUDP() : sockindex(MAX_SOCK_NUM), port(0), remote_port(0), rx_pos(0), tx_port(0) {}
+        uint8_t begin(const uint16_t port);
+        void stop(void);
+        int beginPacket(const IPAddress ip, const uint16_t port);
+        int beginPacket(const char *host, const uint16_t port);
+        int endPacket(void);
+        size_t write(const uint8_t byte);
+        size_t write(const uint8_t *buffer, const size_t size);
+        int parsePacket(void);
+        int available(void);
+        int read(void);
+        int read(uint8_t *buffer, const size_t len);
+        int read(char *buffer, const size_t len) {return read(reinterpret_cast<uint8_t *>(buffer), len);}
+        int peek(void);
+        void flush(void);
+        IPAddress remoteIP(void) {return remote_ip;}
+        uint16_t remotePort(void) {return remote_port;}
+        uint16_t localPort(void) {return port;}
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+
+#include "WString.h"
+
+// IPv4 only, stored in network byte order like the Arduino class
+class IPAddress
+{
+    private:
+        union {
+            uint8_t bytes[4];
+            uint32_t dword;
+        } address;
+    public:
+        IPAddress();
+        IPAddress(const uint8_t first_octet, const uint8_t second_octet, const uint8_t third_octet, const uint8_t fourth_octet);
+        IPAddress(const uint32_t address);
+        IPAddress(const uint8_t *address);
+        bool fromString(const char *address);
+        String toString() const;
+        operator uint32_t() const {return address.dword;}
+        bool operator==(const IPAddress &addr) const {return address.dword == addr.address.dword;}
+        bool operator!=(const IPAddress &addr) const {return !(*this == addr);}
+        bool operator==(const uint8_t *addr) const;
+        uint8_t operator[](const int index) const {return address.bytes[index];}
+        uint8_t &operator[](const int index) {return address.bytes[index];}
+        IPAddress &operator=(const uint8_t *address);
+        IPAddress &operator=(const uint32_t address);
+};
+
+extern const IPAddress INADDR_NONE;
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+class SPISettings
+{
+    public:
+        SPISettings() {}
+        SPISettings(const uint32_t clock, const int bit_order, const int data_mode) {}
+};
+
+class SPIClass
+{
+    public:
+        void begin(void) {}
+        void beginTransaction(const SPISettings settings) {}
+        void endTransaction(void) {}
+        uint8_t transfer(const uint8_t data) {return 0;}
+};
+
+extern SPIClass SPI;
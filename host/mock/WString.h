@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+// Just enough of Arduino's String for IPAddress::toString()
+class String
+{
+    private:
+        std::string str;
+    public:
+        String() {}
+        String(const char *s) : str(s) {}
+        const char *c_str() const {return str.c_str();}
+        unsigned int length() const {return str.length();}
+        bool operator==(const String &other) const {return str == other.str;}
+};
@@ -0,0 +1,638 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "Arduino.h"
+#include "SPI.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/resets.h"
+#include "hardware/spi.h"
+#include "hardware/sync.h"
+#include "pico/critical_section.h"
+#include "pico/platform.h"
+#include "pico/time.h"
+#include "pico/unique_id.h"
+
+#include "host.h"
+
+// Both cores are threads. Masking interrupts on a core takes that core's
+// (recursive) lock, and every interrupt handler runs holding core0's lock,
+// which is where the firmware's IRQs live. A handler therefore waits for
+// loop() to restore interrupts, just as on the chip.
+namespace {
+    thread_local unsigned current_core = 0;
+    std::recursive_mutex irq_locks[2];
+
+    std::mutex event_mutex;
+    std::condition_variable event_cv;
+    bool event_pending[2];
+
+    const auto boot_time = std::chrono::steady_clock::now();
+    std::atomic<bool> manual_clock(false);
+    std::atomic<uint64_t> manual_time_us(0);
+
+    std::atomic<bool> wfe_polling(false);
+
+    std::atomic<bool> lock_holds_enabled(false);
+    std::mutex lock_holds_mutex;
+    std::vector<uint32_t> lock_holds;
+
+    struct irq_entry {
+        irq_handler_t handler;
+        bool enabled;
+    };
+    std::mutex irq_table_mutex;
+    irq_entry irq_table[32];
+
+    struct alarm_entry {
+        uint64_t time_us;
+        alarm_callback_t callback;
+        void *user_data;
+    };
+    std::mutex alarm_mutex;
+    std::condition_variable alarm_cv;
+    std::map<alarm_id_t, alarm_entry> alarms;
+    alarm_id_t next_alarm_id = 1;
+    std::thread alarm_thread;
+    bool alarm_thread_stop = false;
+
+    bool serial_echo = getenv("ME56PS2_HOST_SERIAL") != nullptr && atoi(getenv("ME56PS2_HOST_SERIAL")) != 0;
+
+    void set_event(const unsigned core)
+    {
+        {
+            std::lock_guard<std::mutex> lk(event_mutex);
+            event_pending[core] = true;
+        }
+        event_cv.notify_all();
+    }
+
+    // Fire one due alarm; false when none is due
+    bool fire_due_alarm(void)
+    {
+        alarm_id_t id;
+        alarm_entry entry;
+        {
+            std::lock_guard<std::mutex> lk(alarm_mutex);
+            const auto now = host::now_us();
+            auto due = alarms.end();
+            for (auto it = alarms.begin(); it != alarms.end(); ++it) {
+                if (it->second.time_us <= now && (due == alarms.end() || it->second.time_us < due->second.time_us)) {due = it;}
+            }
+            if (due == alarms.end()) {return false;}
+            id = due->first;
+            entry = due->second;
+            alarms.erase(due);
+        }
+
+        int64_t reschedule = 0;
+        host::run_as_irq([&] {reschedule = entry.callback(id, entry.user_data);});
+        set_event(0);
+        if (reschedule != 0) {
+            std::lock_guard<std::mutex> lk(alarm_mutex);
+            entry.time_us = reschedule > 0 ? host::now_us() + reschedule : entry.time_us - reschedule;
+            alarms[id] = entry;
+        }
+        return true;
+    }
+
+    void alarm_thread_main(void)
+    {
+        std::unique_lock<std::mutex> lk(alarm_mutex);
+        while (!alarm_thread_stop) {
+            uint64_t next = UINT64_MAX;
+            for (const auto &alarm : alarms) {
+                next = std::min(next, alarm.second.time_us);
+            }
+            const auto now = host::now_us();
+            if (next > now) {
+                if (next == UINT64_MAX) {
+                    alarm_cv.wait(lk);
+                } else {
+                    alarm_cv.wait_for(lk, std::chrono::microseconds(next - now));
+                }
+                continue;
+            }
+            lk.unlock();
+            while (fire_due_alarm()) {}
+            lk.lock();
+        }
+    }
+}
+
+namespace host {
+    void set_core(const unsigned core)
+    {
+        current_core = core;
+    }
+
+    unsigned get_core(void)
+    {
+        return current_core;
+    }
+
+    void set_wfe_polling(const bool enable)
+    {
+        wfe_polling = enable;
+    }
+
+    void record_lock_holds(const bool enable)
+    {
+        lock_holds_enabled = enable;
+    }
+
+    std::vector<uint32_t> take_lock_holds(void)
+    {
+        std::lock_guard<std::mutex> lk(lock_holds_mutex);
+        std::vector<uint32_t> taken;
+        taken.swap(lock_holds);
+        return taken;
+    }
+
+    uint64_t now_us(void)
+    {
+        if (manual_clock) {return manual_time_us;}
+
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - boot_time).count();
+    }
+
+    void use_manual_clock(void)
+    {
+        manual_time_us = now_us();
+        manual_clock = true;
+    }
+
+    void advance_us(const uint64_t us)
+    {
+        const auto target = manual_time_us + us;
+        // Alarms due on the way fire at their own time
+        while (true) {
+            uint64_t next = UINT64_MAX;
+            {
+                std::lock_guard<std::mutex> lk(alarm_mutex);
+                for (const auto &alarm : alarms) {
+                    next = std::min(next, alarm.second.time_us);
+                }
+            }
+            if (next > target) {break;}
+            manual_time_us = std::max(static_cast<uint64_t>(manual_time_us), next);
+            fire_due_alarm();
+        }
+        manual_time_us = target;
+    }
+
+    void stop_alarms(void)
+    {
+        {
+            std::lock_guard<std::mutex> lk(alarm_mutex);
+            alarm_thread_stop = true;
+            alarms.clear();
+        }
+        alarm_cv.notify_all();
+        if (alarm_thread.joinable()) {alarm_thread.join();}
+    }
+
+    void run_as_irq(const std::function<void()> &fn)
+    {
+        std::lock_guard<std::recursive_mutex> lk(irq_locks[0]);
+        const auto core = current_core;
+        current_core = 0;
+        fn();
+        current_core = core;
+    }
+
+    void raise_irq(const unsigned num)
+    {
+        irq_handler_t handler;
+        {
+            std::lock_guard<std::mutex> lk(irq_table_mutex);
+            if (!irq_table[num].enabled) {return;}
+            handler = irq_table[num].handler;
+        }
+        if (handler == nullptr) {return;}
+        run_as_irq(handler);
+        // Taking an interrupt also ends a WFE
+        set_event(0);
+    }
+
+    void set_serial_echo(const bool enable)
+    {
+        serial_echo = enable;
+    }
+}
+
+// pico/platform.h, hardware/sync.h
+unsigned get_core_num(void)
+{
+    return current_core;
+}
+
+uint32_t save_and_disable_interrupts(void)
+{
+    irq_locks[current_core].lock();
+    return 0;
+}
+
+void restore_interrupts(const uint32_t status)
+{
+    irq_locks[current_core].unlock();
+}
+
+void __sev(void)
+{
+    set_event(0);
+    set_event(1);
+}
+
+void __wfe(void)
+{
+    std::unique_lock<std::mutex> lk(event_mutex);
+    event_cv.wait(lk, [] {return event_pending[current_core];});
+    event_pending[current_core] = false;
+}
+
+void __wfi(void)
+{
+    __wfe();
+}
+
+void __dmb(void)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+// pico/critical_section.h
+void critical_section_init(critical_section_t *crit_sec)
+{
+}
+
+void critical_section_deinit(critical_section_t *crit_sec)
+{
+}
+
+void critical_section_enter_blocking(critical_section_t *crit_sec)
+{
+    const auto saved = save_and_disable_interrupts();
+    crit_sec->lock.lock();
+    crit_sec->saved_irq = saved;
+    crit_sec->entered = std::chrono::steady_clock::now();
+}
+
+void critical_section_exit(critical_section_t *crit_sec)
+{
+    const auto saved = crit_sec->saved_irq;
+    if (lock_holds_enabled) {
+        const auto held = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - crit_sec->entered).count();
+        std::lock_guard<std::mutex> lk(lock_holds_mutex);
+        lock_holds.push_back(static_cast<uint32_t>(held));
+    }
+    crit_sec->lock.unlock();
+    restore_interrupts(saved);
+}
+
+// pico/time.h
+uint64_t time_us_64(void)
+{
+    return host::now_us();
+}
+
+uint32_t time_us_32(void)
+{
+    return static_cast<uint32_t>(host::now_us());
+}
+
+absolute_time_t get_absolute_time(void)
+{
+    return host::now_us();
+}
+
+uint64_t to_us_since_boot(const absolute_time_t t)
+{
+    return t;
+}
+
+uint32_t to_ms_since_boot(const absolute_time_t t)
+{
+    return t / 1000;
+}
+
+absolute_time_t delayed_by_us(const absolute_time_t t, const uint64_t us)
+{
+    return t + us;
+}
+
+absolute_time_t delayed_by_ms(const absolute_time_t t, const uint32_t ms)
+{
+    return t + ms * 1000ull;
+}
+
+absolute_time_t make_timeout_time_us(const uint64_t us)
+{
+    return host::now_us() + us;
+}
+
+absolute_time_t make_timeout_time_ms(const uint32_t ms)
+{
+    return host::now_us() + ms * 1000ull;
+}
+
+int64_t absolute_time_diff_us(const absolute_time_t from, const absolute_time_t to)
+{
+    return static_cast<int64_t>(to - from);
+}
+
+bool time_reached(const absolute_time_t t)
+{
+    return host::now_us() >= t;
+}
+
+// True when the timeout was reached rather than an event or interrupt
+bool best_effort_wfe_or_timeout(const absolute_time_t timeout_timestamp)
+{
+    if (manual_clock) {return true;}
+    if (wfe_polling) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return true;
+    }
+
+    std::unique_lock<std::mutex> lk(event_mutex);
+    const auto now = host::now_us();
+    const auto woken = timeout_timestamp > now
+        && event_cv.wait_for(lk, std::chrono::microseconds(timeout_timestamp - now), [] {return event_pending[current_core];});
+    if (!woken && !event_pending[current_core]) {return true;}
+    event_pending[current_core] = false;
+    return false;
+}
+
+void sleep_us(const uint64_t us)
+{
+    if (manual_clock) {
+        host::advance_us(us);
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void sleep_ms(const uint32_t ms)
+{
+    sleep_us(ms * 1000ull);
+}
+
+alarm_id_t add_alarm_at(const absolute_time_t time, alarm_callback_t callback, void *user_data, const bool fire_if_past)
+{
+    if (time <= host::now_us() && !fire_if_past) {return 0;}
+
+    alarm_id_t id;
+    {
+        std::lock_guard<std::mutex> lk(alarm_mutex);
+        if (alarm_thread_stop) {return -1;}
+        id = next_alarm_id++;
+        if (next_alarm_id <= 0) {next_alarm_id = 1;}
+        alarms[id] = {time, callback, user_data};
+        if (!manual_clock && !alarm_thread.joinable()) {alarm_thread = std::thread(alarm_thread_main);}
+    }
+    alarm_cv.notify_all();
+
+    return id;
+}
+
+alarm_id_t add_alarm_in_us(const uint64_t us, alarm_callback_t callback, void *user_data, const bool fire_if_past)
+{
+    return add_alarm_at(host::now_us() + us, callback, user_data, fire_if_past);
+}
+
+alarm_id_t add_alarm_in_ms(const uint32_t ms, alarm_callback_t callback, void *user_data, const bool fire_if_past)
+{
+    return add_alarm_in_us(ms * 1000ull, callback, user_data, fire_if_past);
+}
+
+bool cancel_alarm(const alarm_id_t id)
+{
+    std::lock_guard<std::mutex> lk(alarm_mutex);
+    return alarms.erase(id) > 0;
+}
+
+// hardware/irq.h
+void irq_set_enabled(const unsigned num, const bool enabled)
+{
+    std::lock_guard<std::mutex> lk(irq_table_mutex);
+    irq_table[num].enabled = enabled;
+}
+
+bool irq_is_enabled(const unsigned num)
+{
+    std::lock_guard<std::mutex> lk(irq_table_mutex);
+    return irq_table[num].enabled;
+}
+
+void irq_set_exclusive_handler(const unsigned num, irq_handler_t handler)
+{
+    std::lock_guard<std::mutex> lk(irq_table_mutex);
+    irq_table[num].handler = handler;
+}
+
+irq_handler_t irq_get_exclusive_handler(const unsigned num)
+{
+    std::lock_guard<std::mutex> lk(irq_table_mutex);
+    return irq_table[num].handler;
+}
+
+void irq_remove_handler(const unsigned num, irq_handler_t handler)
+{
+    std::lock_guard<std::mutex> lk(irq_table_mutex);
+    if (irq_table[num].handler == handler) {irq_table[num].handler = nullptr;}
+}
+
+void irq_set_priority(const unsigned num, const uint8_t hardware_priority)
+{
+}
+
+void irq_clear(const unsigned num)
+{
+}
+
+// hardware/resets.h
+void reset_block(const uint32_t bits)
+{
+}
+
+void unreset_block_wait(const uint32_t bits)
+{
+}
+
+// hardware/dma.h, hardware/spi.h: linked, never used (see hardware/dma.h)
+int dma_claim_unused_channel(const bool required)
+{
+    if (required) {abort();}
+    return -1;
+}
+
+dma_channel_config dma_channel_get_default_config(const unsigned channel)
+{
+    return {0};
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config *c, const enum dma_channel_transfer_size size)
+{
+}
+
+void channel_config_set_dreq(dma_channel_config *c, const unsigned dreq)
+{
+}
+
+void channel_config_set_read_increment(dma_channel_config *c, const bool incr)
+{
+}
+
+void channel_config_set_write_increment(dma_channel_config *c, const bool incr)
+{
+}
+
+void dma_channel_configure(const unsigned channel, const dma_channel_config *config, volatile void *write_addr, const volatile void *read_addr, const unsigned transfer_count, const bool trigger)
+{
+}
+
+void dma_start_channel_mask(const uint32_t chan_mask)
+{
+    abort();
+}
+
+void dma_channel_wait_for_finish_blocking(const unsigned channel)
+{
+}
+
+spi_inst_t *const spi0 = nullptr;
+
+spi_hw_t *spi_get_hw(spi_inst_t *spi)
+{
+    static spi_hw_t hw;
+    return &hw;
+}
+
+unsigned spi_get_dreq(spi_inst_t *spi, const bool is_tx)
+{
+    return 0;
+}
+
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, const size_t len)
+{
+    return len;
+}
+
+SPIClass SPI;
+
+// pico/unique_id.h
+void pico_get_unique_board_id(pico_unique_board_id_t *id_out)
+{
+    for (int i = 0; i < PICO_UNIQUE_BOARD_ID_SIZE_BYTES; i++) {
+        id_out->id[i] = 0xe0 + i;
+    }
+}
+
+// Arduino.h
+unsigned long millis(void)
+{
+    return host::now_us() / 1000;
+}
+
+unsigned long micros(void)
+{
+    return static_cast<unsigned long>(host::now_us());
+}
+
+void delay(const unsigned long ms)
+{
+    sleep_ms(ms);
+}
+
+void delayMicroseconds(const unsigned int us)
+{
+    sleep_us(us);
+}
+
+void yield(void)
+{
+    std::this_thread::yield();
+}
+
+void pinMode(const int pin, const int mode)
+{
+}
+
+void digitalWrite(const int pin, const int value)
+{
+}
+
+int digitalRead(const int pin)
+{
+    return HIGH;
+}
+
+int digitalPinToInterrupt(const int pin)
+{
+    return pin;
+}
+
+void attachInterrupt(const int interrupt, void (*callback)(void), const int mode)
+{
+}
+
+void noInterrupts(void)
+{
+    save_and_disable_interrupts();
+}
+
+void interrupts(void)
+{
+    restore_interrupts(0);
+}
+
+void SerialUART::begin(const unsigned long baud)
+{
+}
+
+size_t SerialUART::write(const uint8_t *buffer, const size_t size)
+{
+    if (serial_echo) {fwrite(buffer, 1, size, stderr);}
+    return size;
+}
+
+size_t SerialUART::print(const char *str)
+{
+    return write(reinterpret_cast<const uint8_t *>(str), strlen(str));
+}
+
+size_t SerialUART::printf(const char *format, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+
+    return print(buf);
+}
+
+int SerialUART::availableForWrite(void)
+{
+    return 32; // the UART FIFO
+}
+
+SerialUART Serial1;
+
+// The other core keeps running: flash is ordinary memory here
+void RP2040::idleOtherCore(void)
+{
+}
+
+void RP2040::resumeOtherCore(void)
+{
+}
+
+RP2040 rp2040;
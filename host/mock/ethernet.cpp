@@ -0,0 +1,692 @@
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include "Ethernet.h"
+#include "utility/w5100.h"
+
+#include "host.h"
+
+// After IPAddress.h: netinet/in.h defines INADDR_NONE as a macro
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// The chip's sockets. TCP data moves between the 2 KB socket buffers and
+// the host connection whenever the firmware touches the socket (pump()), so
+// a full receive buffer closes the TCP window just as on the chip.
+namespace {
+    constexpr size_t SOCKET_BUFFER_SIZE = 2048;
+
+    class byte_fifo
+    {
+        private:
+            uint8_t data[SOCKET_BUFFER_SIZE];
+            size_t head = 0;
+            size_t count = 0;
+        public:
+            size_t size(void) const {return count;}
+            size_t free(void) const {return SOCKET_BUFFER_SIZE - count;}
+            void clear(void) {head = count = 0;}
+            size_t push(const uint8_t *src, const size_t len)
+            {
+                const auto n = std::min(len, free());
+                for (size_t i = 0; i < n; i++) {
+                    data[(head + count + i) % SOCKET_BUFFER_SIZE] = src[i];
+                }
+                count += n;
+                return n;
+            }
+            size_t peek(const uint8_t **span) const
+            {
+                *span = &data[head];
+                return std::min(count, SOCKET_BUFFER_SIZE - head);
+            }
+            void consume(const size_t len)
+            {
+                head = (head + len) % SOCKET_BUFFER_SIZE;
+                count -= len;
+            }
+            size_t pop(uint8_t *dst, const size_t len)
+            {
+                size_t n = 0;
+                while (n < len && count > 0) {
+                    const uint8_t *span;
+                    const auto span_len = std::min(peek(&span), len - n);
+                    memcpy(&dst[n], span, span_len);
+                    consume(span_len);
+                    n += span_len;
+                }
+                return n;
+            }
+    };
+
+    struct datagram {
+        uint64_t due_us;
+        uint16_t from_port;
+        std::vector<uint8_t> data;
+    };
+
+    struct mock_socket {
+        uint8_t status = SnSR::CLOSED;
+        uint16_t port = 0;        // local port as the firmware sees it
+        int fd = -1;              // TCP connection on the host
+        uint16_t server_port = 0; // connection of an EthernetServer not returned by accept() yet
+        bool closing = false;     // DISCON issued: FIN once the transmit buffer is sent
+        byte_fifo rx, tx;
+        std::deque<datagram> datagrams; // UDP, in order of arrival time
+    };
+
+    std::recursive_mutex chip_mutex;
+    mock_socket sockets[MAX_SOCK_NUM];
+    std::map<uint16_t, int> listeners; // by firmware port, kept open across LISTEN sockets
+
+    double udp_loss = 0;
+    uint32_t udp_delay_us = 0;
+    uint32_t udp_jitter_us = 0;
+    std::mt19937 udp_rng(1);
+
+    const IPAddress loopback(127, 0, 0, 1);
+
+    int get_port_offset(void)
+    {
+        const char *env = getenv("ME56PS2_HOST_PORT_OFFSET");
+        return env != nullptr ? atoi(env) : 0;
+    }
+
+    sockaddr_in host_address(const uint16_t port)
+    {
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(host::host_port(port));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return addr;
+    }
+
+    void set_nodelay(const int fd)
+    {
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    uint8_t allocate(const uint8_t status, const uint16_t port)
+    {
+        for (uint8_t s = 0; s < MAX_SOCK_NUM; s++) {
+            if (sockets[s].status != SnSR::CLOSED) {continue;}
+            sockets[s].status = status;
+            sockets[s].port = port;
+            return s;
+        }
+        return MAX_SOCK_NUM;
+    }
+
+    void close_socket(const uint8_t s)
+    {
+        auto &sock = sockets[s];
+        if (sock.fd >= 0) {close(sock.fd);}
+        sock.fd = -1;
+        sock.status = SnSR::CLOSED;
+        sock.server_port = 0;
+        sock.closing = false;
+        sock.rx.clear();
+        sock.tx.clear();
+        sock.datagrams.clear();
+    }
+
+    int get_listener(const uint16_t port)
+    {
+        const auto it = listeners.find(port);
+        if (it != listeners.end()) {return it->second;}
+
+        const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        const int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        const auto addr = host_address(port);
+        if (bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, 8) != 0) {
+            fprintf(stderr, "ethernet: cannot listen on port %u (host port %u): %s\n", port, host::host_port(port), strerror(errno));
+            close(fd);
+            return -1;
+        }
+        listeners[port] = fd;
+        return fd;
+    }
+
+    // Move data between the socket buffers and the host connection
+    void pump(const uint8_t s)
+    {
+        auto &sock = sockets[s];
+        if (sock.status == SnSR::LISTEN) {
+            const int fd = accept4(get_listener(sock.port), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {return;}
+            set_nodelay(fd);
+            sock.fd = fd;
+            sock.status = SnSR::ESTABLISHED;
+        }
+        if (sock.fd < 0) {return;}
+
+        while (sock.tx.size() > 0) {
+            const uint8_t *span;
+            const auto len = sock.tx.peek(&span);
+            const auto sent = send(sock.fd, span, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (sent > 0) {
+                sock.tx.consume(sent);
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {break;}
+            close_socket(s); // reset by the peer
+            return;
+        }
+        if (sock.closing && sock.tx.size() == 0 && sock.status != SnSR::FIN_WAIT) {
+            shutdown(sock.fd, SHUT_WR);
+            if (sock.status == SnSR::CLOSE_WAIT) {
+                close_socket(s); // both sides are done
+                return;
+            }
+            sock.status = SnSR::FIN_WAIT;
+        }
+
+        while (sock.status == SnSR::ESTABLISHED || sock.status == SnSR::FIN_WAIT) {
+            uint8_t buf[SOCKET_BUFFER_SIZE];
+            // A closing socket is not read by anyone: keep draining until the peer's FIN
+            const auto room = sock.status == SnSR::FIN_WAIT ? sizeof(buf) : sock.rx.free();
+            if (room == 0) {break;}
+            const auto received = recv(sock.fd, buf, room, MSG_DONTWAIT);
+            if (received > 0) {
+                if (sock.status == SnSR::ESTABLISHED) {sock.rx.push(buf, received);}
+                continue;
+            }
+            if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {break;}
+            if (received == 0 && sock.status == SnSR::ESTABLISHED) {
+                sock.status = SnSR::CLOSE_WAIT;
+            } else {
+                close_socket(s);
+            }
+            break;
+        }
+    }
+
+    void pump_all(void)
+    {
+        for (uint8_t s = 0; s < MAX_SOCK_NUM; s++) {
+            pump(s);
+        }
+    }
+
+    void deliver(const uint16_t from_port, const uint16_t to_port, const std::vector<uint8_t> &data)
+    {
+        if (udp_loss > 0 && std::uniform_real_distribution<double>(0, 1)(udp_rng) < udp_loss) {return;}
+
+        const uint64_t jitter = udp_jitter_us > 0 ? std::uniform_int_distribution<uint32_t>(0, udp_jitter_us)(udp_rng) : 0;
+        const auto due = host::now_us() + udp_delay_us + jitter;
+        for (auto &sock : sockets) {
+            if (sock.status != SnSR::UDP || sock.port != to_port) {continue;}
+            auto it = sock.datagrams.end();
+            while (it != sock.datagrams.begin() && std::prev(it)->due_us > due) {
+                --it;
+            }
+            sock.datagrams.insert(it, {due, from_port, data});
+            return;
+        }
+    }
+}
+
+namespace host {
+    uint16_t host_port(const uint16_t port)
+    {
+        static const int offset = get_port_offset();
+        return port + offset + (port < 1024 ? 20000 : 0);
+    }
+
+    void set_udp_impairment(const double loss, const uint32_t delay_us, const uint32_t jitter_us, const uint32_t seed)
+    {
+        std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+        udp_loss = loss;
+        udp_delay_us = delay_us;
+        udp_jitter_us = jitter_us;
+        udp_rng.seed(seed);
+    }
+}
+
+EthernetClass Ethernet;
+W5100Class W5100;
+
+void EthernetClass::init(const uint8_t ss_pin)
+{
+}
+
+int EthernetClass::begin(uint8_t *mac, const unsigned long timeout, const unsigned long response_timeout)
+{
+    return 1;
+}
+
+void EthernetClass::begin(uint8_t *mac, const IPAddress ip, const IPAddress dns, const IPAddress gateway, const IPAddress subnet)
+{
+}
+
+int EthernetClass::maintain(void)
+{
+    return 0;
+}
+
+EthernetLinkStatus EthernetClass::linkStatus(void)
+{
+    return LinkON;
+}
+
+EthernetHardwareStatus EthernetClass::hardwareStatus(void)
+{
+    return EthernetW5100;
+}
+
+IPAddress EthernetClass::localIP(void)
+{
+    return loopback;
+}
+
+IPAddress EthernetClass::dnsServerIP(void)
+{
+    return loopback;
+}
+
+uint8_t EthernetClient::status(void)
+{
+    if (sockindex >= MAX_SOCK_NUM) {return SnSR::CLOSED;}
+
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    pump(sockindex);
+    return sockets[sockindex].status;
+}
+
+// Blocks like the library (up to its 1 s default timeout); every address reaches this host
+int EthernetClient::connect(const IPAddress ip, const uint16_t port)
+{
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    if (sockindex < MAX_SOCK_NUM) {
+        close_socket(sockindex);
+        sockindex = MAX_SOCK_NUM;
+    }
+
+    const auto s = allocate(SnSR::INIT, 0);
+    if (s >= MAX_SOCK_NUM) {return 0;}
+
+    const int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    const auto addr = host_address(port);
+    auto result = ::connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr));
+    if (result != 0 && errno == EINPROGRESS) {
+        pollfd pfd = {fd, POLLOUT, 0};
+        int error = ETIMEDOUT;
+        socklen_t error_len = sizeof(error);
+        if (poll(&pfd, 1, 1000) == 1) {getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len);}
+        result = error == 0 ? 0 : -1;
+    }
+    if (result != 0) {
+        close(fd);
+        close_socket(s);
+        return 0;
+    }
+
+    set_nodelay(fd);
+    sockaddr_in local = {};
+    socklen_t local_len = sizeof(local);
+    getsockname(fd, reinterpret_cast<sockaddr *>(&local), &local_len);
+    sockets[s].fd = fd;
+    sockets[s].port = ntohs(local.sin_port);
+    sockets[s].status = SnSR::ESTABLISHED;
+    sockindex = s;
+    return 1;
+}
+
+int EthernetClient::connect(const char *host, const uint16_t port)
+{
+    IPAddress ip;
+    if (!ip.fromString(host)) {return 0;}
+    return connect(ip, port);
+}
+
+size_t EthernetClient::write(const uint8_t b)
+{
+    return write(&b, 1);
+}
+
+// Waits for room like the library; returns early when the connection is gone
+size_t EthernetClient::write(const uint8_t *buf, const size_t size)
+{
+    if (sockindex >= MAX_SOCK_NUM) {return 0;}
+
+    size_t written = 0;
+    while (true) {
+        {
+            std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+            auto &sock = sockets[sockindex];
+            if (sock.status != SnSR::ESTABLISHED && sock.status != SnSR::CLOSE_WAIT) {return written;}
+            written += sock.tx.push(&buf[written], size - written);
+            pump(sockindex);
+        }
+        if (written == size) {return written;}
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+int EthernetClient::availableForWrite(void)
+{
+    if (sockindex >= MAX_SOCK_NUM) {return 0;}
+
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    pump(sockindex);
+    const auto &sock = sockets[sockindex];
+    if (sock.status != SnSR::ESTABLISHED && sock.status != SnSR::CLOSE_WAIT) {return 0;}
+    return sock.tx.free();
+}
+
+int EthernetClient::available(void)
+{
+    if (sockindex >= MAX_SOCK_NUM) {return 0;}
+
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    pump(sockindex);
+    return sockets[sockindex].rx.size();
+}
+
+int EthernetClient::read(void)
+{
+    uint8_t b;
+    return read(&b, 1) > 0 ? b : -1;
+}
+
+// 0 once the connection is closing and drained, -1 while it is open but empty
+int EthernetClient::read(uint8_t *buf, const size_t size)
+{
+    if (sockindex >= MAX_SOCK_NUM) {return 0;}
+
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    pump(sockindex);
+    auto &sock = sockets[sockindex];
+    const auto n = sock.rx.pop(buf, size);
+    if (n > 0) {
+        pump(sockindex); // the window opens again (RECV)
+        return n;
+    }
+    const auto status = sock.status;
+    return status == SnSR::LISTEN || status == SnSR::CLOSED || status == SnSR::CLOSE_WAIT ? 0 : -1;
+}
+
+int EthernetClient::peek(void)
+{
+    if (sockindex >= MAX_SOCK_NUM) {return -1;}
+
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    pump(sockindex);
+    const uint8_t *span;
+    return sockets[sockindex].rx.peek(&span) > 0 ? span[0] : -1;
+}
+
+void EthernetClient::flush(void)
+{
+    while (sockindex < MAX_SOCK_NUM) {
+        {
+            std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+            pump(sockindex);
+            const auto &sock = sockets[sockindex];
+            if (sock.tx.size() == 0 || sock.fd < 0) {return;}
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+// DISCON, then wait up to a second for the peer to close before giving up, like the library
+void EthernetClient::stop(void)
+{
+    if (sockindex >= MAX_SOCK_NUM) {return;}
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    {
+        std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+        sockets[sockindex].closing = true;
+    }
+    while (std::chrono::steady_clock::now() < deadline) {
+        {
+            std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+            pump(sockindex);
+            if (sockets[sockindex].status == SnSR::CLOSED) {break;}
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    close_socket(sockindex);
+    sockindex = MAX_SOCK_NUM;
+}
+
+uint8_t EthernetClient::connected(void)
+{
+    if (sockindex >= MAX_SOCK_NUM) {return 0;}
+
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    pump(sockindex);
+    const auto &sock = sockets[sockindex];
+    const auto s = sock.status;
+    return !(s == SnSR::LISTEN || s == SnSR::CLOSED || s == SnSR::FIN_WAIT || (s == SnSR::CLOSE_WAIT && sock.rx.size() == 0));
+}
+
+uint16_t EthernetClient::localPort(void)
+{
+    if (sockindex >= MAX_SOCK_NUM) {return 0;}
+
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    return sockets[sockindex].port;
+}
+
+IPAddress EthernetClient::remoteIP(void)
+{
+    return loopback;
+}
+
+uint16_t EthernetClient::remotePort(void)
+{
+    if (sockindex >= MAX_SOCK_NUM) {return 0;}
+
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    sockaddr_in peer = {};
+    socklen_t peer_len = sizeof(peer);
+    if (sockets[sockindex].fd < 0 || getpeername(sockets[sockindex].fd, reinterpret_cast<sockaddr *>(&peer), &peer_len) != 0) {return 0;}
+    return ntohs(peer.sin_port);
+}
+
+void EthernetServer::begin(void)
+{
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    if (get_listener(port) < 0) {return;}
+
+    const auto s = allocate(SnSR::LISTEN, port);
+    if (s < MAX_SOCK_NUM) {sockets[s].server_port = port;}
+}
+
+// Like the library: a connection is returned once, and listening resumes on a new socket
+EthernetClient EthernetServer::accept(void)
+{
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    bool listening = false;
+    uint8_t sockindex = MAX_SOCK_NUM;
+    for (uint8_t s = 0; s < MAX_SOCK_NUM; s++) {
+        auto &sock = sockets[s];
+        if (sock.server_port != port) {continue;}
+        pump(s);
+        if (sockindex == MAX_SOCK_NUM && (sock.status == SnSR::ESTABLISHED || sock.status == SnSR::CLOSE_WAIT)) {
+            sockindex = s;
+            sock.server_port = 0;
+        } else if (sock.status == SnSR::LISTEN) {
+            listening = true;
+        } else if (sock.status == SnSR::CLOSED) {
+            sock.server_port = 0;
+        }
+    }
+    if (!listening) {begin();}
+
+    return EthernetClient(sockindex);
+}
+
+EthernetClient EthernetServer::available(void)
+{
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    bool listening = false;
+    uint8_t sockindex = MAX_SOCK_NUM;
+    for (uint8_t s = 0; s < MAX_SOCK_NUM; s++) {
+        auto &sock = sockets[s];
+        if (sock.server_port != port && !(sock.port == port && sock.status != SnSR::UDP)) {continue;}
+        pump(s);
+        if (sock.status == SnSR::LISTEN) {
+            listening = true;
+        } else if (sockindex == MAX_SOCK_NUM && (sock.status == SnSR::ESTABLISHED || sock.status == SnSR::CLOSE_WAIT) && sock.rx.size() > 0) {
+            sockindex = s;
+        }
+    }
+    if (!listening) {begin();}
+
+    return EthernetClient(sockindex);
+}
+
+uint8_t EthernetUDP::begin(const uint16_t port)
+{
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    if (sockindex < MAX_SOCK_NUM) {close_socket(sockindex);}
+
+    sockindex = allocate(SnSR::UDP, port);
+    if (sockindex >= MAX_SOCK_NUM) {return 0;}
+    this->port = port;
+    rx_packet.clear();
+    rx_pos = 0;
+    return 1;
+}
+
+void EthernetUDP::stop(void)
+{
+    if (sockindex >= MAX_SOCK_NUM) {return;}
+
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    close_socket(sockindex);
+    sockindex = MAX_SOCK_NUM;
+}
+
+int EthernetUDP::beginPacket(const IPAddress ip, const uint16_t port)
+{
+    if (sockindex >= MAX_SOCK_NUM) {return 0;}
+
+    tx_ip = ip;
+    tx_port = port;
+    tx_packet.clear();
+    return 1;
+}
+
+int EthernetUDP::beginPacket(const char *host, const uint16_t port)
+{
+    IPAddress ip;
+    if (!ip.fromString(host)) {return 0;}
+    return beginPacket(ip, port);
+}
+
+int EthernetUDP::endPacket(void)
+{
+    if (sockindex >= MAX_SOCK_NUM) {return 0;}
+
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    deliver(port, tx_port, tx_packet);
+    tx_packet.clear();
+    return 1;
+}
+
+size_t EthernetUDP::write(const uint8_t byte)
+{
+    return write(&byte, 1);
+}
+
+size_t EthernetUDP::write(const uint8_t *buffer, const size_t size)
+{
+    const auto n = std::min(size, SOCKET_BUFFER_SIZE - tx_packet.size());
+    tx_packet.insert(tx_packet.end(), buffer, buffer + n);
+    return n;
+}
+
+// Next datagram that has arrived by now; the rest of the previous one is dropped
+int EthernetUDP::parsePacket(void)
+{
+    rx_packet.clear();
+    rx_pos = 0;
+    if (sockindex >= MAX_SOCK_NUM) {return 0;}
+
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    auto &queue = sockets[sockindex].datagrams;
+    if (queue.empty() || queue.front().due_us > host::now_us()) {return 0;}
+
+    rx_packet = std::move(queue.front().data);
+    remote_ip = loopback;
+    remote_port = queue.front().from_port;
+    queue.pop_front();
+    return rx_packet.size();
+}
+
+int EthernetUDP::available(void)
+{
+    return rx_packet.size() - rx_pos;
+}
+
+int EthernetUDP::read(void)
+{
+    return rx_pos < rx_packet.size() ? rx_packet[rx_pos++] : -1;
+}
+
+int EthernetUDP::read(uint8_t *buffer, const size_t len)
+{
+    if (rx_pos >= rx_packet.size()) {return -1;}
+
+    const auto n = std::min(len, rx_packet.size() - rx_pos);
+    memcpy(buffer, &rx_packet[rx_pos], n);
+    rx_pos += n;
+    return n;
+}
+
+int EthernetUDP::peek(void)
+{
+    return rx_pos < rx_packet.size() ? rx_packet[rx_pos] : -1;
+}
+
+void EthernetUDP::flush(void)
+{
+    rx_pos = rx_packet.size();
+}
+
+uint16_t W5100Class::read(const uint16_t addr, uint8_t *buf, const uint16_t len)
+{
+    memset(buf, 0, len);
+    return len;
+}
+
+void W5100Class::execCmdSn(const SOCKET s, const SockCMD cmd)
+{
+    if (s >= MAX_SOCK_NUM) {return;}
+
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    if (cmd == Sock_DISCON) {
+        sockets[s].closing = true;
+        pump(s);
+    } else if (cmd == Sock_CLOSE) {
+        close_socket(s);
+    }
+}
+
+uint8_t W5100Class::readSnSR(const SOCKET s)
+{
+    if (s >= MAX_SOCK_NUM) {return SnSR::CLOSED;}
+
+    std::lock_guard<std::recursive_mutex> lk(chip_mutex);
+    pump(s);
+    return sockets[s].status;
+}
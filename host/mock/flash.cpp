@@ -0,0 +1,68 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "hardware/flash.h"
+#include "hardware/regs/addressmap.h"
+
+#include "host.h"
+
+// Starts out erased like a new chip. The linker places _EEPROM_start (and
+// the filesystem bounds) inside it, as arduino-pico's linker script does.
+extern "C" {
+    alignas(FLASH_SECTOR_SIZE) uint8_t host_flash[HOST_FLASH_SIZE];
+}
+
+static struct host_flash_init {
+    host_flash_init() {memset(host_flash, 0xff, sizeof(host_flash));}
+} flash_init;
+
+static int write_limit = -1;
+static int writes_dropped = 0;
+
+void host::set_flash_write_limit(const int operations)
+{
+    write_limit = operations;
+    writes_dropped = 0;
+}
+
+int host::get_flash_writes_dropped(void)
+{
+    return writes_dropped;
+}
+
+// false once the power is cut
+static bool flash_powered(void)
+{
+    if (write_limit < 0) {return true;}
+    if (write_limit == 0) {
+        writes_dropped++;
+        return false;
+    }
+    write_limit--;
+    return true;
+}
+
+static void check_range(const uint32_t flash_offs, const size_t count, const size_t align)
+{
+    if (flash_offs % align != 0 || count % align != 0 || flash_offs > HOST_FLASH_SIZE || count > HOST_FLASH_SIZE - flash_offs) {
+        fprintf(stderr, "flash: bad range %#x+%#zx\n", static_cast<unsigned>(flash_offs), count);
+        abort();
+    }
+}
+
+void flash_range_erase(const uint32_t flash_offs, const size_t count)
+{
+    check_range(flash_offs, count, FLASH_SECTOR_SIZE);
+    if (!flash_powered()) {return;}
+    memset(&host_flash[flash_offs], 0xff, count);
+}
+
+void flash_range_program(const uint32_t flash_offs, const uint8_t *data, const size_t count)
+{
+    check_range(flash_offs, count, FLASH_PAGE_SIZE);
+    if (!flash_powered()) {return;}
+    for (size_t i = 0; i < count; i++) {
+        host_flash[flash_offs + i] &= data[i];
+    }
+}
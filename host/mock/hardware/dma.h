@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+
+#include "pico.h"
+
+// Only compiled: the mock chip reports no interrupt line, so the firmware never enables DMA
+enum dma_channel_transfer_size {
+    DMA_SIZE_8 = 0,
+    DMA_SIZE_16 = 1,
+    DMA_SIZE_32 = 2,
+};
+
+typedef struct {
+    uint32_t ctrl;
+} dma_channel_config;
+
+int dma_claim_unused_channel(const bool required);
+dma_channel_config dma_channel_get_default_config(const unsigned channel);
+void channel_config_set_transfer_data_size(dma_channel_config *c, const enum dma_channel_transfer_size size);
+void channel_config_set_dreq(dma_channel_config *c, const unsigned dreq);
+void channel_config_set_read_increment(dma_channel_config *c, const bool incr);
+void channel_config_set_write_increment(dma_channel_config *c, const bool incr);
+void dma_channel_configure(const unsigned channel, const dma_channel_config *config, volatile void *write_addr, const volatile void *read_addr, const unsigned transfer_count, const bool trigger);
+void dma_start_channel_mask(const uint32_t chan_mask);
+void dma_channel_wait_for_finish_blocking(const unsigned channel);
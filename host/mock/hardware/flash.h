@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "pico.h"
+
+#define FLASH_PAGE_SIZE (1u << 8)
+#define FLASH_SECTOR_SIZE (1u << 12)
+
+// The host flash covers HOST_FLASH_SIZE bytes from XIP_BASE. Erasing sets
+// bytes to 0xff and programming can only clear bits, as on the chip.
+#define HOST_FLASH_SIZE (16u * FLASH_SECTOR_SIZE)
+
+void flash_range_erase(const uint32_t flash_offs, const size_t count);
+void flash_range_program(const uint32_t flash_offs, const uint8_t *data, const size_t count);
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+#include "pico.h"
+
+typedef void (*irq_handler_t)(void);
+
+#define PICO_HIGHEST_IRQ_PRIORITY 0x00
+#define PICO_DEFAULT_IRQ_PRIORITY 0x80
+
+void irq_set_enabled(const unsigned num, const bool enabled);
+bool irq_is_enabled(const unsigned num);
+void irq_set_exclusive_handler(const unsigned num, irq_handler_t handler);
+irq_handler_t irq_get_exclusive_handler(const unsigned num);
+void irq_remove_handler(const unsigned num, irq_handler_t handler);
+void irq_set_priority(const unsigned num, const uint8_t hardware_priority);
+void irq_clear(const unsigned num);
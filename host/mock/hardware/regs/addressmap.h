@@ -0,0 +1,7 @@
+#pragma once
+
+#include <cstdint>
+
+// Flash is an array in the host process (see hardware/flash.h)
+extern "C" uint8_t host_flash[];
+#define XIP_BASE (reinterpret_cast<uintptr_t>(host_flash))
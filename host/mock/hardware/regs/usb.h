@@ -0,0 +1,20 @@
+#pragma once
+
+// Register bits of the RP2040 USB controller used by rp2040_usb_device
+#define USB_INTS_BUFF_STATUS_BITS 0x00000010u
+#define USB_INTS_BUS_RESET_BITS 0x00001000u
+#define USB_INTS_SETUP_REQ_BITS 0x00010000u
+
+#define USB_SIE_STATUS_SETUP_REC_BITS 0x00020000u
+#define USB_SIE_STATUS_BUS_RESET_BITS 0x00080000u
+
+#define USB_SIE_CTRL_PULLUP_EN_BITS 0x00010000u
+#define USB_SIE_CTRL_EP0_INT_1BUF_BITS 0x20000000u
+
+#define USB_USB_MUXING_TO_PHY_BITS 0x00000001u
+#define USB_USB_MUXING_SOFTCON_BITS 0x00000008u
+#define USB_USB_PWR_VBUS_DETECT_BITS 0x00000004u
+#define USB_USB_PWR_VBUS_DETECT_OVERRIDE_EN_BITS 0x00000008u
+#define USB_MAIN_CTRL_CONTROLLER_EN_BITS 0x00000001u
+
+#define USBCTRL_IRQ 5
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <cstdint>
+
+#include "pico.h"
+
+#define RESETS_RESET_USBCTRL_BITS 0x01000000u
+
+void reset_block(const uint32_t bits);
+void unreset_block_wait(const uint32_t bits);
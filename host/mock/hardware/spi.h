@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "pico.h"
+
+typedef struct {
+    volatile uint32_t cr0, cr1, dr, sr;
+} spi_hw_t;
+
+typedef struct spi_inst spi_inst_t;
+extern spi_inst_t *const spi0;
+
+spi_hw_t *spi_get_hw(spi_inst_t *spi);
+unsigned spi_get_dreq(spi_inst_t *spi, const bool is_tx);
+int spi_write_blocking(spi_inst_t *spi, const uint8_t *src, const size_t len);
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+
+#include "pico.h"
+#include "hardware/regs/usb.h"
+
+typedef volatile uint32_t io_rw_32;
+typedef volatile uint32_t io_ro_32;
+typedef volatile uint32_t io_wo_32;
+
+#define USB_NUM_ENDPOINTS 16
+#define USB_DPRAM_MAX 4096
+
+#define EP_CTRL_ENABLE_BITS (1u << 31u)
+#define EP_CTRL_DOUBLE_BUFFERED_BITS (1u << 30u)
+#define EP_CTRL_INTERRUPT_PER_BUFFER (1u << 29u)
+#define EP_CTRL_INTERRUPT_PER_DOUBLE_BUFFER (1u << 28u)
+#define EP_CTRL_INTERRUPT_ON_NAK (1u << 16u)
+#define EP_CTRL_INTERRUPT_ON_STALL (1u << 17u)
+#define EP_CTRL_BUFFER_TYPE_LSB 26u
+#define EP_CTRL_HOST_INTERRUPT_INTERVAL_LSB 16u
+
+#define USB_BUF_CTRL_FULL 0x00008000u
+#define USB_BUF_CTRL_LAST 0x00004000u
+#define USB_BUF_CTRL_DATA0_PID 0x00000000u
+#define USB_BUF_CTRL_DATA1_PID 0x00002000u
+#define USB_BUF_CTRL_SEL 0x00001000u
+#define USB_BUF_CTRL_STALL 0x00000800u
+#define USB_BUF_CTRL_AVAIL 0x00000400u
+#define USB_BUF_CTRL_LEN_MASK 0x000003ffu
+#define USB_BUF_CTRL_LEN_LSB 0
+
+typedef struct {
+    volatile uint8_t setup_packet[8];
+    struct {
+        io_rw_32 in;
+        io_rw_32 out;
+    } ep_ctrl[USB_NUM_ENDPOINTS - 1];
+    struct {
+        io_rw_32 in;
+        io_rw_32 out;
+    } ep_buf_ctrl[USB_NUM_ENDPOINTS];
+    uint8_t ep0_buf_a[0x40];
+    uint8_t ep0_buf_b[0x40];
+    uint8_t epx_data[USB_DPRAM_MAX - 0x180];
+} usb_device_dpram_t;
+
+static_assert(sizeof(usb_device_dpram_t) == USB_DPRAM_MAX, "DPRAM layout");
+
+typedef struct {
+    io_rw_32 dev_addr_ctrl;
+    io_rw_32 int_ep_addr_ctrl[15];
+    io_rw_32 main_ctrl;
+    io_rw_32 sof_rw;
+    io_ro_32 sof_rd;
+    io_rw_32 sie_ctrl;
+    io_rw_32 sie_status;
+    io_rw_32 int_ep_ctrl;
+    io_rw_32 buf_status;
+    io_ro_32 buf_cpu_should_handle;
+    io_rw_32 abort;
+    io_rw_32 abort_done;
+    io_rw_32 ep_stall_arm;
+    io_rw_32 nak_poll;
+    io_rw_32 ep_nak_stall_status;
+    io_rw_32 muxing;
+    io_rw_32 pwr;
+    io_rw_32 phy_direct;
+    io_rw_32 phy_direct_override;
+    io_rw_32 phy_trim;
+    uint32_t _pad0;
+    io_rw_32 intr;
+    io_rw_32 inte;
+    io_rw_32 intf;
+    io_ro_32 ints;
+} usb_hw_t;
+
+// The controller's registers and DPRAM live in the host process; host.h
+// drives the other side of them
+extern usb_hw_t *const usb_hw;
+extern usb_device_dpram_t *const usb_dpram;
+
+// Atomic set/clear aliases: writing a member sets or clears those bits of the real register
+template <bool set>
+class hw_alias_reg
+{
+    private:
+        io_rw_32 *reg;
+    public:
+        explicit hw_alias_reg(io_rw_32 *reg) : reg(reg) {}
+        void operator=(const uint32_t bits) {if (set) {*reg |= bits;} else {*reg &= ~bits;}}
+};
+
+template <bool set>
+struct usb_hw_alias_t {
+    hw_alias_reg<set> dev_addr_ctrl, main_ctrl, sie_ctrl, sie_status, buf_status, ep_stall_arm, muxing, pwr, inte;
+    explicit usb_hw_alias_t(usb_hw_t *hw)
+        : dev_addr_ctrl(&hw->dev_addr_ctrl), main_ctrl(&hw->main_ctrl), sie_ctrl(&hw->sie_ctrl), sie_status(&hw->sie_status),
+          buf_status(&hw->buf_status), ep_stall_arm(&hw->ep_stall_arm), muxing(&hw->muxing), pwr(&hw->pwr), inte(&hw->inte) {}
+    usb_hw_alias_t *operator->() {return this;}
+};
+
+inline usb_hw_alias_t<true> hw_set_alias(usb_hw_t *hw) {return usb_hw_alias_t<true>(hw);}
+inline usb_hw_alias_t<false> hw_clear_alias(usb_hw_t *hw) {return usb_hw_alias_t<false>(hw);}
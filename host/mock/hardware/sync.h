@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+#include "pico.h"
+
+// Interrupts are masked per core: the core's IRQ handlers (host::run_as_irq)
+// wait until it restores them. Events wake best_effort_wfe_or_timeout().
+uint32_t save_and_disable_interrupts(void);
+void restore_interrupts(const uint32_t status);
+void __sev(void);
+void __wfe(void);
+void __wfi(void);
+void __dmb(void);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Controls of the host build's stand-ins for the RP2040 and the W5x00, used
+// by the emulator runner and the tests. Everything else under host/mock only
+// mirrors the Arduino/pico-sdk/Ethernet APIs the firmware calls.
+namespace host {
+    // Each thread runs as one of the two cores; threads not told otherwise are core0
+    void set_core(const unsigned core);
+    unsigned get_core(void);
+
+    // Microseconds since boot. The manual clock only moves with advance_us(),
+    // which also fires due alarms; it is meant for single-threaded harnesses.
+    uint64_t now_us(void);
+    void use_manual_clock(void);
+    void advance_us(const uint64_t us);
+    void stop_alarms(void);
+
+    // Make best_effort_wfe_or_timeout() sleep 1 ms and return, as loop() did
+    // with delay(1) before it waited for events; for before/after comparisons
+    void set_wfe_polling(const bool enable);
+
+    // Run fn the way an interrupt handler runs: on core0 with its interrupts
+    // masked, so it never overlaps loop()'s critical sections. Only taking an
+    // interrupt (raise_irq(), alarms) wakes core0, like a WFE on the chip.
+    void run_as_irq(const std::function<void()> &fn);
+    void raise_irq(const unsigned num);
+
+    // How long each critical section was held, in nanoseconds, while
+    // recording is on; take_lock_holds() returns and forgets them
+    void record_lock_holds(const bool enable);
+    std::vector<uint32_t> take_lock_holds(void);
+
+    // Serial1 output goes to stderr when enabled (ME56PS2_HOST_SERIAL=1)
+    void set_serial_echo(const bool enable);
+
+    // TCP ports as seen by the firmware map to loopback ports on the host:
+    // port + ME56PS2_HOST_PORT_OFFSET, and 20000 more below 1024 (log port 23)
+    uint16_t host_port(const uint16_t port);
+
+    // UDP between mock sockets stays in the process; every datagram may be
+    // dropped, and is delivered after delay plus up to jitter microseconds
+    void set_udp_impairment(const double loss, const uint32_t delay_us, const uint32_t jitter_us, const uint32_t seed = 1);
+
+    // Cut the power to the flash after this many more erase/program calls
+    // (negative: never); calls after the cut change nothing and are counted
+    void set_flash_write_limit(const int operations);
+    int get_flash_writes_dropped(void);
+
+    // The USB controller as seen from the cable, for the virtual host
+    enum class usb_result {
+        Ack,
+        Nak,
+        Stall,
+    };
+    bool usb_connected(void);
+    void usb_bus_reset(void);
+    void usb_setup(const uint8_t *packet);
+    usb_result usb_in(const uint8_t ep_num, uint8_t *data, size_t *len);
+    usb_result usb_out(const uint8_t ep_num, const uint8_t *data, const size_t len);
+    uint8_t usb_get_address(void);
+    uint32_t usb_get_pid_errors(void);
+}
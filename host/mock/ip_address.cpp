@@ -0,0 +1,69 @@
+#include <cstdio>
+
+#include "IPAddress.h"
+
+const IPAddress INADDR_NONE(0, 0, 0, 0);
+
+IPAddress::IPAddress()
+{
+    address.dword = 0;
+}
+
+IPAddress::IPAddress(const uint8_t first_octet, const uint8_t second_octet, const uint8_t third_octet, const uint8_t fourth_octet)
+{
+    address.bytes[0] = first_octet;
+    address.bytes[1] = second_octet;
+    address.bytes[2] = third_octet;
+    address.bytes[3] = fourth_octet;
+}
+
+IPAddress::IPAddress(const uint32_t address)
+{
+    this->address.dword = address;
+}
+
+IPAddress::IPAddress(const uint8_t *address)
+{
+    *this = address;
+}
+
+bool IPAddress::fromString(const char *address)
+{
+    unsigned int d[4];
+    char tail;
+    if (sscanf(address, "%u.%u.%u.%u%c", &d[0], &d[1], &d[2], &d[3], &tail) != 4) {return false;}
+    for (int i = 0; i < 4; i++) {
+        if (d[i] > 255) {return false;}
+        this->address.bytes[i] = d[i];
+    }
+    return true;
+}
+
+String IPAddress::toString() const
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", address.bytes[0], address.bytes[1], address.bytes[2], address.bytes[3]);
+    return String(buf);
+}
+
+bool IPAddress::operator==(const uint8_t *addr) const
+{
+    for (int i = 0; i < 4; i++) {
+        if (address.bytes[i] != addr[i]) {return false;}
+    }
+    return true;
+}
+
+IPAddress &IPAddress::operator=(const uint8_t *address)
+{
+    for (int i = 0; i < 4; i++) {
+        this->address.bytes[i] = address[i];
+    }
+    return *this;
+}
+
+IPAddress &IPAddress::operator=(const uint32_t address)
+{
+    this->address.dword = address;
+    return *this;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#define __packed __attribute__((packed))
+#define __not_in_flash_func(func) func
+#define __time_critical_func(func) func
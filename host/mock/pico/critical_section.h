@@ -0,0 +1,19 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+#include "pico.h"
+
+// Masks the calling core's interrupts, then takes a lock shared by both cores
+struct critical_section_t {
+    std::mutex lock;
+    uint32_t saved_irq;
+    std::chrono::steady_clock::time_point entered; // for host::record_lock_holds()
+};
+
+void critical_section_init(critical_section_t *crit_sec);
+void critical_section_deinit(critical_section_t *crit_sec);
+void critical_section_enter_blocking(critical_section_t *crit_sec);
+void critical_section_exit(critical_section_t *crit_sec);
@@ -0,0 +1,5 @@
+#pragma once
+
+#include "pico.h"
+
+unsigned get_core_num(void);
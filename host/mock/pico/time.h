@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+#include "pico.h"
+
+typedef uint64_t absolute_time_t;
+typedef int32_t alarm_id_t;
+typedef int64_t (*alarm_callback_t)(alarm_id_t id, void *user_data);
+
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+absolute_time_t get_absolute_time(void);
+uint64_t to_us_since_boot(const absolute_time_t t);
+uint32_t to_ms_since_boot(const absolute_time_t t);
+absolute_time_t delayed_by_us(const absolute_time_t t, const uint64_t us);
+absolute_time_t delayed_by_ms(const absolute_time_t t, const uint32_t ms);
+absolute_time_t make_timeout_time_us(const uint64_t us);
+absolute_time_t make_timeout_time_ms(const uint32_t ms);
+int64_t absolute_time_diff_us(const absolute_time_t from, const absolute_time_t to);
+bool time_reached(const absolute_time_t t);
+bool best_effort_wfe_or_timeout(const absolute_time_t timeout_timestamp);
+void sleep_us(const uint64_t us);
+void sleep_ms(const uint32_t ms);
+
+// Alarms fire on core0 as interrupts (see host::run_as_irq)
+alarm_id_t add_alarm_at(const absolute_time_t time, alarm_callback_t callback, void *user_data, const bool fire_if_past);
+alarm_id_t add_alarm_in_us(const uint64_t us, alarm_callback_t callback, void *user_data, const bool fire_if_past);
+alarm_id_t add_alarm_in_ms(const uint32_t ms, alarm_callback_t callback, void *user_data, const bool fire_if_past);
+bool cancel_alarm(const alarm_id_t id);
@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <cstring>
+
+#include "hardware/irq.h"
+#include "hardware/regs/usb.h"
+#include "hardware/structs/usb.h"
+
+#include "host.h"
+
+// The controller side of the RP2040 USB device: what the hardware does when
+// the host sends SETUP, IN and OUT tokens. Buffers are taken in the order
+// the controller would (alternating on double-buffered endpoints), and the
+// interrupt is raised like a level-triggered one until the device clears it.
+// All of it runs with core0's interrupts masked (host::run_as_irq), so the
+// device sees the registers change only between its critical sections.
+namespace {
+    alignas(64) usb_hw_t hw;
+    alignas(USB_DPRAM_MAX) usb_device_dpram_t dpram;
+
+    uint8_t hw_next_buf[USB_NUM_ENDPOINTS * 2]; // buffer the controller uses next
+    uint32_t last_ep_ctrl[USB_NUM_ENDPOINTS * 2];
+    uint8_t expected_pid[USB_NUM_ENDPOINTS * 2];
+    uint32_t pid_errors;
+
+    void update_ints(void)
+    {
+        uint32_t ints = 0;
+        if (hw.sie_status & USB_SIE_STATUS_SETUP_REC_BITS) {ints |= USB_INTS_SETUP_REQ_BITS;}
+        if (hw.sie_status & USB_SIE_STATUS_BUS_RESET_BITS) {ints |= USB_INTS_BUS_RESET_BITS;}
+        if (hw.buf_status != 0) {ints |= USB_INTS_BUFF_STATUS_BITS;}
+        hw.ints = ints & hw.inte;
+    }
+
+    void fire_irq(void)
+    {
+        // Level triggered: a handler that leaves its cause set runs again (bounded here)
+        for (int i = 0; i < 4; i++) {
+            update_ints();
+            if (hw.ints == 0) {break;}
+            host::raise_irq(USBCTRL_IRQ);
+        }
+    }
+
+    struct endpoint {
+        int idx;
+        io_rw_32 *buf_ctrl;
+        uint8_t *buf;
+        bool double_buffered;
+    };
+
+    // false when the endpoint is not enabled
+    bool get_endpoint(const uint8_t ep_num, const bool out, endpoint *ep)
+    {
+        ep->idx = ep_num * 2 + (out ? 1 : 0);
+        ep->buf_ctrl = out ? &dpram.ep_buf_ctrl[ep_num].out : &dpram.ep_buf_ctrl[ep_num].in;
+        if (ep_num == 0) {
+            ep->buf = dpram.ep0_buf_a;
+            ep->double_buffered = false;
+            return true;
+        }
+
+        const uint32_t ctrl = out ? dpram.ep_ctrl[ep_num - 1].out : dpram.ep_ctrl[ep_num - 1].in;
+        if ((ctrl & EP_CTRL_ENABLE_BITS) == 0) {return false;}
+        if (ctrl != last_ep_ctrl[ep->idx]) {
+            // Reconfigured: start over from buffer 0 and DATA0
+            last_ep_ctrl[ep->idx] = ctrl;
+            hw_next_buf[ep->idx] = 0;
+            expected_pid[ep->idx] = 0;
+        }
+        ep->buf = reinterpret_cast<uint8_t *>(&dpram) + (ctrl & 0xffc0);
+        ep->double_buffered = (ctrl & EP_CTRL_DOUBLE_BUFFERED_BITS) != 0;
+        return true;
+    }
+
+    bool is_stalled(const uint8_t ep_num, const bool out, const endpoint &ep)
+    {
+        if ((*ep.buf_ctrl & USB_BUF_CTRL_STALL) == 0) {return false;}
+        // EP0 also needs EP_STALL_ARM, cleared by the next SETUP
+        return ep_num != 0 || (hw.ep_stall_arm & (out ? 0x02 : 0x01));
+    }
+
+    // Hand a finished buffer back to the device
+    void complete(const endpoint &ep, const uint8_t buf_id, const uint16_t half)
+    {
+        if (ep.idx >= 2) {
+            const uint8_t pid = (half & USB_BUF_CTRL_DATA1_PID) ? 1 : 0;
+            if (pid != expected_pid[ep.idx]) {pid_errors++;}
+            expected_pid[ep.idx] = pid ^ 1;
+        }
+
+        const uint32_t bit = 1u << ep.idx;
+        hw.buf_status |= bit;
+        if (buf_id == 1) {
+            hw.buf_cpu_should_handle |= bit;
+        } else {
+            hw.buf_cpu_should_handle &= ~bit;
+        }
+        if (ep.double_buffered) {hw_next_buf[ep.idx] ^= 1;}
+        fire_irq();
+    }
+}
+
+usb_hw_t *const usb_hw = &hw;
+usb_device_dpram_t *const usb_dpram = &dpram;
+
+namespace host {
+    bool usb_connected(void)
+    {
+        return (hw.sie_ctrl & USB_SIE_CTRL_PULLUP_EN_BITS) != 0;
+    }
+
+    void usb_bus_reset(void)
+    {
+        run_as_irq([] {
+            hw.dev_addr_ctrl = 0;
+            hw.buf_status = 0;
+            memset(hw_next_buf, 0, sizeof(hw_next_buf));
+            memset(last_ep_ctrl, 0, sizeof(last_ep_ctrl));
+            memset(expected_pid, 0, sizeof(expected_pid));
+            hw.sie_status |= USB_SIE_STATUS_BUS_RESET_BITS;
+            fire_irq();
+        });
+    }
+
+    void usb_setup(const uint8_t *packet)
+    {
+        run_as_irq([packet] {
+            memcpy(const_cast<uint8_t *>(dpram.setup_packet), packet, sizeof(dpram.setup_packet));
+            dpram.ep_buf_ctrl[0].in &= ~USB_BUF_CTRL_STALL;
+            dpram.ep_buf_ctrl[0].out &= ~USB_BUF_CTRL_STALL;
+            hw.ep_stall_arm &= ~0x03u;
+            hw.sie_status |= USB_SIE_STATUS_SETUP_REC_BITS;
+            fire_irq();
+        });
+    }
+
+    usb_result usb_in(const uint8_t ep_num, uint8_t *data, size_t *len)
+    {
+        auto result = usb_result::Nak;
+        run_as_irq([&] {
+            endpoint ep;
+            if (!get_endpoint(ep_num, false, &ep)) {return;}
+            if (is_stalled(ep_num, false, ep)) {
+                result = usb_result::Stall;
+                return;
+            }
+            const uint8_t buf_id = ep.double_buffered ? hw_next_buf[ep.idx] : 0;
+            auto *half = reinterpret_cast<volatile uint16_t *>(ep.buf_ctrl) + buf_id;
+            const uint16_t value = *half;
+            if ((value & USB_BUF_CTRL_AVAIL) == 0 || (value & USB_BUF_CTRL_FULL) == 0) {return;}
+
+            *len = std::min<size_t>(value & USB_BUF_CTRL_LEN_MASK, 64);
+            memcpy(data, ep.buf + buf_id * 64, *len);
+            *half = value & ~(USB_BUF_CTRL_AVAIL | USB_BUF_CTRL_FULL);
+            result = usb_result::Ack;
+            complete(ep, buf_id, value);
+        });
+        return result;
+    }
+
+    usb_result usb_out(const uint8_t ep_num, const uint8_t *data, const size_t len)
+    {
+        auto result = usb_result::Nak;
+        run_as_irq([&] {
+            endpoint ep;
+            if (!get_endpoint(ep_num, true, &ep)) {return;}
+            if (is_stalled(ep_num, true, ep)) {
+                result = usb_result::Stall;
+                return;
+            }
+            const uint8_t buf_id = ep.double_buffered ? hw_next_buf[ep.idx] : 0;
+            auto *half = reinterpret_cast<volatile uint16_t *>(ep.buf_ctrl) + buf_id;
+            const uint16_t value = *half;
+            if ((value & USB_BUF_CTRL_AVAIL) == 0 || (value & USB_BUF_CTRL_FULL) != 0) {return;}
+            if (len > (value & USB_BUF_CTRL_LEN_MASK)) {
+                // More than the buffer was armed for (babble)
+                result = usb_result::Stall;
+                return;
+            }
+
+            memcpy(ep.buf + buf_id * 64, data, len);
+            *half = (value & USB_BUF_CTRL_DATA1_PID) | USB_BUF_CTRL_FULL | len;
+            result = usb_result::Ack;
+            complete(ep, buf_id, value);
+        });
+        return result;
+    }
+
+    uint8_t usb_get_address(void)
+    {
+        return hw.dev_addr_ctrl & 0x7f;
+    }
+
+    uint32_t usb_get_pid_errors(void)
+    {
+        return pid_errors;
+    }
+}
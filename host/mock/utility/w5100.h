@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <SPI.h>
+
+#define SPI_ETHERNET_SETTINGS SPISettings(14000000, MSBFIRST, SPI_MODE0)
+
+typedef uint8_t SOCKET;
+
+enum SockCMD {
+    Sock_OPEN = 0x01,
+    Sock_LISTEN = 0x02,
+    Sock_CONNECT = 0x04,
+    Sock_DISCON = 0x08,
+    Sock_CLOSE = 0x10,
+    Sock_SEND = 0x20,
+    Sock_SEND_MAC = 0x21,
+    Sock_SEND_KEEP = 0x22,
+    Sock_RECV = 0x40,
+};
+
+class SnMR {
+    public:
+        static const uint8_t CLOSE = 0x00;
+        static const uint8_t TCP = 0x21;
+        static const uint8_t UDP = 0x02;
+};
+
+class SnIR {
+    public:
+        static const uint8_t SEND_OK = 0x10;
+        static const uint8_t TIMEOUT = 0x08;
+        static const uint8_t RECV = 0x04;
+        static const uint8_t DISCON = 0x02;
+        static const uint8_t CON = 0x01;
+};
+
+class SnSR {
+    public:
+        static const uint8_t CLOSED = 0x00;
+        static const uint8_t INIT = 0x13;
+        static const uint8_t LISTEN = 0x14;
+        static const uint8_t SYNSENT = 0x15;
+        static const uint8_t SYNRECV = 0x16;
+        static const uint8_t ESTABLISHED = 0x17;
+        static const uint8_t FIN_WAIT = 0x18;
+        static const uint8_t CLOSING = 0x1a;
+        static const uint8_t TIME_WAIT = 0x1b;
+        static const uint8_t CLOSE_WAIT = 0x1c;
+        static const uint8_t LAST_ACK = 0x1d;
+        static const uint8_t UDP = 0x22;
+};
+
+// Socket commands and status act on the mock sockets; common and socket
+// registers are accepted and read back as zero. The Sn_* accessors of the
+// DMA path are never reached (see EthernetClass).
+class W5100Class
+{
+    public:
+        static uint16_t write(const uint16_t addr, const uint8_t *buf, const uint16_t len) {return len;}
+        static uint8_t write(const uint16_t addr, const uint8_t data) {return 1;}
+        static uint16_t read(const uint16_t addr, uint8_t *buf, const uint16_t len);
+        static uint8_t read(const uint16_t addr) {return 0;}
+        static void execCmdSn(const SOCKET s, const SockCMD cmd);
+        static uint8_t readSnSR(const SOCKET s);
+        static uint8_t readSnIR(const SOCKET s) {return 0;}
+        static void writeSnIR(const SOCKET s, const uint8_t data) {}
+        static void writeSnMR(const SOCKET s, const uint8_t data) {}
+        static void writeSnPORT(const SOCKET s, const uint16_t data) {}
+        static void writeSnDIPR(const SOCKET s, const uint8_t *data) {}
+        static void writeSnDPORT(const SOCKET s, const uint16_t data) {}
+        static uint16_t readSnRX_RSR(const SOCKET s) {return 0;}
+        static uint16_t readSnRX_RD(const SOCKET s) {return 0;}
+        static void writeSnRX_RD(const SOCKET s, const uint16_t data) {}
+        static uint16_t readSnTX_FSR(const SOCKET s) {return 0;}
+        static uint16_t readSnTX_WR(const SOCKET s) {return 0;}
+        static void writeSnTX_WR(const SOCKET s, const uint16_t data) {}
+};
+
+extern W5100Class W5100;
@@ -0,0 +1,51 @@
+#include <chrono>
+
+#include "hardware/sync.h"
+
+#include "emulator.h"
+#include "host.h"
+#include "sketch.h"
+
+namespace host {
+    emulator::emulator() : running(false), loop_count(0)
+    {
+    }
+
+    emulator::~emulator()
+    {
+        stop();
+    }
+
+    void emulator::start(void)
+    {
+        running = true;
+        core0 = std::thread([this] {
+            set_core(0);
+            setup();
+            while (running) {
+                loop();
+                loop_count++;
+            }
+        });
+        core1 = std::thread([this] {
+            set_core(1);
+            setup1();
+            while (running) {
+                loop1();
+                // core1 spins on the chip; leave the host's CPUs to the other threads
+                std::this_thread::sleep_for(std::chrono::microseconds(20));
+            }
+        });
+    }
+
+    void emulator::stop(void)
+    {
+        if (!running) {return;}
+
+        running = false;
+        __sev(); // out of wait_for_event()
+        core0.join();
+        core1.join();
+        stop_alarms();
+    }
+}
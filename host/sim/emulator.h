@@ -0,0 +1,25 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+namespace host {
+    // Runs the sketch: setup()/loop() on a thread acting as core0 and
+    // setup1()/loop1() on one acting as core1. Only one per process, as the
+    // sketch's state is global.
+    class emulator
+    {
+        private:
+            std::thread core0, core1;
+            std::atomic<bool> running;
+            std::atomic<uint32_t> loop_count;
+        public:
+            emulator();
+            ~emulator();
+            void start(void);
+            void stop(void);
+            // Passes through loop() so far, to tell sleeping from polling
+            uint32_t get_loop_count(void) const {return loop_count;}
+    };
+}
@@ -0,0 +1,3 @@
+// The sketch as a translation unit of the host build; the Arduino IDE only
+// compiles it as the .ino in the repository root.
+#include "../../me56ps2-emulator-rp2040.ino"
@@ -0,0 +1,7 @@
+#pragma once
+
+// Entry points of me56ps2-emulator-rp2040.ino, compiled by sketch.cpp
+void setup();
+void loop();
+void setup1();
+void loop1();
@@ -0,0 +1,154 @@
+#include <chrono>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "host.h"
+#include "tcp_peer.h"
+
+namespace {
+    sockaddr_in loopback_address(const uint16_t port)
+    {
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(host::host_port(port));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return addr;
+    }
+
+    int64_t remaining_ms(const std::chrono::steady_clock::time_point deadline)
+    {
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        return ms > 0 ? ms : 0;
+    }
+}
+
+namespace host {
+    tcp_peer::tcp_peer() : listen_fd(-1), fd(-1)
+    {
+    }
+
+    tcp_peer::~tcp_peer()
+    {
+        close();
+        if (listen_fd >= 0) {::close(listen_fd);}
+    }
+
+    bool tcp_peer::wait_readable(const int fd, const uint32_t timeout_ms)
+    {
+        pollfd pfd = {fd, POLLIN, 0};
+        return poll(&pfd, 1, timeout_ms) == 1;
+    }
+
+    // false on timeout or when the connection is gone
+    bool tcp_peer::receive(const uint32_t timeout_ms)
+    {
+        if (fd < 0 || !wait_readable(fd, timeout_ms)) {return false;}
+
+        char buf[4096];
+        const auto len = recv(fd, buf, sizeof(buf), 0);
+        if (len <= 0) {
+            close();
+            return false;
+        }
+        received.append(buf, len);
+        return true;
+    }
+
+    bool tcp_peer::listen(const uint16_t port)
+    {
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        const int one = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        const auto addr = loopback_address(port);
+        return bind(listen_fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == 0 && ::listen(listen_fd, 4) == 0;
+    }
+
+    bool tcp_peer::accept(const uint32_t timeout_ms)
+    {
+        if (listen_fd < 0 || !wait_readable(listen_fd, timeout_ms)) {return false;}
+
+        close();
+        fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        received.clear();
+        return fd >= 0;
+    }
+
+    bool tcp_peer::connect(const uint16_t port)
+    {
+        close();
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        const auto addr = loopback_address(port);
+        if (::connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) != 0) {
+            close();
+            return false;
+        }
+        received.clear();
+        return true;
+    }
+
+    bool tcp_peer::write(const std::string &data)
+    {
+        size_t sent = 0;
+        while (fd >= 0 && sent < data.size()) {
+            const auto len = send(fd, &data[sent], data.size() - sent, MSG_NOSIGNAL);
+            if (len <= 0) {return false;}
+            sent += len;
+        }
+        return sent == data.size();
+    }
+
+    bool tcp_peer::expect(const std::string &text, const uint32_t timeout_ms)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (true) {
+            const auto pos = received.find(text);
+            if (pos != std::string::npos) {
+                received.erase(0, pos + text.size());
+                return true;
+            }
+            if (!receive(remaining_ms(deadline))) {return false;}
+        }
+    }
+
+    bool tcp_peer::read_exactly(std::string *data, const size_t count, const uint32_t timeout_ms)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (received.size() < count) {
+            if (!receive(remaining_ms(deadline))) {return false;}
+        }
+        data->assign(received, 0, count);
+        received.erase(0, count);
+        return true;
+    }
+
+    std::string tcp_peer::read(void)
+    {
+        while (receive(0)) {}
+        std::string data;
+        data.swap(received);
+        return data;
+    }
+
+    bool tcp_peer::wait_closed(const uint32_t timeout_ms)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (fd >= 0) {
+            if (!receive(remaining_ms(deadline)) && fd >= 0) {return false;}
+        }
+        return true;
+    }
+
+    void tcp_peer::close(void)
+    {
+        if (fd >= 0) {::close(fd);}
+        fd = -1;
+    }
+}
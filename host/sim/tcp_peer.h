@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace host {
+    // The other end of a call: a plain loopback TCP socket of the host, on the
+    // port the firmware's port maps to (see host::host_port())
+    class tcp_peer
+    {
+        private:
+            int listen_fd;
+            int fd;
+            std::string received;
+
+            bool wait_readable(const int fd, const uint32_t timeout_ms);
+            bool receive(const uint32_t timeout_ms);
+        public:
+            tcp_peer();
+            ~tcp_peer();
+            tcp_peer(const tcp_peer &) = delete;
+            tcp_peer &operator=(const tcp_peer &) = delete;
+
+            bool listen(const uint16_t port);
+            bool accept(const uint32_t timeout_ms = 2000);
+            bool connect(const uint16_t port);
+            bool is_connected(void) const {return fd >= 0;}
+            bool write(const std::string &data);
+            // Waits for text and consumes the received data up to its end
+            bool expect(const std::string &text, const uint32_t timeout_ms = 2000);
+            bool read_exactly(std::string *data, const size_t count, const uint32_t timeout_ms);
+            std::string read(void);
+            // True when the firmware closed the connection within the timeout
+            bool wait_closed(const uint32_t timeout_ms = 2000);
+            void close(void);
+    };
+}
@@ -0,0 +1,226 @@
+#include <chrono>
+#include <cstring>
+
+#include "host.h"
+#include "virtual_host.h"
+
+namespace {
+    constexpr uint8_t device_address = 5;
+    constexpr uint8_t bulk_ep_num = 2;
+    constexpr size_t max_packet_size = 64;
+
+    // Full-speed bulk transactions fit many to a frame; back off briefly on NAK
+    void nak_wait(void)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    template <typename F>
+    host::usb_result retry(F transaction, const uint32_t timeout_ms = 1000)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (true) {
+            const auto result = transaction();
+            if (result != host::usb_result::Nak || std::chrono::steady_clock::now() >= deadline) {return result;}
+            nak_wait();
+        }
+    }
+}
+
+namespace host {
+    virtual_host::virtual_host() : running(false), carrier_detected(false), in_packets(0), in_data_packets(0), out_packets(0), in_poll_interval_us(0)
+    {
+    }
+
+    virtual_host::~virtual_host()
+    {
+        stop();
+    }
+
+    bool virtual_host::control_in(const usb_setup_packet &pkt, std::vector<uint8_t> *data)
+    {
+        usb_setup(reinterpret_cast<const uint8_t *>(&pkt));
+        data->clear();
+        while (data->size() < pkt.wLength) {
+            uint8_t buf[max_packet_size];
+            size_t len = 0;
+            if (retry([&] {return usb_in(0, buf, &len);}) != usb_result::Ack) {return false;}
+            data->insert(data->end(), buf, buf + len);
+            if (len < max_packet_size) {break;}
+        }
+        // Status stage
+        return retry([] {return usb_out(0, nullptr, 0);}) == usb_result::Ack;
+    }
+
+    bool virtual_host::control_out(const usb_setup_packet &pkt)
+    {
+        usb_setup(reinterpret_cast<const uint8_t *>(&pkt));
+        uint8_t buf[max_packet_size];
+        size_t len = 0;
+        return retry([&] {return usb_in(0, buf, &len);}) == usb_result::Ack && len == 0;
+    }
+
+    bool virtual_host::get_descriptor(const uint8_t type, const uint8_t index, std::vector<uint8_t> *desc)
+    {
+        const usb_setup_packet pkt = {USB_DIR_IN | USB_REQUEST_TYPE_STANDARD, USB_REQUEST_GET_DESCRIPTOR, static_cast<uint16_t>((type << 8) | index), 0, 255};
+        return control_in(pkt, desc);
+    }
+
+    bool virtual_host::enumerate(const uint32_t timeout_ms)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (!usb_connected()) {
+            if (std::chrono::steady_clock::now() >= deadline) {return false;}
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        // Connect debounce (USB 2.0 7.1.7.3) before the reset
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        usb_bus_reset();
+
+        std::vector<uint8_t> desc;
+        if (!get_descriptor(USB_DESCRIPTOR_TYPE_DEVICE, 0, &desc) || desc.size() != sizeof(usb_device_descriptor)) {return false;}
+
+        const usb_setup_packet set_address = {USB_DIR_OUT | USB_REQUEST_TYPE_STANDARD, USB_REQUEST_SET_ADDRESS, device_address, 0, 0};
+        if (!control_out(set_address) || usb_get_address() != device_address) {return false;}
+
+        if (!get_descriptor(USB_DESCRIPTOR_TYPE_CONFIGURATION, 0, &desc)) {return false;}
+        const usb_setup_packet set_configuration = {USB_DIR_OUT | USB_REQUEST_TYPE_STANDARD, USB_REQUEST_SET_CONFIGURATION, 1, 0, 0};
+        if (!control_out(set_configuration)) {return false;}
+
+        running = true;
+        poller = std::thread([this] {poll();});
+        return true;
+    }
+
+    // The ME56PS2 vendor request that drives DTR (0x0101 high, 0x0100 low)
+    bool virtual_host::set_dtr(const bool high)
+    {
+        const usb_setup_packet pkt = {USB_DIR_OUT | USB_REQUEST_TYPE_VENDOR, 0x01, static_cast<uint16_t>(high ? 0x0101 : 0x0100), 0, 0};
+        return control_out(pkt);
+    }
+
+    void virtual_host::stop(void)
+    {
+        running = false;
+        if (poller.joinable()) {poller.join();}
+    }
+
+    void virtual_host::poll(void)
+    {
+        std::string packet;
+        auto next_in = std::chrono::steady_clock::now();
+        while (running) {
+            bool busy = false;
+
+            uint8_t buf[max_packet_size];
+            size_t len = 0;
+            const auto now = std::chrono::steady_clock::now();
+            const auto in_due = now >= next_in;
+            if (in_due) {next_in = now + std::chrono::microseconds(in_poll_interval_us.load());}
+            if (in_due && usb_in(bulk_ep_num, buf, &len) == usb_result::Ack && len >= 2) {
+                std::lock_guard<std::mutex> lk(lock);
+                carrier_detected = (buf[0] & 0x80) != 0;
+                rx_data.append(reinterpret_cast<const char *>(&buf[2]), len - 2);
+                in_packets++;
+                if (len > 2) {in_data_packets++;}
+                received_cv.notify_all();
+                busy = len > 2;
+            }
+
+            if (packet.empty()) {
+                std::lock_guard<std::mutex> lk(lock);
+                const auto payload_len = std::min(tx_data.size(), max_packet_size - 1);
+                if (payload_len > 0) {
+                    packet.assign(1, static_cast<char>(payload_len));
+                    packet.append(tx_data, 0, payload_len);
+                    tx_data.erase(0, payload_len);
+                }
+            }
+            if (!packet.empty() && usb_out(bulk_ep_num, reinterpret_cast<const uint8_t *>(packet.data()), packet.size()) == usb_result::Ack) {
+                std::lock_guard<std::mutex> lk(lock);
+                out_packets++;
+                packet.clear();
+                busy = true;
+            }
+
+            if (!busy) {nak_wait();}
+        }
+    }
+
+    void virtual_host::set_in_poll_interval_us(const uint32_t interval_us)
+    {
+        in_poll_interval_us = interval_us;
+    }
+
+    void virtual_host::write(const std::string &data)
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        tx_data += data;
+    }
+
+    size_t virtual_host::get_pending_write_count(void) const
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        return tx_data.size();
+    }
+
+    std::string virtual_host::read(void)
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        std::string data;
+        data.swap(rx_data);
+        return data;
+    }
+
+    bool virtual_host::expect(const std::string &text, const uint32_t timeout_ms)
+    {
+        std::unique_lock<std::mutex> lk(lock);
+        size_t pos = std::string::npos;
+        const auto found = received_cv.wait_for(lk, std::chrono::milliseconds(timeout_ms), [&] {
+            pos = rx_data.find(text);
+            return pos != std::string::npos;
+        });
+        if (found) {rx_data.erase(0, pos + text.size());}
+        return found;
+    }
+
+    bool virtual_host::read_exactly(std::string *data, const size_t count, const uint32_t timeout_ms)
+    {
+        std::unique_lock<std::mutex> lk(lock);
+        const auto done = received_cv.wait_for(lk, std::chrono::milliseconds(timeout_ms), [&] {return rx_data.size() >= count;});
+        if (!done) {return false;}
+        data->assign(rx_data, 0, count);
+        rx_data.erase(0, count);
+        return true;
+    }
+
+    bool virtual_host::wait_for_carrier(const bool detected, const uint32_t timeout_ms)
+    {
+        std::unique_lock<std::mutex> lk(lock);
+        return received_cv.wait_for(lk, std::chrono::milliseconds(timeout_ms), [&] {return carrier_detected == detected;});
+    }
+
+    bool virtual_host::carrier(void) const
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        return carrier_detected;
+    }
+
+    uint32_t virtual_host::get_in_packets(void) const
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        return in_packets;
+    }
+
+    uint32_t virtual_host::get_in_data_packets(void) const
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        return in_data_packets;
+    }
+
+    uint32_t virtual_host::get_out_packets(void) const
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        return out_packets;
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "usb_struct.h"
+
+namespace host {
+    // The PC the modem is plugged into: enumerates the device like a USB 1.1
+    // host, then polls the bulk endpoints from its own thread, the way the
+    // ME56PS2 driver does (1-byte length header on OUT, 2 status bytes on IN).
+    class virtual_host
+    {
+        private:
+            std::thread poller;
+            std::atomic<bool> running;
+            mutable std::mutex lock;
+            std::condition_variable received_cv;
+            std::string tx_data;  // waiting to be sent on EP2 OUT
+            std::string rx_data;  // received on EP2 IN, not consumed yet
+            bool carrier_detected;
+            uint32_t in_packets, in_data_packets, out_packets;
+            std::atomic<uint32_t> in_poll_interval_us;
+
+            bool control_in(const usb_setup_packet &pkt, std::vector<uint8_t> *data);
+            bool control_out(const usb_setup_packet &pkt);
+            void poll(void);
+        public:
+            virtual_host();
+            ~virtual_host();
+            // Up to SET_CONFIGURATION; false when the device does not answer as an ME56PS2
+            bool enumerate(const uint32_t timeout_ms = 2000);
+            bool get_descriptor(const uint8_t type, const uint8_t index, std::vector<uint8_t> *desc);
+            bool set_dtr(const bool high);
+            void stop(void);
+            // Poll EP2 IN at most once per interval, like a driver that asks
+            // once per USB frame; 0 (default) polls as fast as data comes
+            void set_in_poll_interval_us(const uint32_t interval_us);
+
+            void write(const std::string &data);
+            size_t get_pending_write_count(void) const;
+            std::string read(void);
+            // Waits for text and consumes the received data up to its end
+            bool expect(const std::string &text, const uint32_t timeout_ms = 2000);
+            // Waits until count bytes have been received and takes them
+            bool read_exactly(std::string *data, const size_t count, const uint32_t timeout_ms);
+            bool wait_for_carrier(const bool detected, const uint32_t timeout_ms = 2000);
+            bool carrier(void) const;
+            uint32_t get_in_packets(void) const;
+            // IN packets that carried data, not just the two status bytes
+            uint32_t get_in_data_packets(void) const;
+            uint32_t get_out_packets(void) const;
+    };
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// Minimal assertions for the host tests: a failed check reports and exits
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        const auto _a = (a); \
+        const auto _b = (b); \
+        if (!(_a == _b)) { \
+            fprintf(stderr, "%s:%d: CHECK_EQ failed: %s == %s (%lld vs %lld)\n", __FILE__, __LINE__, #a, #b, \
+                static_cast<long long>(_a), static_cast<long long>(_b)); \
+            exit(1); \
+        } \
+    } while (0)
@@ -0,0 +1,109 @@
+// at_command_parser on its own, with handlers that record what they were
+// asked to do: result codes, unknown commands and S-registers, dial strings.
+#include <string>
+
+#include "at_command.h"
+#include "check.h"
+
+namespace {
+    std::string output;
+    std::string dialed;
+    int reports = 0;
+
+    AT_RESULT dial(const char *dial_string)
+    {
+        dialed = dial_string;
+        return AT_RESULT_NONE;
+    }
+
+    AT_RESULT answer(void) {return AT_RESULT_ERROR;}
+    AT_RESULT hangup(void) {return AT_RESULT_OK;}
+    AT_RESULT online(void) {return AT_RESULT_ERROR;}
+    AT_RESULT store(const int index, const char *dial_string) {return AT_RESULT_ERROR;}
+    const char *recall(const int index) {return index == 1 ? "example*net#10023" : nullptr;}
+    void write(const char *data, size_t len) {output.append(data, len);}
+    void report(void) {reports++;}
+
+    // Feed one command line and return everything written in reply
+    std::string run(at_command_parser &modem, const std::string &line)
+    {
+        output.clear();
+        for (const auto c : line + "\r") {
+            modem.input(c);
+        }
+        return output;
+    }
+
+    void test_results(at_command_parser &modem)
+    {
+        CHECK(run(modem, "AT") == "OK\r\n");
+        CHECK(run(modem, "ATE0V1S0=1") == "OK\r\n");
+        CHECK(run(modem, "ATS0?") == "001\r\nOK\r\n");
+        CHECK(run(modem, "ATV0") == "0\r");
+        CHECK(run(modem, "ATA") == "4\r");
+        CHECK(run(modem, "ATV1Q1A") == "");
+        CHECK(run(modem, "ATZ") == "OK\r\n");
+        CHECK(run(modem, "ATI") == "ME56PS2\r\nOK\r\n");
+        CHECK(run(modem, "ATI6") == "OK\r\n");
+        CHECK_EQ(reports, 1);
+        CHECK(run(modem, "A/") == "OK\r\n");
+        CHECK_EQ(reports, 2);
+    }
+
+    // Whatever the table does not know answers OK, as the original adapter did
+    void test_unknown_commands(at_command_parser &modem)
+    {
+        for (const auto *line : {"AT&V", "AT\\J0", "AT&B1", "ATY0", "ATL2M1X4", "AT&C1&D2&K3", "AT%C0\\N3", "AT+MS=V34;E0", "AT!"}) {
+            CHECK(run(modem, line) == "OK\r\n");
+        }
+        // Parameters of an ignored command do not leak into the next one
+        CHECK(run(modem, "ATX4S7=30S7?") == "030\r\nOK\r\n");
+        CHECK(run(modem, "AT&Y=5?E0") == "OK\r\n");
+    }
+
+    void test_s_registers(at_command_parser &modem)
+    {
+        // Unused registers up to S255 take writes and read back as 0
+        CHECK(run(modem, "ATS95=47") == "OK\r\n");
+        CHECK(run(modem, "ATS95?") == "000\r\nOK\r\n");
+        CHECK(run(modem, "ATS255=1") == "OK\r\n");
+        CHECK(run(modem, "ATS256=1") == "ERROR\r\n");
+        CHECK(run(modem, "ATS0=256") == "ERROR\r\n");
+        CHECK(run(modem, "ATS0=255") == "OK\r\n");
+        CHECK_EQ(modem.get_s_register(S_REGISTER_AUTO_ANSWER), 255);
+        CHECK(run(modem, "ATZ") == "OK\r\n");
+        CHECK_EQ(modem.get_s_register(S_REGISTER_AUTO_ANSWER), 0);
+    }
+
+    void test_dial_strings(at_command_parser &modem)
+    {
+        CHECK(run(modem, "ATD192-168-0-1#10023") == "");
+        CHECK(dialed == "192-168-0-1#10023");
+        CHECK(run(modem, "ATDS1") == "");
+        CHECK(dialed == "example*net#10023");
+        CHECK(run(modem, "ATDS2") == "ERROR\r\n");
+
+        // T and P are only taken off for sure before an address
+        CHECK(run(modem, "ATDT192-168-0-1") == "");
+        CHECK(dialed == "192-168-0-1");
+        CHECK(run(modem, "ATDp*example") == "");
+        CHECK(dialed == "*example");
+        CHECK(run(modem, "ATDtokyo*example*net") == "");
+        CHECK(dialed == "tokyo*example*net");
+        CHECK(run(modem, "ATDTgame*example*net") == "");
+        CHECK(dialed == "Tgame*example*net");
+    }
+}
+
+int main(void)
+{
+    at_command_parser modem({dial, answer, hangup, online, store, recall, write, report});
+
+    test_results(modem);
+    test_unknown_commands(modem);
+    test_s_registers(modem);
+    test_dial_strings(modem);
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,125 @@
+// IN packet coalescing (S40) under game-like traffic: the peer sends 8-byte
+// frames every 250 us to a USB host that polls once per 1 ms frame, and for
+// S40=0 and S40=1 the IN packets per second and the latency of each frame
+// from the peer's write to its arrival on the USB host are compared.
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "emulator.h"
+#include "tcp_peer.h"
+#include "virtual_host.h"
+
+namespace {
+    using clock = std::chrono::steady_clock;
+
+    constexpr uint16_t peer_port = 12000;
+    constexpr int frames = 4000;
+    constexpr size_t frame_size = 8;
+    constexpr auto frame_interval = std::chrono::microseconds(250);
+    constexpr double poll_interval_ms = 1;
+
+    struct result {
+        double packets_per_second;
+        double bytes_per_packet;
+        double p50_ms, p99_ms;
+    };
+
+    double percentile_ms(std::vector<double> samples, const int percent)
+    {
+        std::sort(samples.begin(), samples.end());
+        return samples[std::min(samples.size() - 1, samples.size() * percent / 100)];
+    }
+
+    result run(host::virtual_host &usb, host::tcp_peer &listener, const int mode)
+    {
+        usb.write("ATS40=" + std::to_string(mode) + "D127-0-0-1#" + std::to_string(peer_port) + "\r");
+        CHECK(listener.accept());
+        CHECK(usb.expect("CONNECT 33600 V.42\r\n"));
+
+        std::mutex mutex;
+        std::vector<clock::time_point> sent(frames);
+        const auto packets_at_start = usb.get_in_data_packets();
+        const auto start = clock::now();
+        std::thread writer([&] {
+            for (int i = 0; i < frames; i++) {
+                std::this_thread::sleep_until(start + i * frame_interval);
+                std::string frame(frame_size, '\x5a');
+                memcpy(&frame[0], &i, sizeof(i));
+                {
+                    std::lock_guard<std::mutex> lk(mutex);
+                    sent[i] = clock::now();
+                }
+                CHECK(listener.write(frame));
+            }
+        });
+
+        std::vector<double> latency_ms;
+        std::string received;
+        const auto deadline = start + std::chrono::seconds(30);
+        while (latency_ms.size() < frames && clock::now() < deadline) {
+            received += usb.read();
+            const auto now = clock::now();
+            size_t pos = 0;
+            for (; received.size() - pos >= frame_size; pos += frame_size) {
+                int seq;
+                memcpy(&seq, &received[pos], sizeof(seq));
+                CHECK_EQ(seq, static_cast<int>(latency_ms.size()));
+                std::lock_guard<std::mutex> lk(mutex);
+                latency_ms.push_back(std::chrono::duration<double, std::milli>(now - sent[seq]).count());
+            }
+            received.erase(0, pos);
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        const auto seconds = std::chrono::duration<double>(clock::now() - start).count();
+        writer.join();
+        CHECK_EQ(latency_ms.size(), static_cast<size_t>(frames));
+        const auto packets = usb.get_in_data_packets() - packets_at_start;
+
+        CHECK(usb.set_dtr(false));
+        CHECK(listener.wait_closed());
+        CHECK(usb.set_dtr(true));
+        usb.write("AT\r");
+        CHECK(usb.expect("OK\r\n"));
+
+        const result r = {packets / seconds, static_cast<double>(frames * frame_size) / packets,
+            percentile_ms(latency_ms, 50), percentile_ms(latency_ms, 99)};
+        printf("S40=%d: %.0f IN packets/s, %.1f bytes each, latency p50 %.2f ms, p99 %.2f ms\n", mode,
+            r.packets_per_second, r.bytes_per_packet, r.p50_ms, r.p99_ms);
+        return r;
+    }
+}
+
+int main(void)
+{
+    host::emulator emu;
+    host::virtual_host usb;
+    emu.start();
+    CHECK(usb.enumerate());
+    CHECK(usb.set_dtr(true));
+    usb.set_in_poll_interval_us(poll_interval_ms * 1000);
+
+    host::tcp_peer listener;
+    CHECK(listener.listen(peer_port));
+    const auto immediate = run(usb, listener, 0);
+    const auto coalesced = run(usb, listener, 1);
+
+    // The host's polling sets the packet rate either way. Holding data back
+    // never adds packets, and no short packet waits a poll behind the one in
+    // flight: measured about one poll interval better at p50 on an idle
+    // machine (the test is RUN_SERIAL), checked against half of one, and the
+    // tail is not allowed to get worse by more than one poll
+    CHECK(coalesced.packets_per_second < immediate.packets_per_second * 1.05);
+    CHECK(coalesced.p50_ms < immediate.p50_ms - poll_interval_ms / 2);
+    CHECK(coalesced.p99_ms < immediate.p99_ms + poll_interval_ms);
+
+    usb.stop();
+    emu.stop();
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,171 @@
+// In-band compression negotiation (S46) against a loopback TCP peer that
+// speaks the protocol with lz_encoder/lz_decoder, and the fallback for a
+// peer whose data merely starts like an offer.
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "check.h"
+#include "emulator.h"
+#include "lz_codec.h"
+#include "tcp_peer.h"
+#include "virtual_host.h"
+
+namespace {
+    constexpr uint16_t peer_port = 12000;
+    const std::string offer("\xfe" "MEZ\x01", 5);
+
+    std::string make_text(const size_t len)
+    {
+        static const char *const lines[] = {
+            "<player1> gg, one more round?\r\n",
+            "<player2> sure, same stage\r\n",
+            "<player1> lag was fine this time\r\n",
+        };
+        std::string data;
+        for (size_t i = 0; data.size() < len; i++) {
+            data += lines[(i * 7 + i / 3) % 3];
+        }
+        data.resize(len);
+        return data;
+    }
+
+    // Reads and decodes until len bytes came out; returns the bytes on the wire
+    size_t read_compressed(host::tcp_peer &peer, lz_decoder &decoder, std::string *decoded, const size_t len)
+    {
+        size_t wire_bytes = 0;
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (decoded->size() < len && std::chrono::steady_clock::now() < deadline) {
+            const auto data = peer.read();
+            wire_bytes += data.size();
+            size_t pos = 0;
+            while (true) {
+                char out[1024];
+                size_t consumed;
+                const auto out_len = decoder.decode(reinterpret_cast<const uint8_t *>(data.data()) + pos, data.size() - pos, &consumed, out, sizeof(out));
+                decoded->append(out, out_len);
+                pos += consumed;
+                if (out_len == 0 && consumed == 0) {break;}
+            }
+            if (data.empty()) {std::this_thread::sleep_for(std::chrono::milliseconds(1));}
+        }
+        return wire_bytes;
+    }
+
+    void write_compressed(host::tcp_peer &peer, lz_encoder &encoder, const std::string &data)
+    {
+        for (size_t pos = 0; pos < data.size(); pos += lz_encoder::MAX_INPUT) {
+            uint8_t out[lz_encoder::MAX_OUTPUT];
+            const auto len = encoder.encode(&data[pos], std::min(data.size() - pos, lz_encoder::MAX_INPUT), out);
+            CHECK(peer.write(std::string(reinterpret_cast<const char *>(out), len)));
+        }
+    }
+
+    void dial(host::virtual_host &usb, host::tcp_peer &peer, const int compression)
+    {
+        usb.write("ATS46=" + std::to_string(compression) + "D127-0-0-1#" + std::to_string(peer_port) + "\r");
+        CHECK(peer.accept());
+        CHECK(usb.expect("CONNECT 33600 V.42\r\n"));
+    }
+
+    void hang_up(host::virtual_host &usb, host::tcp_peer &peer)
+    {
+        CHECK(usb.set_dtr(false));
+        CHECK(peer.wait_closed());
+        CHECK(usb.set_dtr(true));
+        usb.write("AT\r");
+        CHECK(usb.expect("OK\r\n"));
+    }
+
+    // Both sides offer: both directions compressed
+    void test_both_compress(host::virtual_host &usb, host::tcp_peer &listener)
+    {
+        constexpr size_t len = 16 * 1024;
+        dial(usb, listener, 1);
+        std::string received;
+        CHECK(listener.read_exactly(&received, offer.size(), 2000));
+        CHECK(received == offer);
+        CHECK(listener.write(offer));
+        CHECK(listener.read_exactly(&received, 1, 2000));
+        CHECK(received == "C");
+        CHECK(listener.write("C"));
+
+        lz_decoder decoder;
+        const auto to_peer = make_text(len);
+        usb.write(to_peer);
+        std::string decoded;
+        const auto wire_bytes = read_compressed(listener, decoder, &decoded, len);
+        CHECK(decoded == to_peer);
+        printf("usb->net: %zu bytes, %zu on the wire\n", len, wire_bytes);
+        CHECK(wire_bytes < len / 2);
+
+        lz_encoder encoder;
+        const auto to_usb = make_text(len + 1);
+        write_compressed(listener, encoder, to_usb);
+        CHECK(usb.read_exactly(&received, to_usb.size(), 5000));
+        CHECK(received == to_usb);
+
+        hang_up(usb, listener);
+    }
+
+    // S46=0 declines, but still decodes what the peer compresses
+    void test_peer_compresses(host::virtual_host &usb, host::tcp_peer &listener)
+    {
+        dial(usb, listener, 0);
+        CHECK(listener.write(offer));
+        std::string received;
+        CHECK(listener.read_exactly(&received, offer.size() + 1, 2000));
+        CHECK(received == offer + "R");
+        CHECK(listener.write("C"));
+
+        lz_encoder encoder;
+        const auto to_usb = make_text(4096);
+        write_compressed(listener, encoder, to_usb);
+        CHECK(usb.read_exactly(&received, to_usb.size(), 5000));
+        CHECK(received == to_usb);
+
+        usb.write("raw");
+        CHECK(listener.read_exactly(&received, 3, 2000));
+        CHECK(received == "raw");
+
+        hang_up(usb, listener);
+    }
+
+    // A peer without this firmware whose first byte happens to be 0xfe and
+    // then waits for a reply: the byte is not held back for good
+    void test_partial_offer(host::virtual_host &usb, host::tcp_peer &listener)
+    {
+        dial(usb, listener, 0);
+        CHECK(listener.write("\xfe" "M"));
+        std::string received;
+        CHECK(usb.read_exactly(&received, 2, 1000));
+        CHECK(received == "\xfe" "M");
+        CHECK(listener.write("x"));
+        CHECK(usb.read_exactly(&received, 1, 1000));
+        CHECK(received == "x");
+
+        hang_up(usb, listener);
+    }
+}
+
+int main(void)
+{
+    host::emulator emu;
+    host::virtual_host usb;
+    emu.start();
+    CHECK(usb.enumerate());
+    CHECK(usb.set_dtr(true));
+
+    {
+        host::tcp_peer listener;
+        CHECK(listener.listen(peer_port));
+        test_both_compress(usb, listener);
+        test_peer_compresses(usb, listener);
+        test_partial_offer(usb, listener);
+    }
+
+    usb.stop();
+    emu.stop();
+    printf("ok\n");
+    return 0;
+}
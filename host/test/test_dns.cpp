@@ -0,0 +1,153 @@
+// Dialing host names, with a DNS server stand-in on the mock network (the
+// firmware's DNS server is 127.0.0.1, and UDP stays in the process): names
+// are resolved through the server, and a leading T or P is tried both as
+// part of the name and as a dial modifier.
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Ethernet.h>
+
+#include "check.h"
+#include "emulator.h"
+#include "tcp_peer.h"
+#include "virtual_host.h"
+
+namespace {
+    constexpr uint16_t peer_port = 12000;
+
+    // Answers A queries for a few names with 127.0.0.1 (TTL 0, so nothing is
+    // cached between dials) and everything else with NXDOMAIN
+    class dns_server
+    {
+        private:
+            EthernetUDP udp;
+            std::atomic<bool> running;
+            std::mutex mutex;
+            std::vector<std::string> queries;
+            std::thread thread;
+
+            static bool known(const std::string &name)
+            {
+                return name == "game.example.net" || name == "tokyo.example.net";
+            }
+
+            void answer(const uint8_t *msg, const size_t len)
+            {
+                if (len < 12) {return;}
+                std::string name;
+                size_t pos = 12;
+                while (pos < len && msg[pos] != 0) {
+                    if (!name.empty()) {name += '.';}
+                    name.append(reinterpret_cast<const char *>(&msg[pos + 1]), msg[pos]);
+                    pos += 1 + msg[pos];
+                }
+                pos += 1 + 4; // QTYPE, QCLASS
+                if (pos > len) {return;}
+                {
+                    std::lock_guard<std::mutex> lk(mutex);
+                    queries.push_back(name);
+                }
+
+                std::vector<uint8_t> reply(msg, msg + pos);
+                const auto found = known(name);
+                reply[2] = 0x81;
+                reply[3] = found ? 0x80 : 0x83; // NXDOMAIN
+                reply[7] = found ? 1 : 0;
+                if (found) {
+                    const uint8_t record[] = {0xc0, 0x0c, 0x00, 0x01, 0x00, 0x01, 0, 0, 0, 0, 0x00, 0x04, 127, 0, 0, 1};
+                    reply.insert(reply.end(), record, record + sizeof(record));
+                }
+                udp.beginPacket(udp.remoteIP(), udp.remotePort());
+                udp.write(reply.data(), reply.size());
+                udp.endPacket();
+            }
+
+            void run(void)
+            {
+                while (running) {
+                    if (udp.parsePacket() > 0) {
+                        uint8_t msg[512];
+                        const auto len = udp.read(msg, sizeof(msg));
+                        if (len > 0) {answer(msg, len);}
+                        continue;
+                    }
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                }
+            }
+        public:
+            dns_server() : running(true)
+            {
+                CHECK(udp.begin(53));
+                thread = std::thread([this] {run();});
+            }
+            ~dns_server()
+            {
+                running = false;
+                thread.join();
+                udp.stop();
+            }
+            std::vector<std::string> take_queries(void)
+            {
+                std::lock_guard<std::mutex> lk(mutex);
+                std::vector<std::string> taken;
+                taken.swap(queries);
+                return taken;
+            }
+    };
+
+    void dial_and_hang_up(host::virtual_host &usb, host::tcp_peer &listener, const std::string &dial_string)
+    {
+        usb.write("ATD" + dial_string + "#" + std::to_string(peer_port) + "\r");
+        CHECK(listener.accept(5000));
+        CHECK(usb.expect("CONNECT 33600 V.42\r\n"));
+        CHECK(usb.set_dtr(false));
+        CHECK(listener.wait_closed());
+        CHECK(usb.set_dtr(true));
+        usb.write("AT\r");
+        CHECK(usb.expect("OK\r\n"));
+    }
+}
+
+int main(void)
+{
+    host::emulator emu;
+    host::virtual_host usb;
+    emu.start();
+    CHECK(usb.enumerate());
+    CHECK(usb.set_dtr(true));
+
+    {
+        dns_server dns;
+        host::tcp_peer listener;
+        CHECK(listener.listen(peer_port));
+
+        dial_and_hang_up(usb, listener, "game*example*net");
+        CHECK(dns.take_queries() == std::vector<std::string>({"game.example.net"}));
+
+        // T as a dial modifier: the name as dialed fails, the rest resolves
+        dial_and_hang_up(usb, listener, "Tgame*example*net");
+        CHECK(dns.take_queries() == std::vector<std::string>({"Tgame.example.net", "game.example.net"}));
+
+        // t as the first letter of the name: nothing is taken off
+        dial_and_hang_up(usb, listener, "tokyo*example*net");
+        CHECK(dns.take_queries() == std::vector<std::string>({"tokyo.example.net"}));
+
+        // Before an address T is always a modifier, and no lookup is made
+        dial_and_hang_up(usb, listener, "T127-0-0-1");
+        CHECK(dns.take_queries().empty());
+
+        usb.write("ATDunknown*example*net#" + std::to_string(peer_port) + "\r");
+        CHECK(usb.expect("BUSY\r\n", 5000));
+        CHECK(dns.take_queries() == std::vector<std::string>({"unknown.example.net"}));
+    }
+
+    usb.stop();
+    emu.stop();
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,109 @@
+// core0 sleeps in wait_for_event() until the USB IRQ, core1 or the report
+// interval wakes it, instead of polling. Compared with the delay(1) polling
+// it replaced (host::set_wfe_polling()): loop() passes while idle, the
+// spacing of the status packets, and how long AT commands sent at random
+// moments take to be answered (p50/p99/max).
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "config.h"
+#include "emulator.h"
+#include "host.h"
+#include "virtual_host.h"
+
+namespace {
+    using clock = std::chrono::steady_clock;
+
+    struct distribution {
+        double p50, p99, max;
+    };
+
+    struct result {
+        uint32_t passes; // in 1 s idle
+        distribution status_interval_ms;
+        distribution response_ms;
+    };
+
+    distribution summarize(std::vector<double> samples)
+    {
+        CHECK(!samples.empty());
+        std::sort(samples.begin(), samples.end());
+        return {samples[samples.size() / 2], samples[std::min(samples.size() - 1, samples.size() * 99 / 100)], samples.back()};
+    }
+
+    result measure(host::emulator &emu, host::virtual_host &usb, const bool polling)
+    {
+        host::set_wfe_polling(polling);
+        usb.write("AT\r");
+        CHECK(usb.expect("OK\r\n"));
+
+        // Idle for 1 s, noting when each status packet is picked up
+        result r;
+        const auto passes_at_start = emu.get_loop_count();
+        std::vector<double> intervals;
+        auto packets = usb.get_in_packets();
+        clock::time_point last_packet;
+        const auto end = clock::now() + std::chrono::seconds(1);
+        while (clock::now() < end) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            const auto now_packets = usb.get_in_packets();
+            if (now_packets == packets) {continue;}
+            const auto now = clock::now();
+            if (last_packet != clock::time_point()) {intervals.push_back(std::chrono::duration<double, std::milli>(now - last_packet).count());}
+            last_packet = now;
+            packets = now_packets;
+        }
+        r.passes = emu.get_loop_count() - passes_at_start;
+        r.status_interval_ms = summarize(intervals);
+
+        // Commands at random points between status packets
+        std::mt19937 rng(5);
+        std::vector<double> responses;
+        for (int i = 0; i < 100; i++) {
+            std::this_thread::sleep_for(std::chrono::microseconds(2000 + rng() % 5000));
+            const auto start = clock::now();
+            usb.write("AT\r");
+            CHECK(usb.expect("OK\r\n"));
+            responses.push_back(std::chrono::duration<double, std::milli>(clock::now() - start).count());
+        }
+        r.response_ms = summarize(responses);
+
+        printf("%-8s %4u loop() passes in 1 s idle, status every p50 %.2f p99 %.2f max %.2f ms, AT answered p50 %.2f p99 %.2f max %.2f ms\n",
+            polling ? "delay(1)" : "wfe", r.passes,
+            r.status_interval_ms.p50, r.status_interval_ms.p99, r.status_interval_ms.max,
+            r.response_ms.p50, r.response_ms.p99, r.response_ms.max);
+        return r;
+    }
+}
+
+int main(void)
+{
+    host::emulator emu;
+    host::virtual_host usb;
+    emu.start();
+    CHECK(usb.enumerate());
+    CHECK(usb.set_dtr(true));
+
+    const auto polled = measure(emu, usb, true);
+    const auto event = measure(emu, usb, false);
+
+    // A status packet every report_interval_ms, each waking loop() when sent
+    // and when picked up; polling every millisecond is about 1000 passes
+    CHECK(event.passes <= 4 * 1000 / config::report_interval_ms);
+    CHECK(event.passes * 4 < polled.passes);
+    CHECK(std::abs(event.status_interval_ms.p50 - config::report_interval_ms) < 5);
+
+    // And an event gets through at once instead of at the next poll
+    CHECK(event.response_ms.p50 < polled.response_ms.p50);
+    CHECK(event.response_ms.p99 < config::report_interval_ms);
+
+    usb.stop();
+    emu.stop();
+    printf("ok\n");
+    return 0;
+}
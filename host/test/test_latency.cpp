@@ -0,0 +1,237 @@
+// The online data path under three kinds of traffic: 8-byte echoes every
+// 2 ms, 8-32-byte frames at 60 Hz echoed by the peer as a game exchanging
+// pad data would, and a bulk transfer both ways at once. For each, the round
+// trip seen by the USB host (where it applies) and the firmware's own
+// per-stage probes are reported: latency percentiles and bytes per second
+// through each stage while the traffic ran ("usb in" counts the two status
+// bytes of each packet too).
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "emulator.h"
+#include "latency_probe.h"
+#include "tcp_peer.h"
+#include "virtual_host.h"
+
+// Per-stage probes of the sketch (me56ps2-emulator-rp2040.ino)
+extern latency_probe<> usb_to_net_latency;
+extern latency_probe<> net_to_usb_latency;
+extern latency_probe<> usb_in_latency;
+
+namespace {
+    using clock = std::chrono::steady_clock;
+
+    constexpr uint16_t peer_port = 12000;
+
+    // The probes count from boot; a scenario is reported as the difference
+    struct probe_snapshot {
+        uint32_t bytes;
+        uint32_t histogram[latency_probe<>::BUCKETS];
+    };
+
+    struct stages {
+        probe_snapshot usb_to_net, net_to_usb, usb_in;
+    };
+
+    probe_snapshot take(latency_probe<> &probe)
+    {
+        probe_snapshot s;
+        s.bytes = probe.get_bytes();
+        probe.get_histogram(s.histogram);
+        return s;
+    }
+
+    stages take_all(void)
+    {
+        return {take(usb_to_net_latency), take(net_to_usb_latency), take(usb_in_latency)};
+    }
+
+    double percentile_ms(std::vector<double> samples, const int percent)
+    {
+        std::sort(samples.begin(), samples.end());
+        return samples[std::min(samples.size() - 1, samples.size() * percent / 100)];
+    }
+
+    // Returns the bytes per second through the stage
+    double report_stage(const char *name, const probe_snapshot &before, const probe_snapshot &after, const double seconds, const uint32_t expected_bytes)
+    {
+        uint32_t histogram[latency_probe<>::BUCKETS];
+        uint32_t samples = 0;
+        for (int i = 0; i < latency_probe<>::BUCKETS; i++) {
+            histogram[i] = after.histogram[i] - before.histogram[i];
+            samples += histogram[i];
+        }
+        const auto bytes = after.bytes - before.bytes;
+        const auto rate = bytes / seconds;
+        printf("  %-9s p50 %lu p90 %lu p99 %lu us, %lu bytes, %.0f bytes/s, %lu samples\n", name,
+            static_cast<unsigned long>(latency_probe<>::percentile_us(histogram, 50)),
+            static_cast<unsigned long>(latency_probe<>::percentile_us(histogram, 90)),
+            static_cast<unsigned long>(latency_probe<>::percentile_us(histogram, 99)),
+            static_cast<unsigned long>(bytes), rate, static_cast<unsigned long>(samples));
+        CHECK(bytes >= expected_bytes);
+        CHECK(samples > 0);
+        return rate;
+    }
+
+    void report_stages(const stages &before, const double seconds, const uint32_t usb_to_net_bytes, const uint32_t net_to_usb_bytes)
+    {
+        const auto after = take_all();
+        report_stage("usb->net", before.usb_to_net, after.usb_to_net, seconds, usb_to_net_bytes);
+        report_stage("net->usb", before.net_to_usb, after.net_to_usb, seconds, net_to_usb_bytes);
+        report_stage("usb in", before.usb_in, after.usb_in, seconds, net_to_usb_bytes);
+    }
+
+    // The peer sends back whatever it gets, until stopped
+    class echo_peer
+    {
+        private:
+            host::tcp_peer &peer;
+            std::atomic<bool> running;
+            std::thread thread;
+        public:
+            echo_peer(host::tcp_peer &peer) : peer(peer), running(true)
+            {
+                thread = std::thread([this] {
+                    while (running) {
+                        const auto data = this->peer.read();
+                        if (data.empty()) {
+                            std::this_thread::sleep_for(std::chrono::microseconds(50));
+                            continue;
+                        }
+                        CHECK(this->peer.write(data));
+                    }
+                });
+            }
+            ~echo_peer()
+            {
+                running = false;
+                thread.join();
+            }
+    };
+
+    // Frames of the given sizes, one every interval, each echoed before the
+    // next goes out; returns the round trips in ms
+    std::vector<double> echo_frames(host::virtual_host &usb, const std::vector<size_t> &sizes, const clock::duration interval)
+    {
+        std::vector<double> round_trips;
+        auto next = clock::now();
+        for (size_t i = 0; i < sizes.size(); i++) {
+            std::this_thread::sleep_until(next);
+            next += interval;
+            std::string frame(sizes[i], static_cast<char>(i));
+            frame[0] = static_cast<char>(i >> 8);
+            const auto start = clock::now();
+            usb.write(frame);
+            std::string echoed;
+            CHECK(usb.read_exactly(&echoed, frame.size(), 2000));
+            CHECK(echoed == frame);
+            round_trips.push_back(std::chrono::duration<double, std::milli>(clock::now() - start).count());
+        }
+        return round_trips;
+    }
+
+    uint32_t total(const std::vector<size_t> &sizes)
+    {
+        uint32_t bytes = 0;
+        for (const auto size : sizes) {
+            bytes += size;
+        }
+        return bytes;
+    }
+
+    void test_small_echo(host::virtual_host &usb, host::tcp_peer &peer)
+    {
+        const std::vector<size_t> sizes(300, 8);
+        const auto before = take_all();
+        const auto start = clock::now();
+        std::vector<double> round_trips;
+        {
+            echo_peer echo(peer);
+            round_trips = echo_frames(usb, sizes, std::chrono::milliseconds(2));
+        }
+        const auto seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+        const auto p50 = percentile_ms(round_trips, 50);
+        printf("8-byte frames every 2 ms: round trip p50 %.2f ms, p99 %.2f ms, max %.2f ms\n", p50, percentile_ms(round_trips, 99), percentile_ms(round_trips, 100));
+        // Nothing on the path waits for a poll interval (report_interval_ms is 40 ms)
+        CHECK(p50 < 10);
+        report_stages(before, seconds, total(sizes), total(sizes));
+    }
+
+    // What a game sends once per video frame: a few bytes of pad state,
+    // sometimes more
+    void test_game_frames(host::virtual_host &usb, host::tcp_peer &peer)
+    {
+        std::vector<size_t> sizes;
+        for (int i = 0; i < 180; i++) {
+            sizes.push_back(8 + (i * 7) % 25);
+        }
+        const auto before = take_all();
+        const auto start = clock::now();
+        std::vector<double> round_trips;
+        {
+            echo_peer echo(peer);
+            round_trips = echo_frames(usb, sizes, std::chrono::microseconds(16667));
+        }
+        const auto seconds = std::chrono::duration<double>(clock::now() - start).count();
+
+        const auto p50 = percentile_ms(round_trips, 50);
+        printf("8-32-byte frames at 60 Hz: round trip p50 %.2f ms, p99 %.2f ms, max %.2f ms\n", p50, percentile_ms(round_trips, 99), percentile_ms(round_trips, 100));
+        CHECK(p50 < 10);
+        report_stages(before, seconds, total(sizes), total(sizes));
+    }
+
+    // Both directions at once, as fast as they go
+    void test_bulk(host::virtual_host &usb, host::tcp_peer &peer)
+    {
+        constexpr size_t len = 256 * 1024;
+        std::string data(len, '\0');
+        for (size_t i = 0; i < len; i++) {
+            data[i] = static_cast<char>(i * 7 + (i >> 10));
+        }
+
+        const auto before = take_all();
+        const auto start = clock::now();
+        std::thread to_usb([&] {CHECK(peer.write(data));});
+        usb.write(data);
+        std::string from_peer, from_usb;
+        CHECK(usb.read_exactly(&from_peer, len, 30000));
+        to_usb.join();
+        CHECK(peer.read_exactly(&from_usb, len, 30000));
+        const auto seconds = std::chrono::duration<double>(clock::now() - start).count();
+        CHECK(from_peer == data);
+        CHECK(from_usb == data);
+
+        printf("bulk, %zu bytes each way at once: %.2f s\n", len, seconds);
+        report_stages(before, seconds, len, len);
+    }
+}
+
+int main(void)
+{
+    host::emulator emu;
+    host::virtual_host usb;
+    emu.start();
+    CHECK(usb.enumerate());
+    CHECK(usb.set_dtr(true));
+
+    host::tcp_peer peer;
+    CHECK(peer.listen(peer_port));
+    usb.write("ATD127-0-0-1#" + std::to_string(peer_port) + "\r");
+    CHECK(peer.accept());
+    CHECK(usb.expect("CONNECT 33600 V.42\r\n"));
+
+    test_small_echo(usb, peer);
+    test_game_frames(usb, peer);
+    test_bulk(usb, peer);
+
+    usb.stop();
+    emu.stop();
+    printf("ok\n");
+    return 0;
+}
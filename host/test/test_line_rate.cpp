@@ -0,0 +1,124 @@
+// Line rate emulation (S37) end to end: for a few rates, a loopback peer and
+// the USB host each send about 1.5 s worth of line time at once, and the
+// rate the other side receives it at, from the first byte to the last, is
+// compared with the nominal one. The longest gap between arrivals shows how
+// smoothly the bytes are spread out.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <thread>
+
+#include "check.h"
+#include "emulator.h"
+#include "tcp_peer.h"
+#include "virtual_host.h"
+
+namespace {
+    using clock = std::chrono::steady_clock;
+
+    constexpr uint16_t peer_port = 12000;
+    constexpr double seconds_per_run = 1.5;
+    constexpr double max_rate_error = 0.03;
+
+    struct measurement {
+        double rate_bps;
+        double max_gap_ms;
+    };
+
+    std::string make_data(const size_t len)
+    {
+        std::string data(len, '\0');
+        for (size_t i = 0; i < len; i++) {
+            data[i] = static_cast<char>(i * 13 + (i >> 8));
+        }
+        return data;
+    }
+
+    // Polls read() until len bytes came; the bytes of the first read are the
+    // allowed burst and only mark the start
+    template <typename F>
+    measurement receive(F read, const std::string &expected)
+    {
+        std::string received;
+        clock::time_point first, last;
+        size_t first_len = 0;
+        double max_gap_ms = 0;
+        const auto deadline = clock::now() + std::chrono::seconds(10);
+        while (received.size() < expected.size() && clock::now() < deadline) {
+            const auto data = read();
+            if (data.empty()) {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+                continue;
+            }
+            const auto now = clock::now();
+            if (received.empty()) {
+                first = now;
+                first_len = data.size();
+            } else {
+                max_gap_ms = std::max(max_gap_ms, std::chrono::duration<double, std::milli>(now - last).count());
+            }
+            last = now;
+            received += data;
+        }
+        CHECK(received == expected);
+        const auto seconds = std::chrono::duration<double>(last - first).count();
+        return {(expected.size() - first_len) * 8 / seconds, max_gap_ms};
+    }
+
+    void check_rate(const char *direction, const uint32_t nominal_bps, const measurement &m)
+    {
+        const auto error = m.rate_bps / nominal_bps - 1;
+        printf("%5u bps %s: %.0f bps (%+.2f%%), longest gap %.2f ms\n", static_cast<unsigned>(nominal_bps), direction, m.rate_bps, error * 100, m.max_gap_ms);
+        CHECK(std::fabs(error) < max_rate_error);
+    }
+
+    void test_rate(host::virtual_host &usb, host::tcp_peer &listener, const int s37)
+    {
+        const uint32_t nominal_bps = s37 * 2400;
+        const auto data = make_data(static_cast<size_t>(nominal_bps / 8 * seconds_per_run));
+
+        usb.write("ATS37=" + std::to_string(s37) + "D127-0-0-1#" + std::to_string(peer_port) + "\r");
+        CHECK(listener.accept());
+        CHECK(usb.expect("CONNECT " + std::to_string(nominal_bps) + " V.42\r\n"));
+
+        // Received data goes to the game a byte at a time, data from the game
+        // to the network in bursts of up to 10 ms of line time. The gap
+        // limits leave room for the host's scheduling, not for stalls.
+        CHECK(listener.write(data));
+        const auto net_to_usb = receive([&] {return usb.read();}, data);
+        check_rate("net->usb", nominal_bps, net_to_usb);
+        CHECK(net_to_usb.max_gap_ms < 8000.0 / nominal_bps + 20);
+
+        usb.write(data);
+        const auto usb_to_net = receive([&] {return listener.read();}, data);
+        check_rate("usb->net", nominal_bps, usb_to_net);
+        CHECK(usb_to_net.max_gap_ms < 8000.0 / nominal_bps + 30);
+
+        CHECK(usb.set_dtr(false));
+        CHECK(listener.wait_closed());
+        CHECK(usb.set_dtr(true));
+        usb.write("AT\r");
+        CHECK(usb.expect("OK\r\n"));
+    }
+}
+
+int main(void)
+{
+    host::emulator emu;
+    host::virtual_host usb;
+    emu.start();
+    CHECK(usb.enumerate());
+    CHECK(usb.set_dtr(true));
+
+    host::tcp_peer listener;
+    CHECK(listener.listen(peer_port));
+    for (const auto s37 : {1, 4, 14}) {
+        test_rate(usb, listener, s37);
+    }
+
+    usb.stop();
+    emu.stop();
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,150 @@
+// lz_encoder/lz_decoder on their own: round trips in every call size the data
+// path uses, the MAX_OUTPUT bound, and the ratio and encode/decode cost per
+// KB for chat text, game-like frames and incompressible bytes.
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "lz_codec.h"
+
+namespace {
+    constexpr size_t sample_size = 256 * 1024;
+
+    std::string make_text(void)
+    {
+        static const char *const lines[] = {
+            "<player1> gg, one more round?\r\n",
+            "<player2> sure, same stage\r\n",
+            "<player1> lag was fine this time\r\n",
+            "<player3> joining after this match\r\n",
+        };
+        std::mt19937 rng(1);
+        std::string data;
+        while (data.size() < sample_size) {
+            data += lines[rng() % 4];
+        }
+        data.resize(sample_size);
+        return data;
+    }
+
+    // 16-byte input frames: a frame counter, a few slowly changing fields, padding
+    std::string make_frames(void)
+    {
+        std::mt19937 rng(2);
+        std::string data;
+        uint8_t buttons = 0;
+        for (uint32_t frame = 0; data.size() < sample_size; frame++) {
+            if (rng() % 8 == 0) {buttons = rng();}
+            const uint8_t msg[16] = {0xa5, 0x10, static_cast<uint8_t>(frame >> 8), static_cast<uint8_t>(frame), buttons, 0, 0, 0, 0x80, 0x80, 0, 0, 0, 0, 0, 0x5a};
+            data.append(reinterpret_cast<const char *>(msg), sizeof(msg));
+        }
+        data.resize(sample_size);
+        return data;
+    }
+
+    std::string make_random(void)
+    {
+        std::mt19937 rng(3);
+        std::string data(sample_size, '\0');
+        for (auto &c : data) {
+            c = static_cast<char>(rng());
+        }
+        return data;
+    }
+
+    std::vector<uint8_t> encode(lz_encoder &encoder, const std::string &data, const size_t chunk)
+    {
+        std::vector<uint8_t> encoded;
+        uint8_t out[lz_encoder::MAX_OUTPUT];
+        for (size_t pos = 0; pos < data.size(); pos += chunk) {
+            const auto len = std::min(chunk, data.size() - pos);
+            const auto out_len = encoder.encode(&data[pos], len, out);
+            CHECK(out_len <= lz_encoder::MAX_OUTPUT);
+            encoded.insert(encoded.end(), out, out + out_len);
+        }
+        return encoded;
+    }
+
+    // Feeds in_chunk bytes at a time into an output of out_chunk bytes, as net_read_decoded() does
+    std::string decode(lz_decoder &decoder, const std::vector<uint8_t> &encoded, const size_t in_chunk, const size_t out_chunk)
+    {
+        std::string decoded;
+        std::vector<char> out(out_chunk);
+        size_t pos = 0;
+        while (true) {
+            const auto len = std::min(in_chunk, encoded.size() - pos);
+            size_t consumed;
+            const auto out_len = decoder.decode(&encoded[pos], len, &consumed, out.data(), out.size());
+            decoded.append(out.data(), out_len);
+            pos += consumed;
+            if (out_len == 0 && consumed == 0) {break;}
+        }
+        CHECK_EQ(pos, encoded.size());
+        return decoded;
+    }
+
+    void test_round_trip(const std::string &data)
+    {
+        const auto sample = data.substr(0, 32 * 1024);
+        for (const size_t chunk : {size_t{1}, size_t{17}, size_t{64}, lz_encoder::MAX_INPUT}) {
+            for (const size_t in_chunk : {1, 256}) {
+                lz_encoder encoder;
+                lz_decoder decoder;
+                const auto encoded = encode(encoder, sample, chunk);
+                CHECK(decode(decoder, encoded, in_chunk, 61) == sample);
+            }
+        }
+    }
+
+    void bench(const char *name, const std::string &data)
+    {
+        static lz_encoder encoder;
+        static lz_decoder decoder;
+        encoder.reset();
+        decoder.reset();
+
+        const auto start = std::chrono::steady_clock::now();
+        const auto encoded = encode(encoder, data, lz_encoder::MAX_INPUT);
+        const auto encoded_time = std::chrono::steady_clock::now();
+        const auto decoded = decode(decoder, encoded, 256, 2048);
+        const auto end = std::chrono::steady_clock::now();
+        CHECK(decoded == data);
+
+        const auto kb = data.size() / 1024.0;
+        const auto ratio = static_cast<double>(encoded.size()) / data.size();
+        printf("%-7s ratio %.3f, encode %.2f us/KB, decode %.2f us/KB\n", name, ratio,
+            std::chrono::duration<double, std::micro>(encoded_time - start).count() / kb,
+            std::chrono::duration<double, std::micro>(end - encoded_time).count() / kb);
+    }
+}
+
+int main(void)
+{
+    const auto text = make_text();
+    const auto frames = make_frames();
+    const auto random = make_random();
+
+    for (const auto *data : {&text, &frames, &random}) {
+        test_round_trip(*data);
+    }
+
+    // Incompressible input only pays the literal control bytes
+    {
+        lz_encoder encoder;
+        const auto encoded = encode(encoder, random, lz_encoder::MAX_INPUT);
+        CHECK(encoded.size() <= random.size() + random.size() / 128 + random.size() / lz_encoder::MAX_INPUT);
+        lz_encoder text_encoder;
+        CHECK(encode(text_encoder, text, lz_encoder::MAX_INPUT).size() < text.size() / 4);
+    }
+
+    bench("text", text);
+    bench("frames", frames);
+    bench("random", random);
+
+    printf("ok\n");
+    return 0;
+}
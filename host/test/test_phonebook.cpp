@@ -0,0 +1,150 @@
+// phonebook on the mock flash: entries survive a reload and many compactions,
+// a log written before there were two sectors is still read, and the power
+// may be cut after any erase or program without losing what was stored.
+#include <array>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "hardware/flash.h"
+#include "host.h"
+#include "phonebook.h"
+
+namespace {
+    constexpr uint32_t primary_offset = 0xf000;
+    constexpr uint32_t spare_offset = 0xe000;
+
+    using contents = std::array<std::string, phonebook::ENTRIES>;
+
+    void erase_both(void)
+    {
+        flash_range_erase(primary_offset, FLASH_SECTOR_SIZE);
+        flash_range_erase(spare_offset, FLASH_SECTOR_SIZE);
+    }
+
+    contents read_all(phonebook &book)
+    {
+        contents c;
+        for (int i = 0; i < phonebook::ENTRIES; i++) {
+            const auto *dial = book.get(i);
+            c[i] = dial == nullptr ? "" : dial;
+        }
+        return c;
+    }
+
+    contents reload(const uint32_t flash_offset, const uint32_t spare_flash_offset)
+    {
+        phonebook book(flash_offset, spare_flash_offset);
+        book.load();
+        return read_all(book);
+    }
+
+    // Enough changes for a few compactions, with deletions along the way
+    std::vector<std::pair<int, std::string>> make_changes(void)
+    {
+        std::vector<std::pair<int, std::string>> changes;
+        for (int n = 0; n < 150; n++) {
+            const auto index = (n * 3) % phonebook::ENTRIES;
+            changes.emplace_back(index, n % 11 == 5 ? "" : "192-168-0-" + std::to_string(n) + "#" + std::to_string(10000 + n));
+        }
+        return changes;
+    }
+
+    void test_basic(const uint32_t spare_flash_offset)
+    {
+        erase_both();
+        phonebook book(primary_offset, spare_flash_offset);
+        book.load();
+        CHECK(book.get(0) == nullptr);
+        CHECK(book.set(0, "example*net#10023"));
+        CHECK(book.set(9, std::string(phonebook::DIAL_SIZE, '1').c_str()));
+        CHECK(!book.set(10, "1"));
+        CHECK(!book.set(1, std::string(phonebook::DIAL_SIZE + 1, '1').c_str()));
+        CHECK(reload(primary_offset, spare_flash_offset) == read_all(book));
+        CHECK(book.set(0, ""));
+        CHECK(book.get(0) == nullptr);
+
+        contents expected = read_all(book);
+        for (const auto &change : make_changes()) {
+            CHECK(book.set(change.first, change.second.c_str()));
+            expected[change.first] = change.second;
+        }
+        CHECK(read_all(book) == expected);
+        CHECK(reload(primary_offset, spare_flash_offset) == expected);
+    }
+
+    // Records from slot 0 without a header, as the one-sector log wrote them
+    void test_old_log(void)
+    {
+        erase_both();
+        uint8_t page[FLASH_PAGE_SIZE];
+        memset(page, 0xff, sizeof(page));
+        const char *dials[] = {"10-0-0-1", "example*net"};
+        for (int i = 0; i < 2; i++) {
+            auto *rec = &page[i * 64];
+            memset(rec, 0, 64);
+            rec[0] = 0x42;
+            rec[1] = 0x50;
+            rec[2] = i * 3;
+            rec[3] = strlen(dials[i]);
+            memcpy(&rec[4], dials[i], strlen(dials[i]));
+        }
+        flash_range_program(primary_offset, page, sizeof(page));
+
+        phonebook book(primary_offset, spare_offset);
+        book.load();
+        CHECK(std::string(book.get(0)) == "10-0-0-1");
+        CHECK(std::string(book.get(3)) == "example*net");
+        CHECK(book.set(1, "10-0-0-2"));
+        const auto expected = read_all(book);
+        CHECK(reload(primary_offset, spare_offset) == expected);
+        CHECK(std::string(expected[3]) == "example*net");
+    }
+
+    // Cut the power after every possible number of flash operations: what is
+    // read back is what the last completed set() left, and storing goes on
+    void test_power_loss(void)
+    {
+        const auto changes = make_changes();
+        int cuts = 0;
+        for (int limit = 0;; limit++) {
+            erase_both();
+            phonebook book(primary_offset, spare_offset);
+            book.load();
+
+            host::set_flash_write_limit(limit);
+            contents model, persisted;
+            for (const auto &change : changes) {
+                CHECK(book.set(change.first, change.second.c_str()));
+                model[change.first] = change.second;
+                if (host::get_flash_writes_dropped() == 0) {persisted = model;}
+            }
+            const auto dropped = host::get_flash_writes_dropped();
+            host::set_flash_write_limit(-1);
+            if (dropped == 0) {break;}
+            cuts++;
+
+            phonebook restored(primary_offset, spare_offset);
+            restored.load();
+            CHECK(read_all(restored) == persisted);
+            for (const auto &change : changes) {
+                CHECK(restored.set(change.first, change.second.c_str()));
+            }
+            CHECK(reload(primary_offset, spare_offset) == model);
+        }
+        printf("power cut at %d points, nothing lost\n", cuts);
+        CHECK(cuts > 150);
+    }
+}
+
+int main(void)
+{
+    test_basic(spare_offset);
+    test_basic(primary_offset); // no spare: compacts in place
+    test_old_log();
+    test_power_loss();
+
+    printf("ok\n");
+    return 0;
+}
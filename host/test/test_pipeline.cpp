@@ -0,0 +1,204 @@
+// The whole emulator end to end: a virtual USB host enumerates it and talks
+// AT commands, and calls go over loopback TCP to a peer in this process.
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "config.h"
+#include "emulator.h"
+#include "host.h"
+#include "me56ps2.h"
+#include "tcp_peer.h"
+#include "virtual_host.h"
+
+namespace {
+    constexpr uint16_t peer_port = 12000;
+
+    std::string make_data(const size_t len, const unsigned seed)
+    {
+        std::string data(len, '\0');
+        for (size_t i = 0; i < len; i++) {
+            data[i] = static_cast<char>((i * 31 + seed) ^ (i >> 8));
+        }
+        return data;
+    }
+
+    void test_enumeration(host::virtual_host &usb)
+    {
+        CHECK(usb.enumerate());
+
+        std::vector<uint8_t> desc;
+        CHECK(usb.get_descriptor(USB_DESCRIPTOR_TYPE_DEVICE, 0, &desc));
+        const auto *dev = reinterpret_cast<const usb_device_descriptor *>(desc.data());
+        CHECK_EQ(dev->idVendor, ME56PS2_USB_VENDOR_ID);
+        CHECK_EQ(dev->idProduct, ME56PS2_USB_PRODUCT_ID);
+        CHECK(usb.get_descriptor(USB_DESCRIPTOR_TYPE_STRING, ME56PS2_STRING_ID_PRODUCT, &desc));
+        CHECK(!usb.get_descriptor(USB_DESCRIPTOR_TYPE_STRING, ME56PS2_STRING_DESCRIPTORS_NUM, &desc)); // stalled
+        CHECK(usb.set_dtr(true));
+
+        // Status packets keep coming while idle, without carrier
+        CHECK(usb.wait_for_carrier(false));
+    }
+
+    void test_commands(host::virtual_host &usb)
+    {
+        usb.write("AT\r");
+        CHECK(usb.expect("OK\r\n"));
+        usb.write("ATE0V1S0=0S7=5\r");
+        CHECK(usb.expect("OK\r\n"));
+        usb.write("ATI\r");
+        CHECK(usb.expect("ME56PS2\r\n"));
+        CHECK(usb.expect("OK\r\n"));
+        // Counters come back over USB even though enable_log is off
+        usb.write("ATI6\r");
+        CHECK(usb.expect("uptime: "));
+        CHECK(usb.expect("buffer log_tx: "));
+        CHECK(usb.expect("OK\r\n"));
+        usb.write("ATS7?\r");
+        CHECK(usb.expect("005\r\n"));
+        usb.write("ATH0Z\r");
+        CHECK(usb.expect("OK\r\n"));
+    }
+
+    void exchange(host::virtual_host &usb, host::tcp_peer &peer, const size_t len)
+    {
+        const auto to_peer = make_data(len, 1);
+        usb.write(to_peer);
+        std::string received;
+        CHECK(peer.read_exactly(&received, to_peer.size(), 5000));
+        CHECK(received == to_peer);
+
+        const auto to_usb = make_data(len, 2);
+        CHECK(peer.write(to_usb));
+        CHECK(usb.read_exactly(&received, to_usb.size(), 5000));
+        CHECK(received == to_usb);
+    }
+
+    void test_dial(host::virtual_host &usb)
+    {
+        host::tcp_peer peer;
+        CHECK(peer.listen(peer_port));
+
+        usb.write("ATD127-0-0-1#" + std::to_string(peer_port) + "\r");
+        CHECK(peer.accept());
+        CHECK(usb.expect("CONNECT 33600 V.42\r\n"));
+        CHECK(usb.wait_for_carrier(true));
+
+        exchange(usb, peer, 100);
+        exchange(usb, peer, 64 * 1024);
+
+        // The peer hangs up: carrier drops (no result code), and the host goes on-hook
+        peer.close();
+        CHECK(usb.wait_for_carrier(false, 5000));
+        CHECK(usb.set_dtr(false));
+        CHECK(usb.set_dtr(true));
+        usb.write("AT\r");
+        CHECK(usb.expect("OK\r\n"));
+    }
+
+    void test_refused(host::virtual_host &usb)
+    {
+        usb.write("ATD127-0-0-1#" + std::to_string(peer_port + 1) + "\r");
+        CHECK(usb.expect("BUSY\r\n", 5000));
+    }
+
+    void test_answer(host::virtual_host &usb)
+    {
+        host::tcp_peer caller;
+        CHECK(caller.connect(config::listen_port));
+        CHECK(usb.expect("RING\r\n", 5000));
+        usb.write("ATA\r");
+        CHECK(usb.expect("CONNECT 33600 V.42\r\n"));
+
+        exchange(usb, caller, 1000);
+
+        // Escape to command mode and hang up from here
+        std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+        usb.write("+++");
+        CHECK(usb.expect("OK\r\n", 3000));
+        usb.write("ATH\r");
+        CHECK(usb.expect("OK\r\n"));
+        CHECK(caller.wait_closed());
+        CHECK(usb.wait_for_carrier(false));
+    }
+
+    // S0=2: RING repeats while the call is not answered, and the second one answers it
+    void test_auto_answer(host::virtual_host &usb)
+    {
+        usb.write("ATS0=2\r");
+        CHECK(usb.expect("OK\r\n"));
+        host::tcp_peer caller;
+        CHECK(caller.connect(config::listen_port));
+        CHECK(usb.expect("RING\r\n", 5000));
+        const auto first_ring = std::chrono::steady_clock::now();
+        CHECK(usb.expect("RING\r\n", 5000));
+        CHECK(std::chrono::steady_clock::now() - first_ring >= std::chrono::milliseconds(2500));
+        CHECK(usb.expect("CONNECT 33600 V.42\r\n"));
+        exchange(usb, caller, 100);
+
+        CHECK(usb.set_dtr(false));
+        CHECK(caller.wait_closed());
+        CHECK(usb.set_dtr(true));
+        usb.write("ATS1?\r");
+        CHECK(usb.expect("002\r\nOK\r\n"));
+        usb.write("ATS0=0\r");
+        CHECK(usb.expect("OK\r\n"));
+    }
+
+    void test_on_hook(host::virtual_host &usb)
+    {
+        host::tcp_peer peer;
+        CHECK(peer.listen(peer_port));
+        usb.write("ATD127-0-0-1#" + std::to_string(peer_port) + "\r");
+        CHECK(peer.accept());
+        CHECK(usb.expect("CONNECT"));
+
+        // Dropping DTR hangs up
+        CHECK(usb.set_dtr(false));
+        CHECK(peer.wait_closed());
+        CHECK(usb.set_dtr(true));
+        usb.write("AT\r");
+        CHECK(usb.expect("OK\r\n"));
+    }
+
+    // A half-typed line is dropped on-hook, but a command sent right after
+    // DTR comes back is not, however late loop() gets to the buffer
+    void test_on_hook_then_command(host::virtual_host &usb)
+    {
+        for (int i = 0; i < 200; i++) {
+            usb.write("ATS0=9");
+            while (usb.get_pending_write_count() > 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(500)); // the OUT packet in flight
+            CHECK(usb.set_dtr(false));
+            CHECK(usb.set_dtr(true));
+            usb.write("ATS0?\r");
+            CHECK(usb.expect("000\r\nOK\r\n"));
+        }
+    }
+}
+
+int main(void)
+{
+    host::emulator emu;
+    host::virtual_host usb;
+    emu.start();
+
+    test_enumeration(usb);
+    test_commands(usb);
+    test_dial(usb);
+    test_refused(usb);
+    test_answer(usb);
+    test_auto_answer(usb);
+    test_on_hook(usb);
+    test_on_hook_then_command(usb);
+
+    CHECK_EQ(host::usb_get_pid_errors(), 0u);
+    usb.stop();
+    emu.stop();
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,227 @@
+// ring_buffer on its own: single-threaded behaviour, then a producer and a
+// consumer on two threads (as core0 and core1) checking every byte, the
+// throughput of the locked and the lock-free (SPSC) variants, per call size
+// and across threads, and how long the locked variant holds its critical
+// section, next to the per-element copy it replaced.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "host.h"
+#include "lock.h"
+#include "ring_buffer.h"
+
+namespace {
+    constexpr size_t stress_bytes = 4 * 1024 * 1024;
+
+    void test_basic(void)
+    {
+        ring_buffer<char, 16> buf;
+        const char text[] = "hello\rworld";
+        CHECK_EQ(buf.get_buffer_size(), 15u);
+        CHECK_EQ(buf.enqueue(text, 11), 11u);
+        size_t len;
+        CHECK(buf.find('\r', &len));
+        CHECK_EQ(len, 6u);
+        CHECK_EQ(buf.erase(3), 3u);
+
+        // Full: the rest is dropped and counted
+        CHECK_EQ(buf.enqueue(text, 11), 7u);
+        CHECK(buf.is_full());
+        CHECK_EQ(buf.get_dropped_count(), 4u);
+        CHECK_EQ(buf.get_high_water_mark(), 15u);
+
+        char out[16];
+        CHECK_EQ(buf.dequeue(out, sizeof(out)), 15u);
+        CHECK(memcmp(out, "lo\rworldhello\rw", 15) == 0);
+        CHECK(buf.is_empty());
+    }
+
+    void test_spans(void)
+    {
+        spsc_ring_buffer<char, 16> from;
+        ring_buffer<char, 32> to;
+        for (int i = 0; i < 1000; i++) {
+            // Wraps at different points on both sides
+            char *span;
+            auto len = from.acquire_write_span(&span);
+            CHECK(len > 0);
+            len = std::min<size_t>(len, 11);
+            for (size_t k = 0; k < len; k++) {span[k] = static_cast<char>(i + k);}
+            from.commit_write(len);
+            CHECK_EQ(to.pull(&from), len);
+
+            const char *read_span;
+            size_t got = 0;
+            while (got < len) {
+                const auto n = to.peek_read_span(&read_span);
+                CHECK(n > 0);
+                for (size_t k = 0; k < n; k++) {CHECK_EQ(read_span[k], static_cast<char>(i + got + k));}
+                to.consume(n);
+                got += n;
+            }
+        }
+        CHECK(to.is_empty());
+    }
+
+    // enqueue()/dequeue() cost per call size, single-threaded: one or two
+    // memcpy per call, so larger chunks approach memcpy speed; returns MB/s
+    template <typename B>
+    double bench_chunk(B &buf, const size_t chunk)
+    {
+        constexpr size_t total = 16 * 1024 * 1024;
+        char in[512], out[512];
+        memset(in, 0x5a, sizeof(in));
+        const auto start = std::chrono::steady_clock::now();
+        size_t moved = 0;
+        while (moved < total) {
+            CHECK_EQ(buf.enqueue(in, chunk), chunk);
+            CHECK_EQ(buf.dequeue(out, chunk), chunk);
+            moved += chunk;
+        }
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return total / elapsed / 1e6;
+    }
+
+    // enqueue()/dequeue() as they were before the memcpy spans: one element
+    // at a time under the lock, each with its own index update
+    template <size_t capacity>
+    class per_element_ring_buffer
+    {
+        private:
+            char buffer[capacity];
+            std::atomic<size_t> write_ptr, read_ptr;
+            critical_section_t cs;
+        public:
+            per_element_ring_buffer() : write_ptr(0), read_ptr(0) {critical_section_init(&cs);}
+            ~per_element_ring_buffer() {critical_section_deinit(&cs);}
+            size_t enqueue(const char *data, size_t length)
+            {
+                lock_guard lk(&cs);
+                size_t ptr = 0;
+                while (ptr < length) {
+                    const auto w = write_ptr.load(std::memory_order_relaxed);
+                    const auto next = (w + 1) % capacity;
+                    if (next == read_ptr.load(std::memory_order_acquire)) {break;}
+                    buffer[w] = data[ptr++];
+                    write_ptr.store(next, std::memory_order_release);
+                }
+                return ptr;
+            }
+            size_t dequeue(char *data, size_t max_length)
+            {
+                lock_guard lk(&cs);
+                size_t ptr = 0;
+                while (ptr < max_length) {
+                    const auto r = read_ptr.load(std::memory_order_relaxed);
+                    if (r == write_ptr.load(std::memory_order_acquire)) {break;}
+                    data[ptr++] = buffer[r];
+                    read_ptr.store((r + 1) % capacity, std::memory_order_release);
+                }
+                return ptr;
+            }
+    };
+
+    // Lock hold times of enqueue()+dequeue() pairs of one call size, as
+    // recorded by the mock critical section; prints p50/p99/max in ns and
+    // returns the p99 (the max includes the host preempting the thread)
+    template <typename B>
+    uint32_t bench_hold(const char *name, B &buf, const size_t chunk)
+    {
+        char in[512], out[512];
+        memset(in, 0x5a, sizeof(in));
+        host::take_lock_holds();
+        host::record_lock_holds(true);
+        for (int i = 0; i < 20000; i++) {
+            CHECK_EQ(buf.enqueue(in, chunk), chunk);
+            CHECK_EQ(buf.dequeue(out, chunk), chunk);
+        }
+        host::record_lock_holds(false);
+        auto holds = host::take_lock_holds();
+        CHECK_EQ(holds.size(), 40000u);
+        std::sort(holds.begin(), holds.end());
+        const auto p99 = holds[holds.size() * 99 / 100];
+        printf("chunk %3zu %-12s lock held p50 %5u ns, p99 %5u ns, max %6u ns\n", chunk, name,
+            static_cast<unsigned>(holds[holds.size() / 2]), static_cast<unsigned>(p99), static_cast<unsigned>(holds.back()));
+        return p99;
+    }
+
+    // Producer on core0 and consumer on core1, in odd chunk sizes so that
+    // both sides wrap at every offset; returns MB/s
+    template <typename B>
+    double stress(B &buf, const bool use_spans)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        std::thread producer([&] {
+            host::set_core(0);
+            size_t sent = 0;
+            uint8_t chunk[37];
+            while (sent < stress_bytes) {
+                const auto len = std::min(sizeof(chunk), stress_bytes - sent);
+                for (size_t i = 0; i < len; i++) {chunk[i] = static_cast<uint8_t>(sent + i);}
+                const auto n = buf.enqueue(reinterpret_cast<char *>(chunk), len);
+                sent += n;
+                if (n < len) {std::this_thread::yield();}
+            }
+        });
+
+        host::set_core(1);
+        size_t received = 0;
+        bool in_order = true;
+        while (received < stress_bytes) {
+            char chunk[53];
+            const char *span = chunk;
+            size_t n;
+            if (use_spans) {
+                n = buf.peek_read_span(&span);
+            } else {
+                n = buf.dequeue(chunk, sizeof(chunk));
+            }
+            for (size_t i = 0; i < n; i++) {
+                in_order = in_order && static_cast<uint8_t>(span[i]) == static_cast<uint8_t>(received + i);
+            }
+            if (use_spans) {buf.consume(n);}
+            received += n;
+            if (n == 0) {std::this_thread::yield();}
+        }
+        producer.join();
+        host::set_core(0);
+        CHECK(in_order);
+        CHECK(buf.is_empty());
+
+        const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return stress_bytes / elapsed / 1e6;
+    }
+}
+
+int main(void)
+{
+    test_basic();
+    test_spans();
+
+    static ring_buffer<char, 8192> locked;
+    static spsc_ring_buffer<char, 8192> lock_free;
+    for (const size_t chunk : {1, 16, 64, 511}) {
+        printf("chunk %3zu: locked %.1f MB/s, spsc %.1f MB/s\n", chunk, bench_chunk(locked, chunk), bench_chunk(lock_free, chunk));
+    }
+
+    // A full USB packet and the largest chunk: the copy loop is what held the lock
+    static per_element_ring_buffer<8192> per_element;
+    for (const size_t chunk : {64, 511}) {
+        const auto before = bench_hold("per element", per_element, chunk);
+        const auto after = bench_hold("memcpy", locked, chunk);
+        CHECK(after < before);
+    }
+
+    const auto locked_mbps = stress(locked, false);
+    const auto spsc_mbps = stress(lock_free, false);
+    const auto spsc_span_mbps = stress(lock_free, true);
+    printf("locked %.1f MB/s, spsc %.1f MB/s, spsc with read spans %.1f MB/s\n", locked_mbps, spsc_mbps, spsc_span_mbps);
+
+    printf("ok\n");
+    return 0;
+}
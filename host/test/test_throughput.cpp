@@ -0,0 +1,111 @@
+// Bulk transfers through the online data path in both directions. The IN
+// endpoint is refilled from its completion IRQ, so nearly all packets the
+// host picks up should come from there (ATI6 counts them), not from loop(),
+// and be full.
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include "check.h"
+#include "emulator.h"
+#include "host.h"
+#include "tcp_peer.h"
+#include "virtual_host.h"
+
+namespace {
+    constexpr uint16_t peer_port = 12000;
+    constexpr size_t transfer_size = 1024 * 1024;
+
+    std::string make_data(const size_t len)
+    {
+        std::string data(len, '\0');
+        for (size_t i = 0; i < len; i++) {
+            data[i] = static_cast<char>(i * 7 + (i >> 10));
+        }
+        return data;
+    }
+
+    double seconds_since(const std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // IN packets sent so far and how many of them from the completion IRQ, from ATI6
+    void read_in_counters(host::virtual_host &usb, unsigned long *packets, unsigned long *refills)
+    {
+        usb.write("ATI6\r");
+        CHECK(usb.expect("usb in: "));
+        std::string line;
+        CHECK(usb.read_exactly(&line, 1, 1000));
+        while (line.back() != '\n') {
+            std::string c;
+            CHECK(usb.read_exactly(&c, 1, 1000));
+            line += c;
+        }
+        unsigned long bytes, busy;
+        CHECK_EQ(sscanf(line.c_str(), "%lu packets, %lu bytes, %lu busy, %lu refilled", packets, &bytes, &busy, refills), 4);
+        CHECK(usb.expect("OK\r\n"));
+    }
+}
+
+int main(void)
+{
+    host::emulator emu;
+    host::virtual_host usb;
+    emu.start();
+    CHECK(usb.enumerate());
+    CHECK(usb.set_dtr(true));
+
+    unsigned long packets_before, refills_before;
+    read_in_counters(usb, &packets_before, &refills_before);
+
+    host::tcp_peer peer;
+    CHECK(peer.listen(peer_port));
+    usb.write("ATD127-0-0-1#" + std::to_string(peer_port) + "\r");
+    CHECK(peer.accept());
+    CHECK(usb.expect("CONNECT 33600 V.42\r\n"));
+
+    const auto data = make_data(transfer_size);
+    std::string received;
+
+    // net -> USB
+    const auto passes_at_start = emu.get_loop_count();
+    const auto packets_at_start = usb.get_in_packets();
+    auto start = std::chrono::steady_clock::now();
+    CHECK(peer.write(data));
+    CHECK(usb.read_exactly(&received, data.size(), 30000));
+    const auto in_seconds = seconds_since(start);
+    CHECK(received == data);
+    const auto passes = emu.get_loop_count() - passes_at_start;
+    const auto packets = usb.get_in_packets() - packets_at_start;
+    printf("net->usb: %.2f MB/s, %u IN packets (%.1f bytes each), %u loop() passes\n",
+        data.size() / in_seconds / 1e6, packets, static_cast<double>(data.size()) / packets, passes);
+    CHECK(data.size() / packets >= 48);
+
+    // USB -> net
+    const auto out_packets_at_start = usb.get_out_packets();
+    start = std::chrono::steady_clock::now();
+    usb.write(data);
+    CHECK(peer.read_exactly(&received, data.size(), 30000));
+    const auto out_seconds = seconds_since(start);
+    CHECK(received == data);
+    printf("usb->net: %.2f MB/s, %u OUT packets\n", data.size() / out_seconds / 1e6, usb.get_out_packets() - out_packets_at_start);
+
+    CHECK(usb.set_dtr(false));
+    CHECK(peer.wait_closed());
+    CHECK(usb.set_dtr(true));
+    unsigned long packets_after, refills_after;
+    read_in_counters(usb, &packets_after, &refills_after);
+    const auto call_packets = packets_after - packets_before;
+    const auto call_refills = refills_after - refills_before;
+    printf("%lu IN packets during the call, %lu (%.1f%%) refilled from the completion IRQ\n",
+        call_packets, call_refills, 100.0 * call_refills / call_packets);
+    // Counted by the firmware, so it does not depend on how busy the machine is
+    CHECK(call_refills * 10 >= call_packets * 9);
+
+    CHECK_EQ(host::usb_get_pid_errors(), 0u);
+    usb.stop();
+    emu.stop();
+    printf("ok\n");
+    return 0;
+}
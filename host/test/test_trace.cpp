@@ -0,0 +1,56 @@
+// tracer on its own: records from both cores come out oldest first, a full
+// ring drops and counts, and records format to one text line each.
+#include <cstring>
+#include <thread>
+
+#include "check.h"
+#include "host.h"
+#include "trace.h"
+
+namespace {
+    void record_on_core(tracer<8> &trace, const unsigned core, const uint8_t event, const uint32_t arg1)
+    {
+        std::thread([&] {
+            host::set_core(core);
+            trace.record(event, 0, arg1);
+        }).join();
+    }
+}
+
+int main(void)
+{
+    host::use_manual_clock();
+    static tracer<8> trace;
+
+    record_on_core(trace, 0, TRACE_EVENT_RING, 1);
+    host::advance_us(10);
+    record_on_core(trace, 1, TRACE_EVENT_NET_READ, 2);
+    host::advance_us(10);
+    record_on_core(trace, 1, TRACE_EVENT_NET_READ, 3);
+    host::advance_us(1);
+    record_on_core(trace, 0, TRACE_EVENT_CONNECTED, 4);
+
+    trace_record rec;
+    for (const uint32_t expected : {1u, 2u, 3u, 4u}) {
+        CHECK(trace.pop(&rec));
+        CHECK_EQ(rec.arg1, expected);
+    }
+    CHECK(!trace.pop(&rec));
+
+    // Seven records fit a ring of eight; the rest are dropped
+    for (int i = 0; i < 10; i++) {
+        trace.record(TRACE_EVENT_USB_TRANSMIT, 0x82, i);
+    }
+    CHECK_EQ(trace.get_dropped(), 3u);
+
+    char line[64];
+    CHECK(trace.pop(&rec));
+    const auto len = tracer<8>::format(&rec, line, sizeof(line));
+    CHECK(len > 0 && static_cast<size_t>(len) < sizeof(line));
+    CHECK(strstr(line, "usb_transmit") != nullptr);
+    CHECK(strstr(line, "0082") != nullptr);
+    CHECK(strcmp(&line[len - 2], "\r\n") == 0);
+
+    printf("ok\n");
+    return 0;
+}
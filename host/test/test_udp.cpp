@@ -0,0 +1,197 @@
+// UDP calls (S41=1) against a udp_transport peer in this process, over the
+// mock network with loss and delay injected: round-trip percentiles on an
+// impaired link, and how a call that is never answered ends on both sides.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "emulator.h"
+#include "host.h"
+#include "udp_transport.h"
+#include "virtual_host.h"
+
+namespace {
+    constexpr uint16_t peer_port = 12000;
+
+    // The far end, driven by its own thread like loop1() drives udp_link
+    class udp_peer
+    {
+        private:
+            udp_transport link;
+            std::mutex mutex;
+            std::atomic<bool> running;
+            bool echo;
+            std::thread thread;
+
+            void run(void)
+            {
+                while (running) {
+                    {
+                        std::lock_guard<std::mutex> lk(mutex);
+                        link.receive();
+                        if (echo) {
+                            char buf[256];
+                            const auto len = link.read(buf, sizeof(buf));
+                            if (len > 0) {CHECK_EQ(link.write(buf, len), len);}
+                        }
+                        link.flush();
+                    }
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+            }
+        public:
+            udp_peer() : link(1), running(true), echo(false)
+            {
+                CHECK(link.begin(peer_port));
+                thread = std::thread([this] {run();});
+            }
+            ~udp_peer()
+            {
+                running = false;
+                thread.join();
+                link.stop();
+            }
+            udp_transport::status get_status(void)
+            {
+                std::lock_guard<std::mutex> lk(mutex);
+                return link.get_status();
+            }
+            bool wait_for_status(const udp_transport::status status, const int timeout_ms)
+            {
+                const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+                while (get_status() != status) {
+                    if (std::chrono::steady_clock::now() >= deadline) {return false;}
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                return true;
+            }
+            bool accept(const bool echo)
+            {
+                std::lock_guard<std::mutex> lk(mutex);
+                this->echo = echo;
+                return link.accept();
+            }
+            void close(void)
+            {
+                std::lock_guard<std::mutex> lk(mutex);
+                echo = false;
+                link.close();
+            }
+    };
+
+    void dial(host::virtual_host &usb)
+    {
+        usb.write("ATD127-0-0-1#" + std::to_string(peer_port) + "\r");
+    }
+
+    void hang_up(host::virtual_host &usb)
+    {
+        CHECK(usb.set_dtr(false));
+        CHECK(usb.set_dtr(true));
+        usb.write("AT\r");
+        CHECK(usb.expect("OK\r\n"));
+    }
+
+    // 5% loss each way, 20 ms +- 5 ms one-way delay
+    void test_impaired_link(host::virtual_host &usb, udp_peer &peer)
+    {
+        constexpr int round_trips = 100;
+
+        host::set_udp_impairment(0.05, 15000, 10000, 22);
+        dial(usb);
+        CHECK(peer.wait_for_status(udp_transport::status::Incoming, 5000));
+        CHECK(peer.accept(true));
+        CHECK(usb.expect("CONNECT 33600 V.42\r\n", 5000));
+
+        std::vector<double> rtt_ms;
+        for (int i = 0; i < round_trips; i++) {
+            char msg[9];
+            snprintf(msg, sizeof(msg), "%08d", i);
+            const auto start = std::chrono::steady_clock::now();
+            usb.write(msg);
+            std::string echoed;
+            CHECK(usb.read_exactly(&echoed, 8, 5000));
+            CHECK(echoed == msg);
+            rtt_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        }
+
+        std::sort(rtt_ms.begin(), rtt_ms.end());
+        const auto p50 = rtt_ms[rtt_ms.size() / 2];
+        const auto p99 = rtt_ms[rtt_ms.size() * 99 / 100];
+        printf("udp 5%% loss, 20+-5 ms: round trip p50 %.1f ms, p99 %.1f ms, max %.1f ms\n", p50, p99, rtt_ms.back());
+        CHECK(p50 < 80);
+        CHECK(p99 < 400);
+
+        host::set_udp_impairment(0, 0, 0);
+        hang_up(usb);
+        CHECK(peer.wait_for_status(udp_transport::status::Disconnected, 2000));
+        peer.close();
+    }
+
+    // A callee that rings without answering: the caller gives up after S7
+    // seconds and tells the callee, which stops ringing
+    void test_unanswered(host::virtual_host &usb, udp_peer &peer)
+    {
+        usb.write("ATS7=2\r");
+        CHECK(usb.expect("OK\r\n"));
+        const auto start = std::chrono::steady_clock::now();
+        dial(usb);
+        CHECK(peer.wait_for_status(udp_transport::status::Incoming, 5000));
+        CHECK(usb.expect("NO CARRIER\r\n", 5000));
+        CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(1900));
+        CHECK(peer.wait_for_status(udp_transport::status::Disconnected, 1000));
+        peer.close();
+    }
+
+    // Answered later than the old fixed 5 s limit, within S7
+    void test_late_answer(host::virtual_host &usb, udp_peer &peer)
+    {
+        usb.write("ATS7=10\r");
+        CHECK(usb.expect("OK\r\n"));
+        dial(usb);
+        CHECK(peer.wait_for_status(udp_transport::status::Incoming, 5000));
+        std::this_thread::sleep_for(std::chrono::milliseconds(6000));
+        CHECK(peer.accept(true));
+        CHECK(usb.expect("CONNECT 33600 V.42\r\n", 2000));
+
+        usb.write("hello");
+        std::string echoed;
+        CHECK(usb.read_exactly(&echoed, 5, 2000));
+        CHECK(echoed == "hello");
+
+        hang_up(usb);
+        CHECK(peer.wait_for_status(udp_transport::status::Disconnected, 2000));
+        peer.close();
+    }
+}
+
+int main(void)
+{
+    host::emulator emu;
+    host::virtual_host usb;
+    emu.start();
+    CHECK(usb.enumerate());
+    CHECK(usb.set_dtr(true));
+
+    usb.write("ATS41=1\r");
+    CHECK(usb.expect("OK\r\n"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100)); // udp_link opens on the next attempt
+
+    {
+        udp_peer peer;
+        test_impaired_link(usb, peer);
+        test_unanswered(usb, peer);
+        test_late_answer(usb, peer);
+    }
+
+    usb.stop();
+    emu.stop();
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "pico/time.h"
+
+// Measures how long data sits between two points of the data path. The
+// entering side stamps the running byte offset with the current time, the
+// leaving side looks the stamp up once the same bytes have passed. Each
+// side must be used from a single context (like spsc_ring_buffer).
+// When the stamp queue is full, chunks are simply not sampled.
+template <size_t N = 32>
+class latency_probe
+{
+    static_assert((N & (N - 1)) == 0, "N must be a power of two");
+    public:
+        static constexpr int BUCKETS = 21; // bucket i: [2^(i-1), 2^i) us, the last one is open-ended
+    private:
+        struct stamp {
+            uint32_t offset;
+            uint32_t time_us;
+        };
+        stamp stamps[N];
+        std::atomic<uint32_t> head, tail;
+        uint32_t entered_bytes;
+        std::atomic<uint32_t> left_bytes;
+        std::atomic<uint32_t> histogram[BUCKETS];
+        std::atomic<uint32_t> max_us;
+        void record(uint32_t latency_us);
+    public:
+        latency_probe();
+        void enter(size_t length);
+        void leave(size_t length);
+        uint32_t get_bytes(void) {return left_bytes.load(std::memory_order_relaxed);}
+        uint32_t get_max_us(void) {return max_us.load(std::memory_order_relaxed);}
+        void get_histogram(uint32_t *buckets);
+        static uint32_t percentile_us(const uint32_t *buckets, int percent);
+};
+
+template <size_t N>
+latency_probe<N>::latency_probe()
+{
+    head = 0;
+    tail = 0;
+    entered_bytes = 0;
+    left_bytes = 0;
+    for (auto &bucket : histogram) {bucket = 0;}
+    max_us = 0;
+}
+
+template <size_t N>
+void latency_probe<N>::enter(size_t length)
+{
+    if (length == 0) {return;}
+
+    const auto h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) < N) {
+        stamps[h % N] = {entered_bytes, time_us_32()};
+        head.store(h + 1, std::memory_order_release);
+    }
+    entered_bytes += length;
+}
+
+template <size_t N>
+void latency_probe<N>::leave(size_t length)
+{
+    if (length == 0) {return;}
+
+    const auto now = time_us_32();
+    const auto left = left_bytes.load(std::memory_order_relaxed) + length;
+    auto t = tail.load(std::memory_order_relaxed);
+    const auto h = head.load(std::memory_order_acquire);
+
+    // A stamp is done once the byte it marks has left
+    while (t != h && static_cast<int32_t>(left - stamps[t % N].offset) > 0) {
+        record(now - stamps[t % N].time_us);
+        t++;
+    }
+    tail.store(t, std::memory_order_release);
+    left_bytes.store(left, std::memory_order_relaxed);
+}
+
+template <size_t N>
+void latency_probe<N>::record(uint32_t latency_us)
+{
+    const int bucket = latency_us == 0 ? 0 : 32 - __builtin_clz(latency_us);
+    const int idx = bucket < BUCKETS ? bucket : BUCKETS - 1;
+    histogram[idx].store(histogram[idx].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (latency_us > max_us.load(std::memory_order_relaxed)) {
+        max_us.store(latency_us, std::memory_order_relaxed);
+    }
+}
+
+template <size_t N>
+void latency_probe<N>::get_histogram(uint32_t *buckets)
+{
+    for (int i = 0; i < BUCKETS; i++) {
+        buckets[i] = histogram[i].load(std::memory_order_relaxed);
+    }
+}
+
+// Upper bound of the bucket holding the given percentile, 0 without samples
+template <size_t N>
+uint32_t latency_probe<N>::percentile_us(const uint32_t *buckets, int percent)
+{
+    uint32_t total = 0;
+    for (int i = 0; i < BUCKETS; i++) {total += buckets[i];}
+    if (total == 0) {return 0;}
+
+    const uint32_t target = (static_cast<uint64_t>(total) * percent + 99) / 100;
+    uint32_t count = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        count += buckets[i];
+        if (count >= target) {return 1u << i;}
+    }
+    return 1u << (BUCKETS - 1);
+}
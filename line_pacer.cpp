@@ -0,0 +1,64 @@
+#include <algorithm>
+
+#include "line_pacer.h"
+
+line_pacer::line_pacer(const uint32_t burst_us)
+{
+    this->burst_us = burst_us;
+    rate_bps = 0;
+    credit = 0;
+    last_time_us = 0;
+}
+
+// Starts with a full bucket
+void line_pacer::set_rate(const uint32_t rate_bps, const uint32_t now_us)
+{
+    this->rate_bps = rate_bps;
+    credit = rate_bps != 0 ? std::max(rate_bps * burst_us, 2 * BYTE_COST) : 0;
+    last_time_us = now_us;
+}
+
+// Bytes the bucket can hold, SIZE_MAX when not paced
+size_t line_pacer::get_burst(void)
+{
+    if (rate_bps == 0) {return SIZE_MAX;}
+
+    return std::max(rate_bps * burst_us, 2 * BYTE_COST) / BYTE_COST;
+}
+
+// Bytes that may pass at now_us
+size_t line_pacer::available(const uint32_t now_us)
+{
+    if (rate_bps == 0) {return SIZE_MAX;}
+
+    const auto capacity = std::max(rate_bps * burst_us, 2 * BYTE_COST);
+    const auto elapsed = now_us - last_time_us;
+    last_time_us = now_us;
+    // Compared before multiplying, which could overflow after a long idle time
+    if (elapsed >= (capacity - credit) / rate_bps) {
+        credit = capacity;
+    } else {
+        credit += elapsed * rate_bps;
+    }
+
+    return credit / BYTE_COST;
+}
+
+void line_pacer::consume(const size_t bytes)
+{
+    if (rate_bps == 0) {return;}
+
+    // At most what available() returned
+    credit -= std::min(bytes, static_cast<size_t>(credit / BYTE_COST)) * BYTE_COST;
+}
+
+// Time until the given number of bytes (at most the burst) may pass, as of the last available()
+uint32_t line_pacer::wait_us(const size_t bytes)
+{
+    if (rate_bps == 0) {return 0;}
+
+    const auto needed = static_cast<uint32_t>(std::min(bytes, get_burst())) * BYTE_COST;
+    if (credit >= needed) {return 0;}
+
+    return (needed - credit + rate_bps - 1) / rate_bps;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Token bucket letting bytes through at a modem line rate. Credit grows with
+// time at the rate in bits per second and each byte costs 8 bits (V.42 drops
+// the start and stop bits). The bucket holds at most burst_us worth of
+// credit, so an idle line does not save up for a burst later; at least two
+// bytes, so that waking up a little late for a byte loses no credit.
+// Rate 0 disables pacing. Single context per instance; the caller passes
+// the time so that it is read once per decision.
+class line_pacer
+{
+    private:
+        static constexpr uint32_t BYTE_COST = 8 * 1000000; // bit-microseconds
+
+        uint32_t burst_us;
+        uint32_t rate_bps;
+        uint32_t credit; // bit-microseconds
+        uint32_t last_time_us;
+    public:
+        line_pacer(const uint32_t burst_us);
+        void set_rate(const uint32_t rate_bps, const uint32_t now_us);
+        uint32_t get_rate(void) {return rate_bps;}
+        size_t get_burst(void);
+        size_t available(const uint32_t now_us);
+        void consume(const size_t bytes);
+        uint32_t wait_us(const size_t bytes);
+};
@@ -2,6 +2,7 @@
 
 #include "pico/critical_section.h"
 
+// A null critical section makes the guard a no-op (used by lock-free users).
 class lock_guard
 {
     private:
@@ -14,10 +15,10 @@ class lock_guard
 inline lock_guard::lock_guard(critical_section_t *cs)
 {
     this->cs = cs;
-    critical_section_enter_blocking(cs);
+    if (cs != nullptr) {critical_section_enter_blocking(cs);}
 }
 
 inline lock_guard::~lock_guard()
 {
-    critical_section_exit(cs);
+    if (cs != nullptr) {critical_section_exit(cs);}
 }
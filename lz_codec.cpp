@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <string.h>
+
+#include "lz_codec.h"
+
+static_assert((lz_encoder::WINDOW & (lz_encoder::WINDOW - 1)) == 0, "WINDOW must be a power of two");
+static_assert(lz_encoder::WINDOW <= 65536, "offsets are 16 bits");
+static_assert(lz_encoder::MAX_INPUT <= lz_encoder::WINDOW, "one call's input must fit in the window");
+
+lz_encoder::lz_encoder()
+{
+    reset();
+}
+
+void lz_encoder::reset(void)
+{
+    memset(history, 0, sizeof(history));
+    memset(head, 0, sizeof(head));
+    pos = 0;
+}
+
+uint32_t lz_encoder::hash(const uint32_t p)
+{
+    const uint32_t key = (history[p % WINDOW] << 16) | (history[(p + 1) % WINDOW] << 8) | history[(p + 2) % WINDOW];
+
+    return (key * 2654435761u) >> (32 - HASH_BITS);
+}
+
+size_t lz_encoder::emit_literals(uint32_t from, const uint32_t to, uint8_t *out)
+{
+    size_t out_len = 0;
+    while (from != to) {
+        const auto run = std::min(static_cast<size_t>(to - from), static_cast<size_t>(128));
+        out[out_len++] = run - 1;
+        for (size_t i = 0; i < run; i++) {
+            out[out_len++] = history[(from + i) % WINDOW];
+        }
+        from += run;
+    }
+
+    return out_len;
+}
+
+// Encodes len (at most MAX_INPUT) bytes into out (room for MAX_OUTPUT bytes)
+// and returns the encoded length
+size_t lz_encoder::encode(const char *in, const size_t len, uint8_t *out)
+{
+    // The input joins the history first, so matches may run into it (and overlap themselves)
+    const auto n = std::min(len, MAX_INPUT);
+    for (size_t i = 0; i < n; i++) {
+        history[(pos + i) % WINDOW] = in[i];
+    }
+    const uint32_t end = pos + n;
+
+    size_t out_len = 0;
+    uint32_t literal_start = pos;
+    uint32_t p = pos;
+    while (p != end) {
+        size_t match_len = 0;
+        uint32_t candidate = 0;
+        if (end - p >= MIN_MATCH) {
+            const auto h = hash(p);
+            const auto entry = head[h];
+            head[h] = p + 1;
+            candidate = entry - 1;
+            // The whole candidate must still be in the window, which also keeps the offset in range
+            if (entry != 0 && end - candidate <= WINDOW) {
+                const auto max_len = std::min(static_cast<size_t>(end - p), MAX_MATCH);
+                while (match_len < max_len && history[(candidate + match_len) % WINDOW] == history[(p + match_len) % WINDOW]) {
+                    match_len++;
+                }
+            }
+        }
+        // A match that splits a literal run costs the next run a control
+        // byte, so it has to save one; this keeps MAX_OUTPUT a hard bound
+        if (match_len < MIN_MATCH + (literal_start != p ? 1 : 0)) {
+            p++;
+            continue;
+        }
+
+        out_len += emit_literals(literal_start, p, &out[out_len]);
+        const auto distance = p - candidate - 1;
+        out[out_len++] = 0x80 | (match_len - MIN_MATCH);
+        out[out_len++] = distance >> 8;
+        out[out_len++] = distance & 0xff;
+        for (uint32_t q = p + 1; q != p + match_len && end - q >= MIN_MATCH; q++) {
+            head[hash(q)] = q + 1;
+        }
+        p += match_len;
+        literal_start = p;
+    }
+    out_len += emit_literals(literal_start, end, &out[out_len]);
+    pos = end;
+
+    return out_len;
+}
+
+lz_decoder::lz_decoder()
+{
+    reset();
+}
+
+void lz_decoder::reset(void)
+{
+    memset(history, 0, sizeof(history));
+    pos = 0;
+    state = token_state::Control;
+    remaining = 0;
+    offset = 0;
+}
+
+// Decodes from in until it is used up or max_len bytes were written to out.
+// Returns the decoded length; *consumed tells how much of in was used.
+size_t lz_decoder::decode(const uint8_t *in, const size_t len, size_t *consumed, char *out, const size_t max_len)
+{
+    size_t i = 0;
+    size_t out_len = 0;
+    auto put = [&](const uint8_t c) {
+        history[pos++ % WINDOW] = c;
+        out[out_len++] = c;
+    };
+
+    while (out_len < max_len) {
+        if (state == token_state::Match) {
+            // Distances beyond what was decoded only read stale history: bad
+            // input gives bad output, never an access outside the window
+            put(history[(pos - offset - 1) % WINDOW]);
+            if (--remaining == 0) {state = token_state::Control;}
+            continue;
+        }
+        if (i == len) {break;}
+
+        const auto c = in[i++];
+        switch (state) {
+            case token_state::Control:
+                if (c & 0x80) {
+                    remaining = (c & 0x7f) + 3;
+                    state = token_state::OffsetHigh;
+                } else {
+                    remaining = c + 1;
+                    state = token_state::Literal;
+                }
+                break;
+            case token_state::Literal:
+                put(c);
+                if (--remaining == 0) {state = token_state::Control;}
+                break;
+            case token_state::OffsetHigh:
+                offset = c << 8;
+                state = token_state::OffsetLow;
+                break;
+            case token_state::OffsetLow:
+                offset |= c;
+                state = token_state::Match;
+                break;
+            case token_state::Match:
+                break;
+        }
+    }
+
+    *consumed = i;
+    return out_len;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Streaming LZ77 for the online data path, in the spirit of V.42bis: both
+// ends keep the last WINDOW bytes of the stream, so a repeat of anything
+// sent recently costs three bytes. Each encode() call emits whole tokens for
+// its input (nothing is held back for later), and the decoder can stop at
+// any byte, so either side works on whatever the buffers have at the time.
+//
+// Token format:
+//   0nnnnnnn                 n + 1 literal bytes follow (1-128)
+//   1lllllll dddddddd x2     copy l + 3 bytes (3-130) from d + 1 bytes back
+//
+// The encoder looks up a single candidate per position (no hash chains), so
+// the work per byte is bounded: one hash, and compares that are either cut
+// short or paid for by the bytes the match covers.
+class lz_encoder
+{
+    public:
+        static constexpr size_t WINDOW = 4096;
+        static constexpr size_t MAX_INPUT = 512; // per encode() call
+        static constexpr size_t MAX_OUTPUT = MAX_INPUT + MAX_INPUT / 128 + 1;
+    private:
+        static constexpr int HASH_BITS = 10;
+        static constexpr size_t MIN_MATCH = 3;
+        static constexpr size_t MAX_MATCH = MIN_MATCH + 127;
+
+        uint8_t history[WINDOW];
+        uint32_t head[1 << HASH_BITS]; // latest position + 1 per hash, 0: none
+        uint32_t pos;                  // bytes encoded so far
+
+        uint32_t hash(const uint32_t p);
+        size_t emit_literals(uint32_t from, const uint32_t to, uint8_t *out);
+    public:
+        lz_encoder();
+        void reset(void);
+        size_t encode(const char *in, const size_t len, uint8_t *out);
+};
+
+class lz_decoder
+{
+    public:
+        static constexpr size_t WINDOW = lz_encoder::WINDOW;
+    private:
+        enum class token_state : uint8_t {
+            Control,
+            Literal,
+            OffsetHigh,
+            OffsetLow,
+            Match,
+        };
+
+        uint8_t history[WINDOW];
+        uint32_t pos; // bytes decoded so far
+        token_state state;
+        uint8_t remaining;
+        uint16_t offset;
+    public:
+        lz_decoder();
+        void reset(void);
+        size_t decode(const uint8_t *in, const size_t len, size_t *consumed, char *out, const size_t max_len);
+};
@@ -5,38 +5,142 @@
 #include <EthernetServer.h>
 #include <EthernetUdp.h>
 #include <utility/w5100.h>
+#include <SPI.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cstdarg>
 
+#include "hardware/regs/addressmap.h"
 #include "hardware/regs/usb.h"
 #include "hardware/structs/usb.h"
+#include "hardware/dma.h"
 #include "hardware/irq.h"
 #include "hardware/resets.h"
+#include "hardware/spi.h"
+#include "hardware/sync.h"
+#include "pico/time.h"
 #include "pico/unique_id.h"
 
 #include "usb_struct.h"
 #include "ring_buffer.h"
+#include "latency_probe.h"
+#include "line_pacer.h"
+#include "lz_codec.h"
+#include "trace.h"
+#include "at_command.h"
+#include "dns_resolver.h"
+#include "phonebook.h"
+#include "udp_transport.h"
 #include "state.h"
 #include "rp2040_usb_device.h"
 #include "me56ps2.h"
 #include "config.h"
 
-ring_buffer<char> usb_rx_buffer(8192);
-ring_buffer<char> usb_tx_buffer(8192);
-ring_buffer<char> net_rx_buffer(8192);
-ring_buffer<char> net_tx_buffer(8192);
-ring_buffer<char> log_tx_buffer(2048); // for debugging
+// While Online, data bypasses usb_rx_buffer/usb_tx_buffer: the USB IRQ feeds
+// net_tx_buffer directly and usb_tx_process() drains net_rx_buffer directly.
+spsc_ring_buffer<char, config::buffer_size::usb_rx> usb_rx_buffer; // USB IRQ (core0) -> loop (core0), AT commands
+ring_buffer<char, config::buffer_size::usb_tx> usb_tx_buffer;      // loop (core0), loop1 (core1) -> loop (core0), result codes
+spsc_ring_buffer<char, config::buffer_size::net_rx> net_rx_buffer; // loop1 (core1) -> loop (core0)
+spsc_ring_buffer<char, config::buffer_size::net_tx> net_tx_buffer; // USB IRQ (core0) -> loop1 (core1)
+ring_buffer<char, config::buffer_size::log_tx> log_tx_buffer; // for debugging
+tracer<> trace_log; // for debugging, hot-path events
+uint32_t usb_rx_enqueued = 0;   // bytes ever put into usb_rx_buffer; USB IRQ (core0)
+uint32_t usb_rx_clear_mark = 0; // usb_rx_enqueued at on-hook, the consumer drops what came before
+std::atomic<bool> usb_rx_clear_requested(false);
+std::atomic<uint32_t> net_rx_interval_us(UINT32_MAX); // loop1 (core1) -> usb_tx_process (core0), smoothed time between socket reads
+
+// Emulated line rate (S37) on the online data path
+line_pacer usb_tx_pacer(2000);  // net_rx_buffer -> IN packets, same contexts as usb_tx_process (core0)
+line_pacer net_tx_pacer(10000); // net_tx_buffer -> socket, loop1 (core1); sent in bursts of up to 10 ms
+alarm_id_t usb_tx_alarm = 0;    // usb_tx_process() due when usb_tx_pacer allows the next byte (core0)
+
+// Time spent on the online data path, per stage
+latency_probe<> usb_to_net_latency; // ep2_out_handler -> socket write
+latency_probe<> net_to_usb_latency; // socket read -> IN packet
+latency_probe<> usb_in_latency;     // IN packet -> picked up by the host
+
+// Runtime counters, each written from a single context and read by the "stats" query on the log port
+struct {
+    uint32_t usb_out_packets, usb_out_bytes;  // USB IRQ (core0)
+    uint32_t usb_in_packets, usb_in_bytes;    // usb_tx_process (core0)
+    uint32_t usb_in_busy;                     // usb_tx_process had data but both IN buffers were in flight
+    uint32_t usb_in_refills;                  // IN packets sent from the completion IRQ, not loop()
+    uint32_t net_rx_bytes, net_tx_bytes;      // loop1 (core1)
+    uint32_t net_rx_wire_bytes, net_tx_wire_bytes; // the same on the socket, after compression
+    uint32_t connect_attempts, connect_failures;
+    uint32_t incoming_calls, rejected_calls;
+} metrics;
+
+// Carries the online data path; chosen by S41 when the call is made or rung
+enum class transport {
+    Tcp, // client
+    Udp, // udp_link
+};
 
 rp2040_usb_device *usb;
+char server_host[dns_resolver::NAME_SIZE]; // empty when dialing an IP address
+char server_host_alt[dns_resolver::NAME_SIZE]; // tried when server_host does not resolve, empty if none
 IPAddress server_ip;
 uint16_t server_port;
+dns_resolver resolver; // loop1 (core1)
 EthernetServer server(config::listen_port);
 EthernetClient client;
+udp_transport udp_link(config::udp_redundancy); // open on listen_port while S41 selects UDP, loop1 (core1)
+transport net_transport = transport::Tcp;       // of the current call, loop1 (core1)
 EthernetServer log_server(config::log_listen_port);
 EthernetClient log_client;
+volatile bool w5x00_irq_pending = false;
+bool w5x00_irq_enabled = false;
+uint8_t w5x00_socket_events[MAX_SOCK_NUM];
+uint32_t w5x00_spi_transactions = 0;
+bool w5x00_dma_enabled = false;
+int w5x00_dma_tx_channel;
+int w5x00_dma_rx_channel;
+bool w5x00_send_busy = false;
+bool w5x00_send_pending = false;
+struct queued_call {
+    EthernetClient caller;
+    bool waited; // arrived while the line was busy
+};
+queued_call queued_calls[config::max_queued_calls]; // loop1 (core1), oldest first
+int queued_call_count = 0;
+int net_connect_socket = -1; // outgoing connect in progress, loop1 (core1)
+bool net_connect_result;     // of the blocking connect without DMA
+unsigned long net_connect_deadline;
 state_ctrl<modem_state> state(modem_state::NotInitialized);
 
+AT_RESULT at_dial(const char *dial_string);
+AT_RESULT at_answer(void);
+AT_RESULT at_hangup(void);
+AT_RESULT at_online(void);
+AT_RESULT at_store(const int index, const char *dial_string);
+const char *at_recall(const int index);
+void at_write(const char *data, size_t len);
+void at_report(void);
+
+// Command-mode state (echo, result code format, S-registers); input on loop (core0)
+at_command_parser modem({at_dial, at_answer, at_hangup, at_online, at_store, at_recall, at_write, at_report});
+
+// Stored numbers for ATDSn, in the flash sector arduino-pico reserves for
+// EEPROM, and the sector below the filesystem (if any) for compacting into.
+// When the sketch reaches that far there is only the one sector.
+extern uint8_t _EEPROM_start, _FS_start;
+extern char __flash_binary_end;
+uint32_t phonebook_spare_offset(void)
+{
+    const auto spare = reinterpret_cast<uintptr_t>(&_FS_start) - FLASH_SECTOR_SIZE;
+    if (reinterpret_cast<uintptr_t>(&__flash_binary_end) > spare) {return reinterpret_cast<uintptr_t>(&_EEPROM_start) - XIP_BASE;}
+    return spare - XIP_BASE;
+}
+phonebook phone_book(reinterpret_cast<uintptr_t>(&_EEPROM_start) - XIP_BASE, phonebook_spare_offset());
+
+// S12, 0 disables escape detection
+uint32_t guard_time_ms(void)
+{
+    return modem.get_s_register(S_REGISTER_GUARD_TIME) * 20;
+}
+
 int _printf(const char *fmt, ...)
 {
     va_list args;
@@ -52,12 +156,57 @@ int _printf(const char *fmt, ...)
     return Serial1.print(buf);
 }
 
+// Binary trace record, cheap enough for IRQs; formatted when drained by log_tx()
+void _trace(const uint8_t event, const uint16_t arg0, const uint32_t arg1)
+{
+    if (!config::enable_trace) {return;}
+
+    trace_log.record(event, arg0, arg1);
+}
+
+escape_sequence_detector escape; // USB IRQ or loop() with interrupts disabled (core0)
+uint8_t usb_out_armed = 0; // OUT buffers handed to the controller; USB IRQ or loop() with interrupts disabled (core0)
+
+// Arm OUT buffers only while the destination can take a full packet for each
+// of them. Otherwise the host is NAKed until the consumer frees space and
+// loop() calls this again.
+void usb_rx_rearm()
+{
+    const auto free = state.is_state(modem_state::Online) ? net_tx_buffer.get_free_count() : usb_rx_buffer.get_free_count();
+    while (usb_out_armed < 2 && free >= (usb_out_armed + 1u) * MAX_PACKET_SIZE_BULK) {
+        usb->ep_read(ME56PS2_COM_EP_ADDR_OUT, MAX_PACKET_SIZE_BULK);
+        usb_out_armed++;
+    }
+}
+
 void ep2_out_handler(const void *data, const int len)
 {
+    const auto *payload = reinterpret_cast<const char *>(data) + 1;
     int payload_length = len - 1;
-    usb_rx_buffer.enqueue(reinterpret_cast<const char *>(data) + 1, payload_length);
+    metrics.usb_out_packets++;
+    metrics.usb_out_bytes += payload_length;
+    if (state.is_state(modem_state::Online)) {
+        // The escape characters are passed on like any other data
+        escape.input(payload, payload_length, millis(), modem.get_s_register(S_REGISTER_ESCAPE_CHAR), guard_time_ms());
+        usb_to_net_latency.enter(net_tx_buffer.enqueue(payload, payload_length));
+    } else {
+        usb_rx_enqueued += usb_rx_buffer.enqueue(payload, payload_length);
+    }
+
+    usb_out_armed--;
+    usb_rx_rearm();
+}
 
-    usb->ep_read(ME56PS2_COM_EP_ADDR_OUT, MAX_PACKET_SIZE_BULK);
+void usb_tx_process();
+
+void ep2_in_handler(const void *data, const int len)
+{
+    usb_in_latency.leave(len);
+
+    // Refill the endpoint as soon as a buffer is free instead of waiting for loop()
+    const auto packets = metrics.usb_in_packets;
+    usb_tx_process();
+    metrics.usb_in_refills += metrics.usb_in_packets - packets;
 }
 
 bool control_packet_handler(const struct usb_setup_packet* pkt)
@@ -88,12 +237,13 @@ bool control_packet_handler(const struct usb_setup_packet* pkt)
             }
         }
         if (req == USB_REQUEST_SET_CONFIGURATION) {
-            usb->apply_endpoint_configuration(&me56ps2_config_descriptors.endpoint_bulk_in, nullptr);
-            usb->apply_endpoint_configuration(&me56ps2_config_descriptors.endpoint_bulk_out, ep2_out_handler);
+            usb->apply_endpoint_configuration(&me56ps2_config_descriptors.endpoint_bulk_in, ep2_in_handler, true);
+            usb->apply_endpoint_configuration(&me56ps2_config_descriptors.endpoint_bulk_out, ep2_out_handler, true);
             usb->configure();
             usb->ep0_write(nullptr, 0);
-            usb->ep_read(ME56PS2_COM_EP_ADDR_OUT, MAX_PACKET_SIZE_BULK);
             state.force_transition(modem_state::Offline);
+            usb_out_armed = 0;
+            usb_rx_rearm();
             return true;
         }
         if (req == USB_REQUEST_SET_INTERFACE) {
@@ -105,13 +255,14 @@ bool control_packet_handler(const struct usb_setup_packet* pkt)
         if (pkt->bRequest == 0x01) {
             if ((pkt->wValue & 0x0101) == 0x0100) {
                 // set DTR to LOW for on-hook
-                _printf("on-hook\r\n");
+                _trace(TRACE_EVENT_ON_HOOK, 0, 0);
                 usb_tx_buffer.clear();
-                usb_rx_buffer.clear();
+                usb_rx_clear_mark = usb_rx_enqueued; // usb_rx_buffer is cleared by its consumer
+                usb_rx_clear_requested = true;
                 state.force_transition(modem_state::Offline);
             } else if ((pkt->wValue & 0x0101) == 0x0101) {
                 // set DTR to HIGH for off-hook
-                _printf("off-hook\r\n");
+                _trace(TRACE_EVENT_OFF_HOOK, 0, 0);
             }
         }
         usb->ep0_write(nullptr, 0);
@@ -121,91 +272,272 @@ bool control_packet_handler(const struct usb_setup_packet* pkt)
     return false;
 }
 
-bool parse_address(const char *addr, IPAddress *ip_addr, uint16_t *oport)
+bool parse_address(const char *addr, char *host, size_t host_size, IPAddress *ip_addr, uint16_t *oport)
 {
-    // Input format: "000-000-000-000#00000" or "000-000-000-000"
+    // Input format: "000-000-000-000#00000" or "000-000-000-000",
+    // or a host name with '*' in place of '.': "game*example*net#00000"
     int d[4] = {0, 0, 0, 0};
     int port = config::default_port;
 
     // Parse IPv4 address
     auto ret = sscanf(addr, "%u-%u-%u-%u#%u", &d[0], &d[1], &d[2], &d[3], &port);
-    if (ret < 4) {return false;}
-
-    // Check each digit range
-    for (int i = 0; i < 4; i++) {
-        if (d[i] < 0 || d[i] > 255) {return false;}
+    if (ret >= 4) {
+        // Check each digit range
+        for (int i = 0; i < 4; i++) {
+            if (d[i] < 0 || d[i] > 255) {return false;}
+        }
+        *ip_addr = IPAddress(d[0], d[1], d[2], d[3]);
+        host[0] = '\0';
+    } else {
+        // Parse host name, resolved later by loop1
+        size_t len = 0;
+        const char *p = addr;
+        for (; *p != '\0' && *p != '#'; p++) {
+            const char c = *p == '*' ? '.' : *p;
+            if (!isalnum(static_cast<unsigned char>(c)) && c != '.' && c != '-') {return false;}
+            if (len >= host_size - 1) {return false;}
+            host[len++] = c;
+        }
+        if (len == 0) {return false;}
+        host[len] = '\0';
+        if (*p == '#' && sscanf(p + 1, "%u", &port) != 1) {return false;}
     }
 
     // Check port range (1 - 65535)
     if (port < 1 || port > 65535) {return false;}
 
-    *ip_addr = IPAddress(d[0], d[1], d[2], d[3]);
     *oport = port;
 
     return true;
 }
 
+// S37, 0 when not paced
+uint32_t line_rate_bps(void)
+{
+    return std::min(modem.get_s_register(S_REGISTER_LINE_RATE), static_cast<uint8_t>(14)) * 2400;
+}
+
+void report_connect(void)
+{
+    char detail[16];
+    const auto rate = line_rate_bps();
+    snprintf(detail, sizeof(detail), " %lu V.42", static_cast<unsigned long>(rate != 0 ? rate : 33600));
+    modem.result(AT_RESULT_CONNECT, detail);
+}
+
+AT_RESULT at_dial(const char *dial_string)
+{
+    if (!parse_address(dial_string, server_host, sizeof(server_host), &server_ip, &server_port)) {return AT_RESULT_BUSY;}
+    // "ATDTgame*example*net": the T may be a dial modifier rather than part of the name
+    const auto first = toupper(static_cast<unsigned char>(server_host[0]));
+    const auto ambiguous = (first == 'T' || first == 'P') && server_host[1] != '\0';
+    strcpy(server_host_alt, ambiguous ? &server_host[1] : "");
+    if (!state.transition(modem_state::Offline, modem_state::Calling)) {return AT_RESULT_ERROR;}
+
+    return AT_RESULT_NONE; // loop1 reports CONNECT or BUSY
+}
+
+AT_RESULT at_answer(void)
+{
+    if (!state.transition(modem_state::Ringing, modem_state::Online)) {return AT_RESULT_ERROR;}
+    report_connect();
+
+    return AT_RESULT_NONE;
+}
+
+AT_RESULT at_hangup(void)
+{
+    // loop1 closes the socket once Offline
+    state.force_transition(modem_state::Offline);
+
+    return AT_RESULT_OK;
+}
+
+// ATO, back to online data mode after an escape
+AT_RESULT at_online(void)
+{
+    if (!state.transition(modem_state::OnlineCommand, modem_state::Online)) {return AT_RESULT_NO_CARRIER;}
+    report_connect();
+
+    return AT_RESULT_NONE;
+}
+
+// Called from loop() with interrupts disabled
+void check_escape_sequence(void)
+{
+    if (!state.is_state(modem_state::Online)) {
+        escape.reset();
+        return;
+    }
+
+    const auto guard_ms = guard_time_ms();
+    if (guard_ms == 0 || !escape.poll(millis(), guard_ms)) {return;}
+    if (state.transition(modem_state::Online, modem_state::OnlineCommand)) {
+        modem.result(AT_RESULT_OK);
+    }
+}
+
+AT_RESULT at_store(const int index, const char *dial_string)
+{
+    return phone_book.set(index, dial_string) ? AT_RESULT_OK : AT_RESULT_ERROR;
+}
+
+const char *at_recall(const int index)
+{
+    return phone_book.get(index);
+}
+
+void at_write(const char *data, size_t len)
+{
+    usb_tx_buffer.enqueue(data, len);
+}
+
+template <typename T>
+bool has_keypress(T *buffer)
+{
+    const char *span;
+    const auto len = buffer->peek_read_span(&span);
+    for (size_t i = 0; i < len; i++) {
+        if (span[i] != modem.get_s_register(S_REGISTER_CR) && span[i] != modem.get_s_register(S_REGISTER_LF)) {return true;}
+    }
+
+    return false;
+}
+
 void usb_rx_process()
 {
+    if (usb_rx_clear_requested) {
+        // Only the bytes queued before on-hook: a command sent once DTR is
+        // high again may already be behind them
+        const auto irq_status = save_and_disable_interrupts();
+        usb_rx_clear_requested = false;
+        const auto stale = static_cast<int32_t>(usb_rx_clear_mark - (usb_rx_enqueued - usb_rx_buffer.get_count()));
+        restore_interrupts(irq_status);
+        if (stale >= 0) {
+            usb_rx_buffer.erase(stale);
+            modem.clear_line();
+        }
+    }
+
     if (state.is_state(modem_state::Online)) {
-        net_tx_buffer.pull(&usb_rx_buffer);
+        // Data goes straight to net_tx_buffer; drop anything typed before going online
+        usb_rx_buffer.clear();
+        modem.clear_line();
         return;
     }
 
     if (state.is_state(modem_state::Calling)) {
+        // Any key other than CR/LF aborts dialing (Hayes); loop1 drops the attempt
+        if (has_keypress(&usb_rx_buffer) && state.transition(modem_state::Calling, modem_state::Offline)) {
+            modem.result(AT_RESULT_NO_CARRIER);
+        }
+        usb_rx_buffer.clear();
         return;
     }
 
-    char line[64];
+    modem.process(&usb_rx_buffer);
+}
+
+template <typename T>
+size_t dequeue_spans(T *from, char *dst, size_t max_len)
+{
     size_t len = 0;
-    while (usb_rx_buffer.find('\x0d', &len)) {
-        if (len > sizeof(line) - 1) {
-            // Ignore too long line
-            usb_rx_buffer.erase(len);
-            continue;
-        }
+    while (len < max_len) {
+        const char *span;
+        const auto span_len = std::min(from->peek_read_span(&span), max_len - len);
+        if (span_len == 0) {break;}
+        memcpy(&dst[len], span, span_len);
+        from->consume(span_len);
+        len += span_len;
+    }
 
-        usb_rx_buffer.dequeue(line, len);
-        line[len] = 0;
+    return len;
+}
 
-        if (strncmp(line, "ATD", 3) == 0) {
-            // Dial
-            if (len > 4 && parse_address(&line[4], &server_ip, &server_port)) {
-                state.transition(modem_state::Offline, modem_state::Calling);
-                break;
-            } else {
-                const char reply[] = "BUSY\r\n";
-                usb_tx_buffer.enqueue(reply, sizeof(reply) - 1);
-            }
-        } else if (strncmp(line, "ATA", 3) == 0) {
-            // Answer an incoming call
-            if (state.transition(modem_state::Ringing, modem_state::Online)) {
-                const char reply[] = "CONNECT 33600 V42\r\n";
-                usb_tx_buffer.enqueue(reply, sizeof(reply) - 1);
-                break;
-            } else {
-                const char reply[] = "ERROR\r\n";
-                usb_tx_buffer.enqueue(reply, sizeof(reply) - 1);
-            }
-        } else {
-            const char reply[] = "OK\r\n";
-            usb_tx_buffer.enqueue(reply, sizeof(reply) - 1);
-        }
+unsigned long usb_tx_last_sent_time = 0;
+
+// Adaptive coalescing (S40=1). While a packet is in flight the pipe is busy
+// anyway, so a short packet is held back as long as more socket data is
+// expected before that packet completes. The completion calls
+// usb_tx_process() again, which then sends whatever has accumulated.
+bool hold_tx_packet(const bool online)
+{
+    constexpr uint32_t hold_interval_us = 1000; // about one USB frame
+
+    if (modem.get_s_register(S_REGISTER_TX_COALESCE) != 1 || !online) {return false;}
+    if (usb->get_ep_bufs_in_flight(ME56PS2_COM_EP_ADDR_IN) == 0) {return false;}
+    if (usb_tx_buffer.get_count() + net_rx_buffer.get_count() >= MAX_PACKET_SIZE_BULK - 2) {return false;}
+
+    return net_rx_interval_us.load(std::memory_order_relaxed) < hold_interval_us;
+}
+
+int64_t usb_tx_alarm_handler(alarm_id_t id, void *user_data)
+{
+    usb_tx_alarm = 0;
+    usb_tx_process();
+
+    return 0;
+}
+
+// Run usb_tx_process() again after delay_us, from the alarm IRQ; it has the
+// same priority as the USB IRQ, so the two never interrupt each other
+void schedule_usb_tx(const uint32_t delay_us)
+{
+    if (usb_tx_alarm != 0) {return;}
+
+    usb_tx_alarm = add_alarm_in_us(delay_us, usb_tx_alarm_handler, nullptr, false);
+    if (usb_tx_alarm <= 0) {
+        // Already due (or no alarm free): loop() comes around again at once
+        usb_tx_alarm = 0;
+        __sev();
     }
 }
 
+// Called from ep2_in_handler (USB IRQ), the pacing alarm and from loop() with
+// interrupts disabled, so net_rx_buffer still has a single consumer context.
 void usb_tx_process()
 {
-    static unsigned long last_sent_time = 0;
+    // Received data is let through at the emulated line rate, byte by byte
+    size_t net_allowed = 0;
+    if (state.is_state(modem_state::Online) && !net_rx_buffer.is_empty()) {
+        const auto now_us = time_us_32();
+        const auto rate = line_rate_bps();
+        if (usb_tx_pacer.get_rate() != rate) {usb_tx_pacer.set_rate(rate, now_us);}
+        net_allowed = usb_tx_pacer.available(now_us);
+        if (net_allowed == 0) {schedule_usb_tx(usb_tx_pacer.wait_us(1));}
+    }
+
+    const auto has_data = !usb_tx_buffer.is_empty() || net_allowed > 0;
+    if (usb->is_ep_buf_full(ME56PS2_COM_EP_ADDR_IN)) {
+        if (has_data) {metrics.usb_in_busy++;}
+        return;
+    }
+    if (!has_data && millis() - config::report_interval_ms < usb_tx_last_sent_time) {return;}
 
-    if (usb->is_ep_buf_full(ME56PS2_COM_EP_ADDR_IN)) {return;}
-    if (usb_tx_buffer.is_empty() && millis() - config::report_interval_ms < last_sent_time) {return;}
-    last_sent_time = millis();
+    // Build the packet directly in the endpoint buffer: result codes first, then online data.
+    // The carrier stays up in online command mode, but received data waits for ATO.
+    const auto current_state = state.get_state();
+    const auto online = current_state == modem_state::Online;
+    const auto carrier = online || current_state == modem_state::OnlineCommand;
+    if (has_data && hold_tx_packet(online)) {return;}
+    usb_tx_last_sent_time = millis();
 
-    char tx_packet[MAX_PACKET_SIZE_BULK] = {0x31, 0x60};
-    if (state.is_state(modem_state::Online)) {tx_packet[0] |= 0x80;}
-    int tx_packet_len = 2 + usb_tx_buffer.dequeue(&tx_packet[2], MAX_PACKET_SIZE_BULK - 2);
-    usb->ep_write(ME56PS2_COM_EP_ADDR_IN, tx_packet, tx_packet_len);
+    auto *tx_packet = reinterpret_cast<char *>(usb->get_ep_buf(ME56PS2_COM_EP_ADDR_IN));
+    tx_packet[0] = 0x31;
+    tx_packet[1] = 0x60;
+    if (carrier) {tx_packet[0] |= 0x80;}
+    size_t tx_packet_len = 2;
+    tx_packet_len += dequeue_spans(&usb_tx_buffer, &tx_packet[tx_packet_len], MAX_PACKET_SIZE_BULK - tx_packet_len);
+    if (online) {
+        const auto len = dequeue_spans(&net_rx_buffer, &tx_packet[tx_packet_len], std::min(MAX_PACKET_SIZE_BULK - tx_packet_len, net_allowed));
+        usb_tx_pacer.consume(len);
+        net_to_usb_latency.leave(len);
+        tx_packet_len += len;
+    }
+    usb->ep_commit(ME56PS2_COM_EP_ADDR_IN, tx_packet_len);
+    metrics.usb_in_packets++;
+    metrics.usb_in_bytes += tx_packet_len - 2;
+    usb_in_latency.enter(tx_packet_len);
 }
 
 void setup()
@@ -213,24 +545,45 @@ void setup()
     Serial1.begin();
     Serial1.printf("Boot.\r\n");
     Serial1.printf("Initializing USB Device...\r\n");
-    usb = new rp2040_usb_device(_printf);
+    usb = new rp2040_usb_device(_printf, _trace);
+    modem.set_s_register_default(S_REGISTER_LINE_RATE, config::line_rate);
+    modem.set_s_register_default(S_REGISTER_TX_COALESCE, config::tx_coalesce_mode);
+    modem.set_s_register_default(S_REGISTER_TRANSPORT, config::transport_mode);
+    modem.set_s_register_default(S_REGISTER_COMPRESSION, config::compression);
+    phone_book.load();
     usb->set_setup_packet_callback(control_packet_handler);
     usb->init();
 }
 
-void loop()
+// Wake core0 from wait_for_event() after handing it data from core1
+void notify_core0()
 {
-    delay(1);
+    __sev();
+}
 
-    if (!usb->is_configured()) {return;}
+// Sleep until the USB IRQ or core1 signals an event, or the report interval expires
+void wait_for_event()
+{
+    const auto elapsed = millis() - usb_tx_last_sent_time;
+    const auto timeout_ms = elapsed < config::report_interval_ms ? config::report_interval_ms - elapsed : 0;
+    best_effort_wfe_or_timeout(make_timeout_time_ms(timeout_ms));
+}
 
-    usb_rx_process();
+void loop()
+{
+    if (usb->is_configured()) {
+        usb_rx_process();
 
-    if (state.is_state(modem_state::Online)) {
-        usb_tx_buffer.pull(&net_rx_buffer);
+        // Resume OUT transfers held back for lack of buffer space, kick an idle IN
+        // pipe and send periodic status; completions are handled in the endpoint handlers
+        const auto irq_status = save_and_disable_interrupts();
+        check_escape_sequence();
+        usb_rx_rearm();
+        usb_tx_process();
+        restore_interrupts(irq_status);
     }
 
-    usb_tx_process();
+    wait_for_event();
 }
 
 void set_user_led(bool value)
@@ -282,6 +635,693 @@ void set_retry_register(const uint16_t retry_time_value, const uint8_t retry_cou
     }
 }
 
+void w5x00_irq_handler(void)
+{
+    w5x00_irq_pending = true;
+}
+
+bool enable_w5x00_interrupt(void)
+{
+    // Only the W5500 INTn is wired on W5500-EVB-PICO; other chips keep polling
+    if (Ethernet.hardwareStatus() != EthernetW5500) {return false;}
+
+    const uint8_t mask = SnIR::CON | SnIR::DISCON | SnIR::RECV | SnIR::TIMEOUT | SnIR::SEND_OK;
+    for (int sock = 0; sock < MAX_SOCK_NUM; sock++) {
+        w5x00_write_uint8(0x1000 + (sock << 8) + 0x002c, mask); // Sn_IMR
+    }
+    w5x00_write_uint8(0x0018, 0xff); // SIMR
+
+    pinMode(PINOUT_ETHERNET_INT, INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(PINOUT_ETHERNET_INT), w5x00_irq_handler, FALLING);
+
+    return true;
+}
+
+// Returns the socket interrupt bits (SnIR) raised since the last call, all
+// sockets combined. Without interrupt support every event is reported so
+// that the caller polls the sockets as before.
+uint8_t poll_w5x00_events(void)
+{
+    if (!w5x00_irq_enabled) {return 0xff;}
+    if (!w5x00_irq_pending && digitalRead(PINOUT_ETHERNET_INT) == HIGH) {return 0;}
+    w5x00_irq_pending = false;
+
+    uint8_t events = 0;
+    const uint8_t sir = W5100.read(0x0017); // SIR
+    w5x00_spi_transactions++;
+    for (int sock = 0; sock < MAX_SOCK_NUM; sock++) {
+        if ((sir & (1 << sock)) == 0) {continue;}
+        const auto ir = W5100.readSnIR(sock);
+        W5100.writeSnIR(sock, ir);
+        w5x00_spi_transactions += 2;
+        w5x00_socket_events[sock] |= ir;
+        events |= ir;
+    }
+
+    return events;
+}
+
+void report_w5x00_spi_transactions(void)
+{
+    static unsigned long last_report_time = 0;
+    static uint32_t last_count = 0;
+
+    const auto now = millis();
+    if (now - last_report_time < 1000) {return;}
+    _printf("SPI transactions: %lu/s\r\n", w5x00_spi_transactions - last_count);
+    last_report_time = now;
+    last_count = w5x00_spi_transactions;
+}
+
+bool enable_w5x00_dma(void)
+{
+    // The burst frame format below is W5500 specific, and SEND completion
+    // is tracked through the socket interrupts
+    if (!w5x00_irq_enabled) {return false;}
+
+    w5x00_dma_tx_channel = dma_claim_unused_channel(true);
+    w5x00_dma_rx_channel = dma_claim_unused_channel(true);
+
+    return true;
+}
+
+// One W5500 SPI frame (address, control, data phase) with the data phase
+// moved by DMA. tx == nullptr clocks out zeros, rx == nullptr discards input.
+void w5x00_dma_transfer(const uint16_t addr, const uint8_t control, const uint8_t *tx, uint8_t *rx, const uint16_t len)
+{
+    static uint8_t dummy = 0;
+    const uint8_t header[3] = {static_cast<uint8_t>(addr >> 8), static_cast<uint8_t>(addr & 0xff), control};
+
+    SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+    digitalWrite(PINOUT_ETHERNET_SS, LOW);
+    spi_write_blocking(spi0, header, sizeof(header));
+
+    auto tx_config = dma_channel_get_default_config(w5x00_dma_tx_channel);
+    channel_config_set_transfer_data_size(&tx_config, DMA_SIZE_8);
+    channel_config_set_dreq(&tx_config, spi_get_dreq(spi0, true));
+    channel_config_set_read_increment(&tx_config, tx != nullptr);
+    channel_config_set_write_increment(&tx_config, false);
+    dma_channel_configure(w5x00_dma_tx_channel, &tx_config, &spi_get_hw(spi0)->dr, tx != nullptr ? tx : &dummy, len, false);
+
+    auto rx_config = dma_channel_get_default_config(w5x00_dma_rx_channel);
+    channel_config_set_transfer_data_size(&rx_config, DMA_SIZE_8);
+    channel_config_set_dreq(&rx_config, spi_get_dreq(spi0, false));
+    channel_config_set_read_increment(&rx_config, false);
+    channel_config_set_write_increment(&rx_config, rx != nullptr);
+    dma_channel_configure(w5x00_dma_rx_channel, &rx_config, rx != nullptr ? rx : &dummy, &spi_get_hw(spi0)->dr, len, false);
+
+    dma_start_channel_mask((1u << w5x00_dma_tx_channel) | (1u << w5x00_dma_rx_channel));
+    dma_channel_wait_for_finish_blocking(w5x00_dma_rx_channel);
+
+    digitalWrite(PINOUT_ETHERNET_SS, HIGH);
+    SPI.endTransaction();
+    w5x00_spi_transactions++;
+}
+
+// Free-running 16-bit registers (RSR/FSR) must be read until two reads agree
+template <typename F>
+uint16_t w5x00_read_stable(F read)
+{
+    uint16_t value, prev;
+    value = read();
+    w5x00_spi_transactions++;
+    do {
+        prev = value;
+        value = read();
+        w5x00_spi_transactions++;
+    } while (value != prev);
+
+    return value;
+}
+
+int w5x00_dma_recv(const uint8_t sock, uint8_t *buf, const uint16_t max_len)
+{
+    const auto rsr = w5x00_read_stable([sock] {return W5100.readSnRX_RSR(sock);});
+    const auto len = std::min(rsr, max_len);
+    if (len == 0) {return 0;}
+
+    // The W5500 wraps the pointer inside the socket buffer by itself
+    const auto ptr = W5100.readSnRX_RD(sock);
+    w5x00_dma_transfer(ptr, ((sock * 4 + 3) << 3) | 0x00, nullptr, buf, len); // Sn RX buffer, read
+    W5100.writeSnRX_RD(sock, ptr + len);
+    W5100.execCmdSn(sock, Sock_RECV);
+    w5x00_spi_transactions += 3;
+
+    return len;
+}
+
+// Issue SEND for data queued in the chip once the previous SEND completed
+void w5x00_dma_flush(const uint8_t sock)
+{
+    if (w5x00_send_busy) {
+        if ((w5x00_socket_events[sock] & (SnIR::SEND_OK | SnIR::TIMEOUT)) == 0) {return;}
+        w5x00_socket_events[sock] &= ~(SnIR::SEND_OK | SnIR::TIMEOUT);
+        w5x00_send_busy = false;
+    }
+
+    if (w5x00_send_pending) {
+        W5100.execCmdSn(sock, Sock_SEND);
+        w5x00_spi_transactions++;
+        w5x00_send_pending = false;
+        w5x00_send_busy = true;
+    }
+}
+
+int w5x00_dma_send(const uint8_t sock, const uint8_t *buf, const uint16_t max_len)
+{
+    const auto fsr = w5x00_read_stable([sock] {return W5100.readSnTX_FSR(sock);});
+    const auto len = std::min(fsr, max_len);
+    if (len == 0) {return 0;}
+
+    // Data may be queued behind a SEND still in progress; it goes out with the next SEND
+    const auto ptr = W5100.readSnTX_WR(sock);
+    w5x00_dma_transfer(ptr, ((sock * 4 + 2) << 3) | 0x04, buf, nullptr, len); // Sn TX buffer, write
+    W5100.writeSnTX_WR(sock, ptr + len);
+    w5x00_spi_transactions += 2;
+    w5x00_send_pending = true;
+    w5x00_dma_flush(sock);
+
+    return len;
+}
+
+bool w5x00_dma_connected(const uint8_t sock)
+{
+    const auto status = W5100.readSnSR(sock);
+    w5x00_spi_transactions++;
+    if (status == SnSR::CLOSE_WAIT) {
+        return w5x00_read_stable([sock] {return W5100.readSnRX_RSR(sock);}) > 0;
+    }
+    return status != SnSR::LISTEN && status != SnSR::CLOSED && status != SnSR::FIN_WAIT;
+}
+
+// Compression of the online data path (S46), negotiated in band for each
+// direction. A side with S46=1 starts its stream with compression_offer and
+// holds its data until the peer's stream shows whether the peer understands
+// it; then it sends 'C' and compressed data, otherwise (or when the peer
+// stays silent for compression_negotiation_ms) 'R' and raw data. A side with
+// S46=0 that has sent nothing yet answers an offer with the offer and 'R'.
+// Offers and decisions are stripped from the received stream, so peers with
+// this firmware fall back to raw cleanly; others get the offer as data.
+// The offer is written in one piece, so received bytes that match only its
+// start and stay alone for compression_offer_hold_ms are the peer's data.
+constexpr uint8_t compression_offer[] = {0xfe, 'M', 'E', 'Z', 0x01};
+constexpr unsigned long compression_negotiation_ms = 1000;
+constexpr unsigned long compression_offer_hold_ms = 50;
+
+enum class codec_mode : uint8_t {
+    Negotiating,
+    Replay, // receiving: a partial offer turned out to be data
+    Raw,
+    Compressed,
+};
+
+// loop1 (core1)
+struct {
+    codec_mode tx, rx;
+    uint8_t rx_matched;  // offer bytes at the start of the received stream
+    uint8_t rx_replayed; // of those, passed on as data (Replay)
+    bool tx_started;     // anything sent, the offer included
+    bool timing;         // negotiation timer running (online)
+    unsigned long start_ms;
+    unsigned long rx_matched_ms; // first offer byte received
+} net_codec;
+lz_encoder net_tx_encoder;
+lz_decoder net_rx_decoder;
+uint8_t net_tx_stage[lz_encoder::MAX_OUTPUT]; // encoded data or negotiation waiting for room in the socket
+size_t net_tx_stage_pos = 0, net_tx_stage_len = 0;
+uint8_t net_rx_stage[256]; // read from the socket, not yet decoded
+size_t net_rx_stage_pos = 0, net_rx_stage_len = 0;
+
+// Only while the stage holds no more than a few negotiation bytes
+void net_tx_stage_append(const uint8_t *data, const size_t len)
+{
+    memcpy(&net_tx_stage[net_tx_stage_len], data, len);
+    net_tx_stage_len += len;
+}
+
+void net_codec_open(void)
+{
+    const auto offer = modem.get_s_register(S_REGISTER_COMPRESSION) == 1;
+    net_codec.tx = offer ? codec_mode::Negotiating : codec_mode::Raw;
+    net_codec.rx = codec_mode::Negotiating;
+    net_codec.rx_matched = 0;
+    net_codec.rx_replayed = 0;
+    net_codec.tx_started = false;
+    net_codec.timing = false;
+    net_tx_encoder.reset();
+    net_rx_decoder.reset();
+    net_tx_stage_pos = net_tx_stage_len = 0;
+    net_rx_stage_pos = net_rx_stage_len = 0;
+    if (offer) {net_tx_stage_append(compression_offer, sizeof(compression_offer));}
+}
+
+// Start a new session on client's socket
+void net_open(void)
+{
+    if (net_transport == transport::Tcp) {w5x00_socket_events[client.getSocketNumber()] = 0;}
+    w5x00_send_busy = false;
+    w5x00_send_pending = false;
+    net_rx_interval_us.store(UINT32_MAX, std::memory_order_relaxed);
+    net_codec_open();
+}
+
+// Smoothed interval between socket reads that returned data, for hold_tx_packet()
+void update_net_rx_interval(void)
+{
+    static uint32_t last_time_us = 0;
+
+    const auto now = time_us_32();
+    const auto interval = now - last_time_us;
+    const auto avg = net_rx_interval_us.load(std::memory_order_relaxed);
+    last_time_us = now;
+    net_rx_interval_us.store(avg == UINT32_MAX ? interval : avg - avg / 8 + interval / 8, std::memory_order_relaxed);
+}
+
+int net_read(char *buf, const size_t max_len)
+{
+    if (net_transport == transport::Udp) {return udp_link.read(buf, max_len);}
+
+    const auto len = std::min(max_len, static_cast<size_t>(UINT16_MAX));
+    if (w5x00_dma_enabled) {
+        return w5x00_dma_recv(client.getSocketNumber(), reinterpret_cast<uint8_t *>(buf), len);
+    }
+
+    w5x00_spi_transactions++;
+    return client.read(reinterpret_cast<uint8_t *>(buf), len);
+}
+
+int net_write(const char *buf, const size_t max_len)
+{
+    if (net_transport == transport::Udp) {return udp_link.write(buf, max_len);}
+
+    const auto len = std::min(max_len, static_cast<size_t>(UINT16_MAX));
+    if (w5x00_dma_enabled) {
+        return w5x00_dma_send(client.getSocketNumber(), reinterpret_cast<const uint8_t *>(buf), len);
+    }
+
+    const auto writable = std::min(len, static_cast<size_t>(client.availableForWrite()));
+    w5x00_spi_transactions++;
+    if (writable == 0) {return 0;}
+    w5x00_spi_transactions++;
+    return client.write(buf, writable);
+}
+
+// Data handed to net_write() that still waits for a SEND command
+void net_flush(void)
+{
+    if (net_transport == transport::Udp) {
+        udp_link.flush();
+    } else if (w5x00_dma_enabled) {
+        w5x00_dma_flush(client.getSocketNumber());
+    }
+}
+
+enum class connect_status {
+    Pending,
+    Connected,
+    Refused,  // reset by the peer
+    TimedOut, // no answer
+};
+
+// Issue CONNECT on a free socket and return without waiting; net_connect_poll()
+// follows it up. Without DMA the library's blocking connect is used, since the
+// library keeps per-socket state of its own for client.read().
+// S41 dials UDP calls from udp_link's socket instead.
+bool net_connect_start(const IPAddress &ip_addr, const uint16_t port)
+{
+    static uint16_t local_port = 0;
+
+    net_transport = modem.get_s_register(S_REGISTER_TRANSPORT) == 1 ? transport::Udp : transport::Tcp;
+    if (net_transport == transport::Udp) {
+        if (udp_link.get_status() != udp_transport::status::Listening) {return false;}
+        const auto wait_s = std::max(modem.get_s_register(S_REGISTER_WAIT_CARRIER), static_cast<uint8_t>(1));
+        udp_link.connect(ip_addr, port, wait_s * 1000UL);
+        net_connect_socket = MAX_SOCK_NUM;
+        return true;
+    }
+
+    if (!w5x00_dma_enabled) {
+        w5x00_spi_transactions++;
+        net_connect_result = client.connect(ip_addr, port);
+        net_connect_socket = MAX_SOCK_NUM;
+        return true;
+    }
+
+    int sock = -1;
+    for (int s = 0; s < MAX_SOCK_NUM && sock < 0; s++) {
+        w5x00_spi_transactions++;
+        if (W5100.readSnSR(s) == SnSR::CLOSED) {sock = s;}
+    }
+    if (sock < 0) {return false;}
+
+    local_port = local_port >= 49152 && local_port < UINT16_MAX ? local_port + 1 : 49152 + (time_us_32() & 0x3fff);
+    uint8_t dest[4] = {ip_addr[0], ip_addr[1], ip_addr[2], ip_addr[3]};
+    W5100.writeSnMR(sock, SnMR::TCP);
+    W5100.writeSnPORT(sock, local_port);
+    W5100.execCmdSn(sock, Sock_OPEN);
+    W5100.writeSnDIPR(sock, dest);
+    W5100.writeSnDPORT(sock, port);
+    W5100.execCmdSn(sock, Sock_CONNECT);
+    w5x00_spi_transactions += 6;
+
+    w5x00_socket_events[sock] = 0;
+    net_connect_socket = sock;
+    // The chip gives up after its own retries (TIMEOUT); this is only a backstop
+    net_connect_deadline = millis() + config::retry_time_value / 10 * (config::retry_count + 1) + 1000;
+
+    return true;
+}
+
+void net_connect_abort(void)
+{
+    if (net_connect_socket < 0) {return;}
+
+    if (net_transport == transport::Udp) {
+        udp_link.close();
+    } else if (net_connect_socket == MAX_SOCK_NUM) {
+        if (net_connect_result) {client.stop();}
+    } else {
+        W5100.execCmdSn(net_connect_socket, Sock_CLOSE);
+        w5x00_spi_transactions++;
+    }
+    net_connect_socket = -1;
+}
+
+// Sn_SR is only read when a socket interrupt arrived or the deadline passed
+connect_status net_connect_poll(void)
+{
+    if (net_transport == transport::Udp) {
+        const auto status = udp_link.get_status();
+        if (status == udp_transport::status::Connecting) {return connect_status::Pending;}
+        if (status == udp_transport::status::Connected) {
+            net_connect_socket = -1;
+            return connect_status::Connected;
+        }
+        net_connect_abort();
+        return status == udp_transport::status::Refused ? connect_status::Refused : connect_status::TimedOut;
+    }
+
+    const auto sock = net_connect_socket;
+    if (sock == MAX_SOCK_NUM) {
+        net_connect_socket = -1;
+        return net_connect_result ? connect_status::Connected : connect_status::Refused;
+    }
+
+    const auto events = w5x00_socket_events[sock];
+    const auto expired = static_cast<long>(millis() - net_connect_deadline) >= 0;
+    if (events == 0 && !expired) {return connect_status::Pending;}
+    w5x00_socket_events[sock] = 0;
+
+    const auto status = W5100.readSnSR(sock);
+    w5x00_spi_transactions++;
+    if (status == SnSR::ESTABLISHED || status == SnSR::CLOSE_WAIT) {
+        net_connect_socket = -1;
+        client = EthernetClient(sock);
+        return connect_status::Connected;
+    }
+
+    const auto timed_out = (events & SnIR::TIMEOUT) || expired;
+    if (status != SnSR::CLOSED && !timed_out) {return connect_status::Pending;}
+    net_connect_abort();
+
+    return timed_out ? connect_status::TimedOut : connect_status::Refused;
+}
+
+bool net_connected(void)
+{
+    if (net_transport == transport::Udp) {return udp_link.connected();}
+
+    if (w5x00_dma_enabled) {
+        return w5x00_dma_connected(client.getSocketNumber());
+    }
+
+    w5x00_spi_transactions++;
+    return client.connected();
+}
+
+void net_close(void)
+{
+    if (net_transport == transport::Udp) {
+        udp_link.close();
+        return;
+    }
+
+    client.stop();
+    w5x00_spi_transactions++;
+}
+
+// True once everything staged is in the socket
+bool net_tx_stage_flush(void)
+{
+    while (net_tx_stage_pos < net_tx_stage_len) {
+        const auto len = net_write(reinterpret_cast<const char *>(&net_tx_stage[net_tx_stage_pos]), net_tx_stage_len - net_tx_stage_pos);
+        if (len <= 0) {return false;}
+        net_tx_stage_pos += len;
+        net_codec.tx_started = true;
+        metrics.net_tx_wire_bytes += len;
+    }
+    net_tx_stage_pos = net_tx_stage_len = 0;
+    return true;
+}
+
+// Decides how this side sends once the peer's stream tells, and sends what is staged.
+// The timer only runs online: a ringing side does not read the caller's offer yet.
+void net_codec_update(const bool online)
+{
+    if (net_codec.tx == codec_mode::Negotiating) {
+        if (online && !net_codec.timing) {
+            net_codec.timing = true;
+            net_codec.start_ms = millis();
+        }
+        const auto peer_offered = net_codec.rx_matched == sizeof(compression_offer);
+        const auto peer_raw = net_codec.rx != codec_mode::Negotiating && !peer_offered;
+        const auto expired = net_codec.timing && millis() - net_codec.start_ms >= compression_negotiation_ms;
+        if (peer_offered || peer_raw || expired) {
+            const uint8_t decision = peer_offered ? 'C' : 'R';
+            net_tx_stage_append(&decision, 1);
+            net_codec.tx = peer_offered ? codec_mode::Compressed : codec_mode::Raw;
+        }
+    }
+    net_tx_stage_flush();
+}
+
+// One byte at the start of the received stream: the offer, the decision after it, or data
+void net_codec_detect(void)
+{
+    const auto c = net_rx_stage[net_rx_stage_pos];
+    if (net_codec.rx_matched == sizeof(compression_offer)) {
+        net_rx_stage_pos++;
+        net_codec.rx = c == 'C' ? codec_mode::Compressed : codec_mode::Raw;
+        return;
+    }
+    if (c != compression_offer[net_codec.rx_matched]) {
+        // c is data, and so is the part of the offer it followed
+        net_codec.rx = net_codec.rx_matched > 0 ? codec_mode::Replay : codec_mode::Raw;
+        return;
+    }
+    net_rx_stage_pos++;
+    if (net_codec.rx_matched == 0) {net_codec.rx_matched_ms = millis();}
+    if (++net_codec.rx_matched == sizeof(compression_offer) && net_codec.tx == codec_mode::Raw && !net_codec.tx_started) {
+        const uint8_t decline = 'R';
+        net_tx_stage_append(compression_offer, sizeof(compression_offer));
+        net_tx_stage_append(&decline, 1);
+    }
+}
+
+// Gives up on a partial offer that nothing followed (see compression_offer_hold_ms);
+// true when the held bytes are to be read as data
+bool net_codec_expire(void)
+{
+    if (net_codec.rx != codec_mode::Negotiating || net_codec.rx_matched == 0 || net_codec.rx_matched == sizeof(compression_offer)) {return false;}
+    if (net_rx_stage_pos < net_rx_stage_len || millis() - net_codec.rx_matched_ms < compression_offer_hold_ms) {return false;}
+
+    net_codec.rx = codec_mode::Replay;
+    return true;
+}
+
+// net_read() behind the negotiation and decompression; raw data that is not
+// staged is read straight into buf
+int net_read_decoded(char *buf, const size_t max_len)
+{
+    size_t len = 0;
+    while (len < max_len) {
+        const auto staged = net_rx_stage_len - net_rx_stage_pos;
+        if (net_codec.rx == codec_mode::Raw && staged == 0) {
+            const auto read_len = net_read(&buf[len], max_len - len);
+            if (read_len > 0) {
+                len += read_len;
+                metrics.net_rx_wire_bytes += read_len;
+            }
+            break;
+        }
+        if (net_codec.rx == codec_mode::Replay) {
+            buf[len++] = compression_offer[net_codec.rx_replayed++];
+            if (net_codec.rx_replayed == net_codec.rx_matched) {net_codec.rx = codec_mode::Raw;}
+            continue;
+        }
+        if (net_codec.rx == codec_mode::Compressed) {
+            // Called even without input: a match may still have bytes to give
+            size_t consumed;
+            const auto decoded = net_rx_decoder.decode(&net_rx_stage[net_rx_stage_pos], staged, &consumed, &buf[len], max_len - len);
+            len += decoded;
+            net_rx_stage_pos += consumed;
+            if (decoded > 0 || consumed > 0) {continue;}
+        } else if (staged > 0) {
+            if (net_codec.rx == codec_mode::Negotiating) {
+                net_codec_detect();
+            } else {
+                const auto copy_len = std::min(staged, max_len - len);
+                memcpy(&buf[len], &net_rx_stage[net_rx_stage_pos], copy_len);
+                len += copy_len;
+                net_rx_stage_pos += copy_len;
+            }
+            continue;
+        }
+
+        const auto read_len = net_read(reinterpret_cast<char *>(net_rx_stage), sizeof(net_rx_stage));
+        if (read_len <= 0) {break;}
+        net_rx_stage_pos = 0;
+        net_rx_stage_len = read_len;
+        metrics.net_rx_wire_bytes += read_len;
+    }
+
+    return len;
+}
+
+// net_write() behind the negotiation and compression; returns how much of buf was taken
+int net_write_encoded(const char *buf, const size_t max_len)
+{
+    if (!net_tx_stage_flush()) {return 0;}
+
+    if (net_codec.tx == codec_mode::Raw) {
+        const auto len = net_write(buf, max_len);
+        if (len > 0) {
+            net_codec.tx_started = true;
+            metrics.net_tx_wire_bytes += len;
+        }
+        return len;
+    }
+    if (net_codec.tx != codec_mode::Compressed) {return 0;} // holding until negotiated
+
+    const auto len = std::min(max_len, lz_encoder::MAX_INPUT);
+    net_tx_stage_len = net_tx_encoder.encode(buf, len, net_tx_stage);
+    net_tx_stage_flush();
+    return len;
+}
+
+struct latency_report {
+    const char *name;
+    latency_probe<> *probe;
+    uint32_t last_histogram[latency_probe<>::BUCKETS];
+    uint32_t last_bytes;
+};
+
+latency_report latency_reports[] = {
+    {"usb->net", &usb_to_net_latency, {}, 0},
+    {"net->usb", &net_to_usb_latency, {}, 0},
+    {"usb in", &usb_in_latency, {}, 0},
+};
+
+// Per-stage latency percentiles and throughput over the last report interval
+void report_latency(void)
+{
+    constexpr unsigned long interval_ms = 5000;
+    static unsigned long last_report_time = 0;
+
+    const auto now = millis();
+    if (now - last_report_time < interval_ms) {return;}
+    last_report_time = now;
+
+    for (auto &report : latency_reports) {
+        uint32_t histogram[latency_probe<>::BUCKETS];
+        report.probe->get_histogram(histogram);
+        for (int i = 0; i < latency_probe<>::BUCKETS; i++) {
+            const auto count = histogram[i];
+            histogram[i] -= report.last_histogram[i];
+            report.last_histogram[i] = count;
+        }
+        const auto bytes = report.probe->get_bytes();
+        _printf("latency %s: p50 %lu p90 %lu p99 %lu max %lu us, %lu B/s\r\n", report.name,
+            latency_probe<>::percentile_us(histogram, 50), latency_probe<>::percentile_us(histogram, 90),
+            latency_probe<>::percentile_us(histogram, 99), report.probe->get_max_us(),
+            (bytes - report.last_bytes) * 1000 / interval_ms);
+        report.last_bytes = bytes;
+    }
+}
+
+// One line of runtime counters; formatted on the stack and handed to write,
+// which only queues it (nothing here waits for the UART or the socket)
+void write_stats_line(void (*write)(const char *data, size_t len), const char *fmt, ...)
+{
+    va_list args;
+    char buf[96];
+
+    va_start(args, fmt);
+    const auto len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    if (len > 0) {write(buf, std::min(static_cast<size_t>(len), sizeof(buf) - 1));}
+}
+
+template <typename T>
+void report_buffer_stats(void (*write)(const char *data, size_t len), const char *name, T *buffer)
+{
+    write_stats_line(write, "buffer %s: %u/%u used, high-water %u, dropped %u\r\n", name,
+        buffer->get_count(), buffer->get_buffer_size(), buffer->get_high_water_mark(), buffer->get_dropped_count());
+}
+
+// Runtime counters, for ATI6 and the "stats" query on the log port
+void report_stats(void (*write)(const char *data, size_t len))
+{
+    write_stats_line(write, "uptime: %lu ms, state: %d (%lu transitions)\r\n", millis(), static_cast<int>(state.get_state()), state.get_transition_count());
+    write_stats_line(write, "usb out: %lu packets, %lu bytes\r\n", metrics.usb_out_packets, metrics.usb_out_bytes);
+    write_stats_line(write, "usb in: %lu packets, %lu bytes, %lu busy, %lu refilled\r\n", metrics.usb_in_packets, metrics.usb_in_bytes, metrics.usb_in_busy, metrics.usb_in_refills);
+    write_stats_line(write, "usb ep0 stalls: %lu\r\n", usb->get_ep0_stall_count());
+    write_stats_line(write, "net: rx %lu bytes (%lu on the wire), tx %lu bytes (%lu on the wire)\r\n",
+        metrics.net_rx_bytes, metrics.net_rx_wire_bytes, metrics.net_tx_bytes, metrics.net_tx_wire_bytes);
+    write_stats_line(write, "calls: %lu dialed, %lu failed, %lu incoming, %lu rejected, %d queued\r\n",
+        metrics.connect_attempts, metrics.connect_failures, metrics.incoming_calls, metrics.rejected_calls, queued_call_count);
+    write_stats_line(write, "udp: %lu retransmits, %lu duplicates, rtt %lu us\r\n",
+        udp_link.get_retransmit_count(), udp_link.get_duplicate_count(), udp_link.get_rtt_us());
+    write_stats_line(write, "spi transactions: %lu, trace dropped: %lu\r\n", w5x00_spi_transactions, trace_log.get_dropped());
+    report_buffer_stats(write, "usb_rx", &usb_rx_buffer);
+    report_buffer_stats(write, "usb_tx", &usb_tx_buffer);
+    report_buffer_stats(write, "net_rx", &net_rx_buffer);
+    report_buffer_stats(write, "net_tx", &net_tx_buffer);
+    report_buffer_stats(write, "log_tx", &log_tx_buffer);
+}
+
+void at_report(void)
+{
+    report_stats(at_write);
+}
+
+void log_write(const char *data, size_t len)
+{
+    log_tx_buffer.enqueue(data, len);
+}
+
+// Commands typed on the log port, one per line
+void log_rx(void)
+{
+    static char line[16];
+    static size_t len = 0;
+
+    while (log_client.available() > 0) {
+        const auto c = log_client.read();
+        w5x00_spi_transactions++;
+        if (c != '\r' && c != '\n') {
+            if (len < sizeof(line) - 1) {line[len++] = c;}
+            continue;
+        }
+        line[len] = 0;
+        if (strcmp(line, "stats") == 0) {
+            report_stats(log_write);
+        }
+        len = 0;
+    }
+}
+
 void initialize_network(void)
 {
     using namespace config;
@@ -317,14 +1357,106 @@ void setup1()
     Serial1.printf("IP Address: %s\r\n", Ethernet.localIP().toString().c_str());
     Serial1.printf("MAC Address: %02x-%02x-%02x-%02x-%02x-%02x\r\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
 
+    w5x00_irq_enabled = enable_w5x00_interrupt();
+    Serial1.printf("Ethernet Interrupt: %s\r\n", w5x00_irq_enabled ? "enabled" : "disabled (polling)");
+    w5x00_dma_enabled = enable_w5x00_dma();
+    Serial1.printf("Ethernet DMA: %s\r\n", w5x00_dma_enabled ? "enabled" : "disabled");
+
     set_user_led(true);
 
     log_server.begin();
 }
 
-void log_tx()
+// Overflow caller: send the busy message and start closing without waiting for it
+void reject_call(EthernetClient &caller)
+{
+    metrics.rejected_calls++;
+    if (sizeof(config::busy_message) > 1) {
+        caller.write(config::busy_message, sizeof(config::busy_message) - 1);
+    }
+    W5100.execCmdSn(caller.getSocketNumber(), Sock_DISCON);
+    w5x00_spi_transactions += 2;
+}
+
+// Every incoming connection waits in queued_calls until the line is free
+void accept_calls(const uint8_t events, const bool line_busy)
+{
+    if ((events & SnIR::CON) == 0) {return;}
+
+    while (true) {
+        auto caller = server.accept();
+        w5x00_spi_transactions += MAX_SOCK_NUM;
+        if (!caller) {break;}
+
+        metrics.incoming_calls++;
+        if (queued_call_count >= config::max_queued_calls) {
+            reject_call(caller);
+            continue;
+        }
+        const auto waited = line_busy || queued_call_count > 0;
+        queued_calls[queued_call_count++] = {caller, waited};
+    }
+}
+
+// udp_link listens on listen_port while S41 selects UDP; a UDP call in
+// progress keeps it open. Opening is retried while all sockets are taken.
+void update_udp_link(const bool in_use)
+{
+    static unsigned long last_attempt_time = 0;
+
+    if (modem.get_s_register(S_REGISTER_TRANSPORT) != 1) {
+        if (!in_use) {udp_link.stop();}
+        return;
+    }
+
+    const auto now = millis();
+    if (udp_link.is_open() || now - last_attempt_time < 1000) {return;}
+    last_attempt_time = now;
+    udp_link.begin(config::listen_port);
+    w5x00_spi_transactions += MAX_SOCK_NUM;
+}
+
+void dial_failed(const AT_RESULT result)
+{
+    metrics.connect_failures++;
+    _trace(TRACE_EVENT_CONNECT_FAILED, 0, 0);
+    if (state.transition(modem_state::Calling, modem_state::Offline)) {
+        modem.result(result);
+        notify_core0();
+    }
+}
+
+// server_ip for the current dial. A name missing from the cache is looked up
+// over several loop1() passes (Busy) so that the loop keeps running meanwhile.
+dns_resolver::status resolve_server_ip(void)
+{
+    if (server_host[0] == '\0') {return dns_resolver::status::Resolved;}
+
+    auto status = resolver.poll(&server_ip);
+    if (status == dns_resolver::status::Idle) {
+        if (resolver.lookup(server_host, &server_ip)) {return dns_resolver::status::Resolved;}
+        resolver.start(Ethernet.dnsServerIP(), server_host);
+        status = resolver.poll(&server_ip);
+    }
+    if (status == dns_resolver::status::Failed && server_host_alt[0] != '\0') {
+        // The name as dialed does not exist; try it without the leading T or P
+        resolver.cancel();
+        strcpy(server_host, server_host_alt);
+        server_host_alt[0] = '\0';
+        return dns_resolver::status::Busy;
+    }
+    if (status != dns_resolver::status::Busy) {resolver.cancel();}
+
+    return status;
+}
+
+void log_tx(const uint8_t events)
 {
-    EthernetClient new_client = log_server.accept();
+    EthernetClient new_client;
+    if (events & SnIR::CON) {
+        new_client = log_server.accept();
+        w5x00_spi_transactions += MAX_SOCK_NUM;
+    }
     if (new_client) {
         if (!log_client.connected()) {
             log_client.stop();
@@ -335,77 +1467,226 @@ void log_tx()
         }
     }
 
-    while (log_client.availableForWrite() && !log_tx_buffer.is_empty()) {
-        char buf[64];
-        int len = log_tx_buffer.dequeue(buf, sizeof(buf));
-        int ptr = 0;
-        while (ptr < len) {
-            ptr += log_client.write(buf + ptr, len - ptr);
-        }
+    log_rx();
+
+    while (!log_tx_buffer.is_empty() && log_client.availableForWrite()) {
+        const char *span;
+        const auto len = log_tx_buffer.peek_read_span(&span);
+        if (len == 0) {break;}
+        log_tx_buffer.consume(log_client.write(span, len));
+    }
+
+    trace_record rec;
+    while (log_client.availableForWrite() >= 64 && trace_log.pop(&rec)) {
+        char line[64];
+        const auto len = tracer<>::format(&rec, line, sizeof(line));
+        log_client.write(line, std::min(static_cast<size_t>(len), sizeof(line) - 1));
     }
 }
 
+// RING repeats while a call is not answered, like a 1 s on, 2 s off ring
+// cadence; S1 counts them and S0 says after how many to answer
+constexpr unsigned long ring_interval_ms = 3000;
+unsigned long last_ring_ms = 0; // loop1 (core1)
+
+// Reports one ring of the call in Ringing (answer: without waiting for S0)
+void ring(const bool answer)
+{
+    const auto rings = std::min(modem.get_s_register(S_REGISTER_RING_COUNT) + 1, 255);
+    modem.set_s_register(S_REGISTER_RING_COUNT, rings);
+    last_ring_ms = millis();
+    _trace(TRACE_EVENT_RING, 0, 0);
+    modem.result(AT_RESULT_RING);
+
+    const auto auto_answer = modem.get_s_register(S_REGISTER_AUTO_ANSWER);
+    if ((answer || (auto_answer != 0 && rings >= auto_answer)) && state.transition(modem_state::Ringing, modem_state::Online)) {
+        report_connect();
+    }
+    notify_core0();
+}
+
 void loop1()
 {
-    if (config::enable_log) {log_tx();}
+    // Socket state that outlives the interrupt which reported it
+    static bool client_open = false;
+    static bool net_rx_pending = false;
+    static bool disconnect_pending = false;
 
-    EthernetClient new_client = server.accept();
-    if (new_client) {
-        if (state.transition(modem_state::Offline, modem_state::Ringing)) {
-            client = new_client;
-            const char msg[] = "RING\r\n";
-            usb_tx_buffer.enqueue(msg, sizeof(msg) - 1);
-        } else {
-            new_client.stop();
+    const auto events = poll_w5x00_events();
+    if (events & SnIR::RECV) {net_rx_pending = true;}
+    if (events & (SnIR::DISCON | SnIR::TIMEOUT)) {disconnect_pending = true;}
+
+    if (config::enable_log || config::enable_trace) {log_tx(events);}
+    if (config::enable_log) {
+        report_w5x00_spi_transactions();
+        report_latency();
+    }
+
+    accept_calls(events, client_open || !state.is_state(modem_state::Offline));
+    update_udp_link(net_transport == transport::Udp && (client_open || net_connect_socket >= 0));
+    if (udp_link.is_open() && (events & SnIR::RECV)) {udp_link.receive();}
+    if (client_open && net_transport == transport::Udp && !udp_link.connected()) {disconnect_pending = true;}
+
+    // Dialing: name lookup, then connect, each polled without blocking. DTR
+    // drop or a keypress moves the state away from Calling, which aborts it.
+    if (!state.is_state(modem_state::Calling)) {
+        resolver.cancel();
+        net_connect_abort();
+    } else if (net_connect_socket < 0) {
+        const auto resolved = resolve_server_ip();
+        if (resolved == dns_resolver::status::Failed) {
+            metrics.connect_attempts++;
+            dial_failed(AT_RESULT_BUSY);
+        } else if (resolved == dns_resolver::status::Resolved) {
+            _trace(TRACE_EVENT_CONNECTING, server_port, static_cast<uint32_t>(server_ip));
+            metrics.connect_attempts++;
+            if (!net_connect_start(server_ip, server_port)) {dial_failed(AT_RESULT_BUSY);}
         }
     }
 
-    if (state.is_state(modem_state::Calling)) {
-        _printf("Connecting...\r\n");
-    
-        if (client.connect(server_ip, server_port)) {
-            _printf("Connected.\r\n");
-            const char reply[] = "CONNECT 33600 V.42\r\n";
-            usb_tx_buffer.enqueue(reply, sizeof(reply) - 1);
-            state.transition(modem_state::Calling, modem_state::Online);
+    if (state.is_state(modem_state::Calling) && net_connect_socket >= 0) {
+        const auto status = net_connect_poll();
+        if (status == connect_status::Connected) {
+            _trace(TRACE_EVENT_CONNECTED, 0, 0);
+            client_open = true;
+            net_open();
+            net_rx_pending = true;
+            disconnect_pending = false;
+            // Go online before reporting CONNECT so the host's first bytes take the online path.
+            // If the dial was aborted meanwhile, the Offline check below closes the socket.
+            if (state.transition(modem_state::Calling, modem_state::Online)) {
+                report_connect();
+                notify_core0();
+            }
+        } else if (status == connect_status::Refused) {
+            dial_failed(AT_RESULT_BUSY);
+        } else if (status == connect_status::TimedOut) {
+            dial_failed(AT_RESULT_NO_CARRIER);
+        }
+    }
+
+    if (state.is_state(modem_state::Offline) && client_open) {
+        net_close();
+        client_open = false;
+    }
+
+    // Ring the oldest caller still on the line once the line is free
+    while (queued_call_count > 0 && !client_open && state.is_state(modem_state::Offline)) {
+        auto &next = queued_calls[0];
+        w5x00_spi_transactions++;
+        const auto hung_up = !next.caller.connected();
+        if (hung_up) {
+            next.caller.stop();
+        } else if (state.transition(modem_state::Offline, modem_state::Ringing)) {
+            net_transport = transport::Tcp;
+            client = next.caller;
+            client_open = true;
+            net_open();
+            net_rx_pending = true;
+            disconnect_pending = false;
+            modem.set_s_register(S_REGISTER_RING_COUNT, 0);
+            ring(config::auto_answer_queued_calls && next.waited);
         } else {
-            _printf("Connection failed.\r\n");
-            const char reply[] = "BUSY\r\n";
-            usb_tx_buffer.enqueue(reply, sizeof(reply) - 1);
-            state.transition(modem_state::Calling, modem_state::Offline);
+            break; // core0 took the line (dialing)
         }
+        for (int i = 1; i < queued_call_count; i++) {
+            queued_calls[i - 1] = queued_calls[i];
+        }
+        queued_calls[--queued_call_count].caller = EthernetClient();
     }
 
-    if (state.is_state(modem_state::Offline)) {
-        if (client.availableForWrite()) {
-            client.stop();
+    // A UDP caller rings like a TCP one but is not queued: with the line busy it is refused
+    if (udp_link.get_status() == udp_transport::status::Incoming && !(client_open && net_transport == transport::Udp)) {
+        metrics.incoming_calls++;
+        if (!client_open && state.transition(modem_state::Offline, modem_state::Ringing)) {
+            net_transport = transport::Udp;
+            udp_link.accept();
+            client_open = true;
+            net_open();
+            net_rx_pending = true;
+            disconnect_pending = false;
+            modem.set_s_register(S_REGISTER_RING_COUNT, 0);
+            ring(false);
+        } else {
+            metrics.rejected_calls++;
+            udp_link.close();
         }
     }
 
-    if (!state.is_state(modem_state::Online)) {
+    if (client_open && state.is_state(modem_state::Ringing) && millis() - last_ring_ms >= ring_interval_ms) {ring(false);}
+
+    // A ringing side already sends its compression offer, so the caller need not wait for the answer
+    const auto online = state.is_state(modem_state::Online) || state.is_state(modem_state::OnlineCommand);
+    if (client_open && (online || state.is_state(modem_state::Ringing))) {net_codec_update(online);}
+    if (!online) {
+        // Online, net_flush() below does this; otherwise the offer, SYNs, ACKs and keepalives are still due
+        if (client_open && net_transport == transport::Tcp) {net_flush();}
+        udp_link.flush();
         return;
     }
 
-    // Receive
-    while (client.available() && !net_rx_buffer.is_full()) {
-        char buf[64];
-        const auto max_len = std::min(sizeof(buf), net_rx_buffer.get_free_count());
-        const auto len = client.read(reinterpret_cast<uint8_t *>(buf), max_len);
-        net_rx_buffer.enqueue(buf, len);
+    // Receive (directly into net_rx_buffer) until the socket runs dry. While the
+    // buffer is full the data stays in the chip, so the TCP window closes instead
+    // of bytes being dropped; reading resumes once usb_tx_process() frees space.
+    if (net_codec_expire()) {net_rx_pending = true;}
+    bool net_rx_received = false;
+    while (net_rx_pending) {
+        char *span;
+        const auto max_len = net_rx_buffer.acquire_write_span(&span);
+        if (max_len == 0) {break;}
+        const auto len = net_read_decoded(span, max_len);
+        if (len <= 0) {
+            net_rx_pending = false;
+            break;
+        }
+        net_rx_buffer.commit_write(len);
+        metrics.net_rx_bytes += len;
+        _trace(TRACE_EVENT_NET_READ, 0, len);
+        net_to_usb_latency.enter(len);
+        net_rx_received = true;
+        notify_core0();
     }
+    if (net_rx_received) {update_net_rx_interval();}
 
-    // Transmit
-    while (client.availableForWrite() && !net_tx_buffer.is_empty()) {
-        char buf[512];
-        const auto max_len = std::min(sizeof(buf), static_cast<size_t>(client.availableForWrite()));
-        int len = net_tx_buffer.dequeue(buf, max_len);
-        int ptr = 0;
-        while (ptr < len) {
-            ptr += client.write(buf + ptr, len - ptr);
-        }
+    // Transmit (directly from net_tx_buffer) at the emulated line rate. What is
+    // pending goes out once the line could have carried it, up to a full
+    // bucket at a time, rather than as one packet per byte. Freed space lets
+    // core0 re-arm USB OUT, which is the flow control the host sees.
+    const auto now_us = time_us_32();
+    const auto rate = line_rate_bps();
+    if (net_tx_pacer.get_rate() != rate) {net_tx_pacer.set_rate(rate, now_us);}
+    auto net_tx_allowed = net_tx_pacer.available(now_us);
+    if (net_tx_allowed < std::min(net_tx_buffer.get_count(), net_tx_pacer.get_burst())) {net_tx_allowed = 0;}
+    bool net_tx_consumed = false;
+    while (!net_tx_buffer.is_empty() && net_tx_allowed > 0) {
+        const char *span;
+        const auto span_len = std::min(net_tx_buffer.peek_read_span(&span), net_tx_allowed);
+        const auto len = net_write_encoded(span, span_len);
+        if (len <= 0) {break;}
+        net_tx_buffer.consume(len);
+        net_tx_pacer.consume(len);
+        net_tx_allowed -= len;
+        metrics.net_tx_bytes += len;
+        _trace(TRACE_EVENT_NET_WRITE, 0, len);
+        usb_to_net_latency.leave(len);
+        net_tx_consumed = true;
     }
+    if (net_tx_consumed) {notify_core0();}
+    net_flush();
 
-    if (!client.connected()) {
-        state.transition(modem_state::Online, modem_state::Disconnected);
+    // connected() stays true while received data remains, so keep checking
+    // until it drops or the socket turns out to be still established
+    if (disconnect_pending) {
+        if (!net_connected()) {
+            if (!state.transition(modem_state::Online, modem_state::Disconnected)
+                && state.transition(modem_state::OnlineCommand, modem_state::Offline)) {
+                modem.result(AT_RESULT_NO_CARRIER);
+                notify_core0();
+            }
+            _trace(TRACE_EVENT_DISCONNECTED, 0, 0);
+            disconnect_pending = false;
+        } else if (net_transport == transport::Udp || client.status() == SnSR::ESTABLISHED) {
+            disconnect_pending = false;
+        }
     }
 }
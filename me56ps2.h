@@ -1,3 +1,7 @@
+#pragma once
+
+#include <cstdint>
+
 #include "usb_struct.h"
 
 constexpr auto ME56PS2_BCD_USB        = 0x0110U; // USB 1.1
@@ -23,6 +27,7 @@ enum PINOUT {
     PINOUT_USER_LED       = 25,
     PINOUT_ETHERNET_RESET = 20,
     PINOUT_ETHERNET_SS    = 17,
+    PINOUT_ETHERNET_INT   = 21,
 };
 
 enum class modem_state : int {
@@ -31,6 +36,7 @@ enum class modem_state : int {
     Ringing,
     Calling,
     Online,
+    OnlineCommand, // escaped with "+++", the connection stays up
     Disconnected,
 };
 
@@ -123,7 +129,7 @@ const struct usb_string_descriptor<3> me56ps2_string_descriptor_3 = { // Serial
 };
 
 constexpr auto ME56PS2_STRING_DESCRIPTORS_NUM = 4;
-const void *me56ps2_string_descriptors[ME56PS2_STRING_DESCRIPTORS_NUM] = {
+inline const void *me56ps2_string_descriptors[ME56PS2_STRING_DESCRIPTORS_NUM] = {
     &me56ps2_string_descriptor_0,
     &me56ps2_string_descriptor_1,
     &me56ps2_string_descriptor_2,
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <string.h>
+
+#include <Arduino.h>
+
+#include "hardware/regs/addressmap.h"
+
+#include "phonebook.h"
+
+phonebook::phonebook(const uint32_t flash_offset, const uint32_t spare_flash_offset)
+{
+    sector_offsets[0] = flash_offset;
+    sector_offsets[1] = spare_flash_offset;
+    active = -1;
+    generation = 0;
+    for (auto &entry : entries) {
+        entry[0] = '\0';
+    }
+    next_record = RECORDS;
+}
+
+const phonebook::record *phonebook::get_records(const int sector)
+{
+    return reinterpret_cast<const record *>(XIP_BASE + sector_offsets[sector]);
+}
+
+// false when the sector does not start with a header, i.e. its log was
+// never finished (or it is erased, or holds a log without one)
+bool phonebook::read_generation(const int sector, uint32_t *generation)
+{
+    const auto &header = get_records(sector)[0];
+    if (header.magic != RECORD_MAGIC || header.index != HEADER_INDEX || header.length != 0) {return false;}
+
+    memcpy(generation, header.dial, sizeof(*generation));
+    return true;
+}
+
+void phonebook::load(void)
+{
+    active = -1;
+    for (int sector = 0; sector < 2; sector++) {
+        uint32_t g;
+        if (!read_generation(sector, &g)) {continue;}
+        if (active < 0 || static_cast<int32_t>(g - generation) > 0) {
+            active = sector;
+            generation = g;
+        }
+    }
+
+    // Without a header the first sector may still hold a log from before
+    // there were two; read it, and move it to the spare on the first change
+    const auto *records = get_records(active < 0 ? 0 : active);
+    int slot;
+    for (slot = active < 0 ? 0 : 1; slot < RECORDS; slot++) {
+        const auto &rec = records[slot];
+        if (rec.magic != RECORD_MAGIC) {break;} // erased, end of the log
+        if (rec.index >= ENTRIES || rec.length > DIAL_SIZE) {continue;}
+        memcpy(entries[rec.index], rec.dial, rec.length);
+        entries[rec.index][rec.length] = '\0';
+    }
+    next_record = active < 0 ? RECORDS : slot;
+}
+
+// nullptr when the entry is empty or out of range
+const char *phonebook::get(const int index)
+{
+    if (index < 0 || index >= ENTRIES || entries[index][0] == '\0') {return nullptr;}
+
+    return entries[index];
+}
+
+// An empty dial string deletes the entry
+bool phonebook::set(const int index, const char *dial_string)
+{
+    const auto length = strlen(dial_string);
+    if (index < 0 || index >= ENTRIES || length > DIAL_SIZE) {return false;}
+    if (strcmp(entries[index], dial_string) == 0) {return true;}
+
+    memcpy(entries[index], dial_string, length + 1);
+    if (next_record >= RECORDS) {
+        compact();
+    } else {
+        program_entry(active, next_record++, index);
+    }
+
+    return true;
+}
+
+// Programs one record of the page; the other bytes are written as 0xff,
+// which leaves what is already in flash unchanged.
+void phonebook::program_record(const int sector, const int slot, const record &rec)
+{
+    uint8_t page[FLASH_PAGE_SIZE];
+    memset(page, 0xff, sizeof(page));
+    memcpy(page + slot % RECORDS_PER_PAGE * sizeof(record), &rec, sizeof(rec));
+
+    // Flash is not readable while it is programmed: park the other core and IRQs
+    rp2040.idleOtherCore();
+    noInterrupts();
+    flash_range_program(sector_offsets[sector] + slot / RECORDS_PER_PAGE * FLASH_PAGE_SIZE, page, sizeof(page));
+    interrupts();
+    rp2040.resumeOtherCore();
+}
+
+void phonebook::program_entry(const int sector, const int slot, const int index)
+{
+    record rec;
+    const auto length = strlen(entries[index]);
+    rec.magic = RECORD_MAGIC;
+    rec.index = index;
+    rec.length = length;
+    memset(rec.dial, 0, sizeof(rec.dial));
+    memcpy(rec.dial, entries[index], length);
+    program_record(sector, slot, rec);
+}
+
+// Start the log over in the other sector with one record per live entry.
+// The current log stays intact until the new header is programmed.
+void phonebook::compact(void)
+{
+    const auto target = active == 1 ? 0 : 1;
+
+    rp2040.idleOtherCore();
+    noInterrupts();
+    flash_range_erase(sector_offsets[target], FLASH_SECTOR_SIZE);
+    interrupts();
+    rp2040.resumeOtherCore();
+
+    next_record = 1;
+    for (int i = 0; i < ENTRIES; i++) {
+        if (entries[i][0] != '\0') {program_entry(target, next_record++, i);}
+    }
+
+    record header;
+    memset(&header, 0, sizeof(header));
+    header.magic = RECORD_MAGIC;
+    header.index = HEADER_INDEX;
+    header.length = 0;
+    generation++;
+    memcpy(header.dial, &generation, sizeof(generation));
+    program_record(target, 0, header);
+    active = target;
+}
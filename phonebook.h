@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "hardware/flash.h"
+
+// Numbered dial strings kept in flash. Every change is appended as a new
+// 64-byte record (the last record of an entry wins) to the log in one of two
+// sectors. When the log is full it starts over in the other sector with the
+// live entries, and a header record with a higher generation number, written
+// last, makes it the current one; so a power loss at any point leaves one
+// complete copy. Given the same sector twice it falls back to erasing the
+// only copy in place. load() builds the RAM copy that get() reads, so
+// dialing never touches flash.
+class phonebook
+{
+    public:
+        static constexpr int ENTRIES = 10;
+        static constexpr size_t DIAL_SIZE = 60;
+    private:
+        static constexpr uint16_t RECORD_MAGIC = 0x5042;
+        static constexpr uint8_t HEADER_INDEX = 0xff; // first record of a log, generation in dial
+        struct record {
+            uint16_t magic;
+            uint8_t index;
+            uint8_t length; // 0: entry deleted
+            char dial[DIAL_SIZE];
+        };
+        static_assert(sizeof(record) == 64, "records must tile flash pages");
+        static constexpr int RECORDS = FLASH_SECTOR_SIZE / sizeof(record);
+        static constexpr int RECORDS_PER_PAGE = FLASH_PAGE_SIZE / sizeof(record);
+
+        uint32_t sector_offsets[2];
+        int active;          // sector holding the current log, -1: none yet
+        uint32_t generation; // of the current log
+        char entries[ENTRIES][DIAL_SIZE + 1];
+        int next_record;
+
+        const record *get_records(const int sector);
+        bool read_generation(const int sector, uint32_t *generation);
+        void program_record(const int sector, const int slot, const record &rec);
+        void program_entry(const int sector, const int slot, const int index);
+        void compact(void);
+    public:
+        phonebook(const uint32_t flash_offset, const uint32_t spare_flash_offset);
+        void load(void);
+        const char *get(const int index);
+        bool set(const int index, const char *dial_string);
+};
@@ -1,23 +1,53 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
+#include <cstring>
+#include <type_traits>
 
 #include "lock.h"
 
-template <typename T>
+// All operations are written so that the producer only stores write_ptr and
+// the consumer only stores read_ptr (release), each reading the other side's
+// pointer with acquire. With spsc = true the critical section is skipped
+// entirely, which is safe as long as there is exactly one producer context
+// and one consumer context. clear(), erase() and find() are consumer-side
+// operations.
+//
+// acquire_write_span()/commit_write() and peek_read_span()/consume() give
+// direct access to the buffer memory. The caller must be the only producer
+// (write span) or the only consumer (read span) of the buffer; the span is
+// valid until the matching commit_write() or consume().
+//
+// The producer side also keeps statistics: the highest fill level seen and
+// the number of elements enqueue() could not store.
+//
+// The storage is part of the object, sized by capacity at compile time, so
+// a buffer declared at file scope costs no heap and no work at startup. The
+// capacity must be a power of two so that pointer wrap-around is a mask
+// instead of a modulo; one element is kept free to tell full from empty.
+template <typename T, size_t capacity, bool spsc = false>
 class ring_buffer
 {
+    static_assert(std::is_trivially_copyable<T>::value, "ring_buffer<T> copies elements with memcpy");
+    static_assert(capacity >= 2 && (capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+    template <typename, size_t, bool> friend class ring_buffer;
     private:
-        size_t write_ptr, read_ptr;
-        size_t buffer_size;
-        T *buffer;
+        static constexpr size_t buffer_size = capacity;
+        std::atomic<size_t> write_ptr, read_ptr;
+        T buffer[capacity];
         critical_section_t cs;
-        bool is_empty_without_lock(void);
-        bool is_full_without_lock(void);
-        bool enqueue_signle_without_lock(const T *data);
-        bool dequeue_signle_without_lock(T *data);
+        size_t high_water_mark;
+        size_t dropped_count;
+        critical_section_t *get_lock(void) {return spsc ? nullptr : &cs;}
+        size_t wrap(size_t ptr) {return ptr & (capacity - 1);}
+        size_t count_without_lock(void);
+        size_t write_span_without_lock(T **span);
+        size_t read_span_without_lock(const T **span);
+        void update_high_water_mark(size_t count) {if (count > high_water_mark) {high_water_mark = count;}}
     public:
-        ring_buffer(const size_t size);
+        ring_buffer();
         ~ring_buffer();
         bool is_empty(void);
         bool is_full(void);
@@ -27,168 +57,236 @@ class ring_buffer
         size_t enqueue(const T *data, size_t length);
         size_t dequeue(T *data, size_t max_length);
         size_t erase(size_t length);
-        size_t pull(ring_buffer<T> *from);
+        size_t acquire_write_span(T **span);
+        void commit_write(size_t length);
+        size_t peek_read_span(const T **span);
+        size_t consume(size_t length);
+        template <size_t from_capacity, bool from_spsc>
+        size_t pull(ring_buffer<T, from_capacity, from_spsc> *from);
         void clear(void);
         bool find(const T marker, size_t *length);
+        size_t get_high_water_mark(void) {return high_water_mark;}
+        size_t get_dropped_count(void) {return dropped_count;}
 };
 
-template <typename T>
-ring_buffer<T>::ring_buffer(const size_t size)
+template <typename T, size_t capacity>
+using spsc_ring_buffer = ring_buffer<T, capacity, true>;
+
+template <typename T, size_t capacity, bool spsc>
+ring_buffer<T, capacity, spsc>::ring_buffer()
 {
     write_ptr = 0;
     read_ptr = 0;
-    buffer_size = size;
-    buffer = new T[size];
+    high_water_mark = 0;
+    dropped_count = 0;
     critical_section_init(&cs);
 }
 
-template <typename T>
-ring_buffer<T>::~ring_buffer()
+template <typename T, size_t capacity, bool spsc>
+ring_buffer<T, capacity, spsc>::~ring_buffer()
 {
     critical_section_deinit(&cs);
-    delete buffer;
 }
 
-template <typename T>
-bool ring_buffer<T>::is_empty_without_lock(void)
+template <typename T, size_t capacity, bool spsc>
+size_t ring_buffer<T, capacity, spsc>::count_without_lock(void)
+{
+    const auto w = write_ptr.load(std::memory_order_acquire);
+    const auto r = read_ptr.load(std::memory_order_acquire);
+
+    return wrap(buffer_size + w - r);
+}
+
+// Contiguous free region starting at write_ptr (producer side).
+template <typename T, size_t capacity, bool spsc>
+size_t ring_buffer<T, capacity, spsc>::write_span_without_lock(T **span)
 {
-    return write_ptr == read_ptr;
+    const auto w = write_ptr.load(std::memory_order_relaxed);
+    const auto r = read_ptr.load(std::memory_order_acquire);
+    const auto free = wrap(buffer_size + r - w - 1);
+
+    *span = &buffer[w];
+    return std::min(free, buffer_size - w);
 }
 
-template <typename T>
-bool ring_buffer<T>::is_full_without_lock(void)
+// Contiguous filled region starting at read_ptr (consumer side).
+template <typename T, size_t capacity, bool spsc>
+size_t ring_buffer<T, capacity, spsc>::read_span_without_lock(const T **span)
 {
-    const auto next_write_ptr = (write_ptr + 1) % buffer_size;
-    return next_write_ptr == read_ptr;
+    const auto r = read_ptr.load(std::memory_order_relaxed);
+    const auto w = write_ptr.load(std::memory_order_acquire);
+    const auto count = wrap(buffer_size + w - r);
+
+    *span = &buffer[r];
+    return std::min(count, buffer_size - r);
 }
 
-template <typename T>
-bool ring_buffer<T>::is_empty(void)
+template <typename T, size_t capacity, bool spsc>
+bool ring_buffer<T, capacity, spsc>::is_empty(void)
 {
-    lock_guard lk(&cs);
+    lock_guard lk(get_lock());
 
-    return is_empty_without_lock();
+    return count_without_lock() == 0;
 }
 
-template <typename T>
-bool ring_buffer<T>::is_full(void)
+template <typename T, size_t capacity, bool spsc>
+bool ring_buffer<T, capacity, spsc>::is_full(void)
 {
-    lock_guard lk(&cs);
+    lock_guard lk(get_lock());
 
-    return is_full_without_lock();
+    return count_without_lock() == get_buffer_size();
 }
 
-template <typename T>
-size_t ring_buffer<T>::get_buffer_size(void)
+template <typename T, size_t capacity, bool spsc>
+size_t ring_buffer<T, capacity, spsc>::get_buffer_size(void)
 {
     return buffer_size - 1;
 }
 
-template <typename T>
-size_t ring_buffer<T>::get_count(void)
+template <typename T, size_t capacity, bool spsc>
+size_t ring_buffer<T, capacity, spsc>::get_count(void)
 {
-    lock_guard lk(&cs);
+    lock_guard lk(get_lock());
 
-    return (buffer_size + write_ptr - read_ptr) % buffer_size;
+    return count_without_lock();
 }
 
-template <typename T>
-size_t ring_buffer<T>::get_free_count(void)
+template <typename T, size_t capacity, bool spsc>
+size_t ring_buffer<T, capacity, spsc>::get_free_count(void)
 {
     return get_buffer_size() - get_count();
 }
 
-template <typename T>
-bool ring_buffer<T>::enqueue_signle_without_lock(const T *data)
+template <typename T, size_t capacity, bool spsc>
+size_t ring_buffer<T, capacity, spsc>::enqueue(const T *data, size_t length)
 {
-    if (is_full_without_lock()) {
-        return false;
-    }
+    lock_guard lk(get_lock());
+
+    const auto w = write_ptr.load(std::memory_order_relaxed);
+    const auto r = read_ptr.load(std::memory_order_acquire);
+    const auto free = wrap(buffer_size + r - w - 1);
+    const auto len = std::min(length, free);
+    const auto first = std::min(len, buffer_size - w);
+
+    memcpy(&buffer[w], data, first * sizeof(T));
+    memcpy(buffer, data + first, (len - first) * sizeof(T));
+    write_ptr.store(wrap(w + len), std::memory_order_release);
 
-    buffer[write_ptr] = *data;
-    write_ptr = (write_ptr + 1) % buffer_size;
+    update_high_water_mark(get_buffer_size() - free + len);
+    dropped_count += length - len;
 
-    return true;
+    return len;
 }
 
-template <typename T>
-size_t ring_buffer<T>::enqueue(const T *data, size_t length)
+template <typename T, size_t capacity, bool spsc>
+size_t ring_buffer<T, capacity, spsc>::dequeue(T *data, size_t max_length)
 {
-    lock_guard lk(&cs);
+    lock_guard lk(get_lock());
 
-    size_t ptr = 0;
-    while(ptr < length && enqueue_signle_without_lock(&data[ptr])) {ptr++;}
+    const auto r = read_ptr.load(std::memory_order_relaxed);
+    const auto w = write_ptr.load(std::memory_order_acquire);
+    const auto len = std::min(max_length, wrap(buffer_size + w - r));
+    const auto first = std::min(len, buffer_size - r);
 
-    return ptr;
+    memcpy(data, &buffer[r], first * sizeof(T));
+    memcpy(data + first, buffer, (len - first) * sizeof(T));
+    read_ptr.store(wrap(r + len), std::memory_order_release);
+
+    return len;
 }
 
-template <typename T>
-bool ring_buffer<T>::dequeue_signle_without_lock(T *data)
+template <typename T, size_t capacity, bool spsc>
+size_t ring_buffer<T, capacity, spsc>::erase(size_t length)
 {
-    if (is_empty_without_lock()) {
-        return false;
-    }
+    lock_guard lk(get_lock());
+
+    const auto erased = std::min(length, count_without_lock());
+    const auto r = read_ptr.load(std::memory_order_relaxed);
+    read_ptr.store(wrap(r + erased), std::memory_order_release);
+
+    return erased;
+}
 
-    *data = buffer[read_ptr];
-    read_ptr = (read_ptr + 1) % buffer_size;
+template <typename T, size_t capacity, bool spsc>
+size_t ring_buffer<T, capacity, spsc>::acquire_write_span(T **span)
+{
+    lock_guard lk(get_lock());
 
-    return true;
+    return write_span_without_lock(span);
 }
 
-template <typename T>
-size_t ring_buffer<T>::dequeue(T *data, size_t max_length)
+template <typename T, size_t capacity, bool spsc>
+void ring_buffer<T, capacity, spsc>::commit_write(size_t length)
 {
-    lock_guard lk(&cs);
+    lock_guard lk(get_lock());
 
-    size_t ptr = 0;
-    while (ptr < max_length && dequeue_signle_without_lock(&data[ptr])) {ptr++;}
+    const auto w = write_ptr.load(std::memory_order_relaxed);
+    const auto r = read_ptr.load(std::memory_order_acquire);
+    const auto free = wrap(buffer_size + r - w - 1);
+    const auto committed = std::min(length, free);
+    write_ptr.store(wrap(w + committed), std::memory_order_release);
 
-    return ptr;
+    update_high_water_mark(get_buffer_size() - free + committed);
 }
 
-template <typename T>
-size_t ring_buffer<T>::erase(size_t length)
+template <typename T, size_t capacity, bool spsc>
+size_t ring_buffer<T, capacity, spsc>::peek_read_span(const T **span)
 {
-    lock_guard lk(&cs);
+    lock_guard lk(get_lock());
 
-    const auto erased = std::min(length, get_count());
-    read_ptr += erased;
+    return read_span_without_lock(span);
+}
 
-    return erased;
+template <typename T, size_t capacity, bool spsc>
+size_t ring_buffer<T, capacity, spsc>::consume(size_t length)
+{
+    // Clamped like erase() so that a clear() between peek and consume is harmless.
+    return erase(length);
 }
 
-template <typename T>
-size_t ring_buffer<T>::pull(ring_buffer<T> *from)
+template <typename T, size_t capacity, bool spsc>
+template <size_t from_capacity, bool from_spsc>
+size_t ring_buffer<T, capacity, spsc>::pull(ring_buffer<T, from_capacity, from_spsc> *from)
 {
-    lock_guard lk(&cs);
-    lock_guard lk2(&from->cs);
+    lock_guard lk(get_lock());
+    lock_guard lk2(from->get_lock());
     size_t count = 0;
-    T data;
 
-    while (!is_full_without_lock() && from->dequeue_signle_without_lock(&data)) {
-        enqueue_signle_without_lock(&data);
-        count++;
+    // Both sides wrap at most once, so this copies in at most three segments.
+    while (true) {
+        T *dst;
+        const T *src;
+        const auto len = std::min(write_span_without_lock(&dst), from->read_span_without_lock(&src));
+        if (len == 0) {break;}
+
+        memcpy(dst, src, len * sizeof(T));
+        write_ptr.store(wrap(write_ptr.load(std::memory_order_relaxed) + len), std::memory_order_release);
+        from->read_ptr.store(from->wrap(from->read_ptr.load(std::memory_order_relaxed) + len), std::memory_order_release);
+        count += len;
     }
+    update_high_water_mark(count_without_lock());
 
     return count;
 }
 
-template <typename T>
-void ring_buffer<T>::clear(void)
+template <typename T, size_t capacity, bool spsc>
+void ring_buffer<T, capacity, spsc>::clear(void)
 {
-    lock_guard lk(&cs);
+    lock_guard lk(get_lock());
 
-    read_ptr = write_ptr;
+    read_ptr.store(write_ptr.load(std::memory_order_acquire), std::memory_order_release);
 }
 
-template <typename T>
-bool ring_buffer<T>::find(const T marker, size_t *length)
+template <typename T, size_t capacity, bool spsc>
+bool ring_buffer<T, capacity, spsc>::find(const T marker, size_t *length)
 {
-    lock_guard lk(&cs);
+    lock_guard lk(get_lock());
 
-    for (auto ptr = read_ptr; ptr != write_ptr; ptr = (ptr + 1) % buffer_size) {
+    const auto r = read_ptr.load(std::memory_order_relaxed);
+    const auto w = write_ptr.load(std::memory_order_acquire);
+    for (auto ptr = r; ptr != w; ptr = wrap(ptr + 1)) {
         if (buffer[ptr] == marker) {
-            *length = (buffer_size + ptr - read_ptr + 1) % buffer_size;
+            *length = wrap(buffer_size + ptr - r + 1);
             return true;
         }
     }
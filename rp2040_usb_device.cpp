@@ -7,6 +7,7 @@
 #include "hardware/structs/usb.h"
 #include "hardware/irq.h"
 #include "hardware/resets.h"
+#include "hardware/sync.h"
 
 #include "usb_struct.h"
 #include "rp2040_usb_device.h"
@@ -14,30 +15,11 @@
 rp2040_usb_device *rp2040_usb_device::instance = nullptr;
 
 void rp2040_usb_device::bus_reset() {
-    this->printf("BUS_RESET\r\n");
+    this->trace(USB_TRACE_EVENT_BUS_RESET, 0, 0);
     usb_hw->dev_addr_ctrl = 0;
     configured = false;
 }
 
-void rp2040_usb_device::dump_hex_and_ascii(const void *data, const size_t length)
-{
-    const uint8_t *c = reinterpret_cast<const uint8_t *>(data);
-    for (size_t offset = 0; offset < length; offset += 16) {
-        this->printf("  %04lx: ", offset);
-        for (size_t p = 0; p < 16; p++) {
-            if (offset + p < length) {
-                this->printf("%02x ", c[offset + p]);
-            } else {
-                this->printf("   ");
-            }
-        }
-        for (size_t p = 0; p < 16 && offset + p < length; p++) {
-            this->printf("%c", isprint(c[offset + p]) ? c[offset + p] : '.');
-        }
-        this->printf("\r\n");
-    }
-}
-
 void rp2040_usb_device::_irq_handler_usbctrl(void) {
     instance->irq_handler_usbctrl();
 }
@@ -58,23 +40,41 @@ uint32_t rp2040_usb_device::get_ep_pid(const uint8_t ep_addr)
 
 void rp2040_usb_device::transmit(const uint8_t ep_addr, const void *data, const int len)
 {
-    this->printf("transmit ep_addr[0x%02x], length: %d\r\n", ep_addr, len);
-
     if (len > 0) {
-        memcpy(get_usb_ep_buf_ptr(ep_addr), data, len);
-        dump_hex_and_ascii(data, len);
+        memcpy(get_ep_buf(ep_addr), data, len);
     }
 
-    const uint32_t val = USB_BUF_CTRL_AVAIL | USB_BUF_CTRL_FULL | get_ep_pid(ep_addr) | len;
+    submit(ep_addr, len);
+}
+
+void rp2040_usb_device::submit(const uint8_t ep_addr, const int len)
+{
+    this->trace(USB_TRACE_EVENT_TRANSMIT, ep_addr, len);
 
-    *(get_usb_ep_buf_ctrl_ptr(ep_addr)) = val;
+    const uint16_t val = USB_BUF_CTRL_AVAIL | USB_BUF_CTRL_FULL | get_ep_pid(ep_addr) | len;
+
+    *(get_usb_ep_buf_ctrl_half_ptr(ep_addr, next_buf_id(ep_addr))) = val;
 }
 
 void rp2040_usb_device::receive(const uint8_t ep_addr, const int max_len)
 {
-    uint32_t val = USB_BUF_CTRL_AVAIL | get_ep_pid(ep_addr) | max_len;
+    const uint16_t val = USB_BUF_CTRL_AVAIL | get_ep_pid(ep_addr) | max_len;
 
-    *(get_usb_ep_buf_ctrl_ptr(ep_addr)) = val;
+    *(get_usb_ep_buf_ctrl_half_ptr(ep_addr, next_buf_id(ep_addr))) = val;
+}
+
+// Buffers are handed to the controller alternately and it processes them in
+// the same order, so the DATA0/DATA1 sequence from get_ep_pid() follows them.
+uint8_t rp2040_usb_device::next_buf_id(const uint8_t ep_addr)
+{
+    const auto idx = get_usb_ep_index(ep_addr);
+    const auto buf_id = ep_next_buf_id[idx];
+
+    if (ep_double_buffered[idx]) {
+        ep_next_buf_id[idx] ^= 1;
+    }
+
+    return buf_id;
 }
 
 void rp2040_usb_device::handle_setup_packet(const volatile struct usb_setup_packet *_pkt)
@@ -86,12 +86,7 @@ void rp2040_usb_device::handle_setup_packet(const volatile struct usb_setup_pack
     pkt.wIndex = _pkt->wIndex;
     pkt.wLength = _pkt->wLength;
     last_setup_packet = pkt;
-    this->printf("Setup packet\r\n");
-    this->printf("  bmRequestType: 0x%02x\r\n", pkt.bmRequestType);
-    this->printf("  bRequest: 0x%02x\r\n", pkt.bRequest);
-    this->printf("  wValue: 0x%04x\r\n", pkt.wValue);
-    this->printf("  wIndex: 0x%04x\r\n", pkt.wIndex);
-    this->printf("  wLength: 0x%04x\r\n", pkt.wLength);
+    this->trace(USB_TRACE_EVENT_SETUP, (pkt.bmRequestType << 8) | pkt.bRequest, (pkt.wValue << 16) | pkt.wIndex);
 
     ep_next_pid[get_usb_ep_index(USB_ENDPOINT_CONTROL_IN)] = DATA_PID::DATA1;
 
@@ -136,12 +131,12 @@ void rp2040_usb_device::handle_buff_status(void)
     for (int idx = 0; idx < 32; bit <<= 1, idx++) {
         if ((buf_status & bit) == 0) {continue;}
         const auto ep_addr = get_usb_ep_addr_by_index(idx);
-        const auto buf = get_usb_ep_buf_ptr(ep_addr);
-        const auto len = *(get_usb_ep_buf_ctrl_ptr(ep_addr)) & USB_BUF_CTRL_LEN_MASK;
+        const uint8_t buf_id = (ep_double_buffered[idx] && (usb_hw->buf_cpu_should_handle & bit)) ? 1 : 0;
+        const auto buf = get_usb_ep_buf_ptr(ep_addr, buf_id);
+        const auto len = *(get_usb_ep_buf_ctrl_half_ptr(ep_addr, buf_id)) & USB_BUF_CTRL_LEN_MASK;
 
         if (is_dir_out(ep_addr)) {
-            this->printf("received ep_addr[0x%02x], length: %d\r\n", ep_addr, len);
-            dump_hex_and_ascii(buf, len);
+            this->trace(USB_TRACE_EVENT_RECEIVED, ep_addr, len);
         }
 
         if (transferred_callback[idx] != nullptr) {
@@ -171,6 +166,9 @@ void rp2040_usb_device::irq_handler_usbctrl(void)
     }
 
     irq_clear(USBCTRL_IRQ);
+
+    // Wake the main loop if it is waiting for an event
+    __sev();
 }
 
 int rp2040_usb_device::_dummy_printf(const char *fmt, ...)
@@ -178,7 +176,11 @@ int rp2040_usb_device::_dummy_printf(const char *fmt, ...)
     return 0;
 }
 
-rp2040_usb_device::rp2040_usb_device(int (*printf)(const char *fmt, ...))
+void rp2040_usb_device::_dummy_trace(const uint8_t event, const uint16_t arg0, const uint32_t arg1)
+{
+}
+
+rp2040_usb_device::rp2040_usb_device(int (*printf)(const char *fmt, ...), void (*trace)(const uint8_t event, const uint16_t arg0, const uint32_t arg1))
 {
     if (printf != nullptr) {
         this->printf = printf;
@@ -186,11 +188,20 @@ rp2040_usb_device::rp2040_usb_device(int (*printf)(const char *fmt, ...))
         this->printf = _dummy_printf;
     }
 
+    if (trace != nullptr) {
+        this->trace = trace;
+    } else {
+        this->trace = _dummy_trace;
+    }
+
     for (int i = 0; i < 32; i++) {
         transferred_callback[i] = nullptr;
+        ep_double_buffered[i] = false;
+        ep_next_buf_id[i] = 0;
     }
     transferred_callback[get_usb_ep_index(USB_ENDPOINT_CONTROL_IN)] = _ep0_in_transferred_callback;
     configured = false;
+    ep0_stall_count = 0;
 }
 
 bool rp2040_usb_device::init(void)
@@ -230,13 +241,21 @@ void rp2040_usb_device::set_setup_packet_callback(bool (*setup_packet_callback)(
     this->setup_packet_callback = setup_packet_callback;
 }
 
-void rp2040_usb_device::apply_endpoint_configuration(const struct usb_endpoint_descriptor *ep_desc, void (*transferred_callback)(const void *data, const int len))
+void rp2040_usb_device::apply_endpoint_configuration(const struct usb_endpoint_descriptor *ep_desc, void (*transferred_callback)(const void *data, const int len), const bool double_buffered)
 {
     const auto ep_addr = ep_desc->bEndpointAddress;
+    const auto idx = get_usb_ep_index(ep_addr);
     const auto ep_buf_offset = reinterpret_cast<uintptr_t>(get_usb_ep_buf_ptr(ep_addr)) - reinterpret_cast<uintptr_t>(usb_dpram);
-    const uint32_t val = EP_CTRL_ENABLE_BITS | EP_CTRL_INTERRUPT_PER_BUFFER | (ep_desc->bmAttributes << EP_CTRL_BUFFER_TYPE_LSB) | ep_buf_offset;
-    this->transferred_callback[get_usb_ep_index(ep_addr)] = transferred_callback;
-    ep_next_pid[get_usb_ep_index(ep_addr)] = DATA_PID::DATA0;
+    uint32_t val = EP_CTRL_ENABLE_BITS | EP_CTRL_INTERRUPT_PER_BUFFER | (ep_desc->bmAttributes << EP_CTRL_BUFFER_TYPE_LSB) | ep_buf_offset;
+    if (double_buffered) {
+        // Buffer 1 follows buffer 0 at +64 bytes
+        val |= EP_CTRL_DOUBLE_BUFFERED_BITS;
+    }
+    this->transferred_callback[idx] = transferred_callback;
+    ep_next_pid[idx] = DATA_PID::DATA0;
+    ep_double_buffered[idx] = double_buffered;
+    ep_next_buf_id[idx] = 0;
+    *(get_usb_ep_buf_ctrl_ptr(ep_addr)) = double_buffered ? USB_BUF_CTRL_SEL : 0; // start from buffer 0
     *(get_usb_ep_ctrl_ptr(ep_addr)) = val;
 }
 
@@ -265,13 +284,36 @@ void rp2040_usb_device::ep_read(const int ep_addr, const int max_len)
     receive(ep_addr, max_len);
 }
 
+void *rp2040_usb_device::get_ep_buf(const int ep_addr)
+{
+    return get_usb_ep_buf_ptr(ep_addr, ep_next_buf_id[get_usb_ep_index(ep_addr)]);
+}
+
+void rp2040_usb_device::ep_commit(const int ep_addr, const int len)
+{
+    submit(ep_addr, len);
+}
+
+// For a double-buffered endpoint this is true only when both buffers are in flight
 bool rp2040_usb_device::is_ep_buf_full(const int ep_addr)
 {
-    return *(get_usb_ep_buf_ctrl_ptr(ep_addr)) & USB_BUF_CTRL_FULL;
+    return *(get_usb_ep_buf_ctrl_half_ptr(ep_addr, ep_next_buf_id[get_usb_ep_index(ep_addr)])) & USB_BUF_CTRL_FULL;
+}
+
+// Buffers handed to the controller that have not been transferred yet
+int rp2040_usb_device::get_ep_bufs_in_flight(const int ep_addr)
+{
+    int count = (*(get_usb_ep_buf_ctrl_half_ptr(ep_addr, 0)) & USB_BUF_CTRL_FULL) ? 1 : 0;
+    if (ep_double_buffered[get_usb_ep_index(ep_addr)] && (*(get_usb_ep_buf_ctrl_half_ptr(ep_addr, 1)) & USB_BUF_CTRL_FULL)) {
+        count++;
+    }
+
+    return count;
 }
 
 void rp2040_usb_device::ep0_stall(void)
 {
+    ep0_stall_count++;
     if (is_dir_out(last_setup_packet.bmRequestType)) {
         usb_hw->ep_stall_arm |= 0x02;
         *(get_usb_ep_buf_ctrl_ptr(USB_ENDPOINT_CONTROL_OUT)) |= USB_BUF_CTRL_STALL;
@@ -1,4 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "hardware/structs/usb.h"
+
 #include "usb_struct.h"
+#include "rp2040_usb_trace.h"
 
 enum class DATA_PID : uint8_t {
     DATA0 = 0,
@@ -10,6 +18,7 @@ class rp2040_usb_device
     private:
         static rp2040_usb_device *instance;
         static int _dummy_printf(const char *fmt, ...);
+        static void _dummy_trace(const uint8_t event, const uint16_t arg0, const uint32_t arg1);
         static void _irq_handler_usbctrl(void);
         static void _ep0_in_transferred_callback(const void *data, const int len);
 
@@ -33,42 +42,56 @@ class rp2040_usb_device
             auto *ep_ctrl = &usb_dpram->ep_ctrl[get_usb_ep_num(ep_addr) - 1];
             return is_dir_out(ep_addr) ? &ep_ctrl->out : &ep_ctrl->in;
         }
-        void *get_usb_ep_buf_ptr(uint8_t ep_addr)
+        volatile uint16_t *get_usb_ep_buf_ctrl_half_ptr(uint8_t ep_addr, uint8_t buf_id)
+        {
+            return reinterpret_cast<volatile uint16_t *>(get_usb_ep_buf_ctrl_ptr(ep_addr)) + buf_id;
+        }
+        // Each endpoint gets 128 bytes (two 64-byte buffers) in epx_data, which covers EP1-EP14
+        void *get_usb_ep_buf_ptr(uint8_t ep_addr, uint8_t buf_id = 0)
         {
             return is_control(ep_addr)
                 ? reinterpret_cast<void *>(usb_dpram->ep0_buf_a)
-                : reinterpret_cast<void *>(&usb_dpram->epx_data[(get_usb_ep_index(ep_addr) - 2) * 64]);
+                : reinterpret_cast<void *>(&usb_dpram->epx_data[(get_usb_ep_index(ep_addr) - 2) * 128 + buf_id * 64]);
         }
         void clear_sie_status(uint32_t clear_bit) {hw_clear_alias(usb_hw)->sie_status = clear_bit;}
 
         DATA_PID ep_next_pid[32];
+        bool ep_double_buffered[32];
+        uint8_t ep_next_buf_id[32]; // buffer to fill (IN) or arm (OUT) next
 
         struct usb_setup_packet last_setup_packet;
         bool configured;
+        uint32_t ep0_stall_count;
 
         bool (*setup_packet_callback)(const struct usb_setup_packet *pkt);
         void (*transferred_callback[32])(const void *data, const int len);
 
-        void dump_hex_and_ascii(const void *data, const size_t length);
         void bus_reset(void);
         void ep0_in_transferred_callback(const void *data, const int len);
         void irq_handler_usbctrl(void);
         void transmit(const uint8_t ep_addr, const void *data, const int len);
+        void submit(const uint8_t ep_addr, const int len);
         void receive(const uint8_t ep_addr, const int max_len);
         void handle_setup_packet(const volatile struct usb_setup_packet *pkt);
         void handle_buff_status();
         uint32_t get_ep_pid(const uint8_t ep_addr);
+        uint8_t next_buf_id(const uint8_t ep_addr);
         int (*printf)(const char *fmt, ...);
+        void (*trace)(const uint8_t event, const uint16_t arg0, const uint32_t arg1);
     public:
-        rp2040_usb_device(int (*printf)(const char *fmt, ...) = nullptr);
+        rp2040_usb_device(int (*printf)(const char *fmt, ...) = nullptr, void (*trace)(const uint8_t event, const uint16_t arg0, const uint32_t arg1) = nullptr);
         bool init(void);
         void set_setup_packet_callback(bool (*setup_packet_callback)(const struct usb_setup_packet *pkt));
-        void apply_endpoint_configuration(const struct usb_endpoint_descriptor *ep_desc, void (*transferred_callback)(const void *data, const int len));
+        void apply_endpoint_configuration(const struct usb_endpoint_descriptor *ep_desc, void (*transferred_callback)(const void *data, const int len), const bool double_buffered = false);
         bool is_configured(void);
         void configure(void);
         void ep0_write(const void *data, const int len);
         void ep_write(const int ep_num, const void *data, const int len);
         void ep_read(const int ep_num, const int max_len);
+        void *get_ep_buf(const int ep_addr);
+        void ep_commit(const int ep_addr, const int len);
         bool is_ep_buf_full(const int ep_addr);
+        int get_ep_bufs_in_flight(const int ep_addr);
         void ep0_stall(void);
+        uint32_t get_ep0_stall_count(void) {return ep0_stall_count;}
 };
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+
+// Events rp2040_usb_device passes to its trace callback. An application
+// tracing other events too numbers its own from USB_TRACE_EVENT_NUM on.
+enum USB_TRACE_EVENT : uint8_t {
+    USB_TRACE_EVENT_BUS_RESET, // -
+    USB_TRACE_EVENT_SETUP,     // arg0: bmRequestType << 8 | bRequest, arg1: wValue << 16 | wIndex
+    USB_TRACE_EVENT_TRANSMIT,  // arg0: ep_addr, arg1: length
+    USB_TRACE_EVENT_RECEIVED,  // arg0: ep_addr, arg1: length
+    USB_TRACE_EVENT_NUM,
+};
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 #include "lock.h"
 
 template <typename T>
@@ -7,6 +9,7 @@ class state_ctrl {
     private:
         critical_section_t cs;
         T state;
+        uint32_t transitions;
     public:
         state_ctrl(const T initial);
         ~state_ctrl();
@@ -14,6 +17,7 @@ class state_ctrl {
         bool is_state (const T state);
         bool transition(const T current_state, const T next_state);
         void force_transition(const T next_state);
+        uint32_t get_transition_count() {return transitions;}
 };
 
 template <typename T>
@@ -21,6 +25,7 @@ state_ctrl<T>::state_ctrl(const T initial)
 {
     critical_section_init(&cs);
     state = initial;
+    transitions = 0;
 }
 
 template <typename T>
@@ -52,6 +57,7 @@ bool state_ctrl<T>::transition(const T current_state, const T next_state)
 
     if (state == current_state) {
         state = next_state;
+        transitions++;
         return true;
     }
 
@@ -63,5 +69,6 @@ void state_ctrl<T>::force_transition(const T next_state)
 {
     lock_guard lk(&cs);
 
+    if (state != next_state) {transitions++;}
     state = next_state;
 }
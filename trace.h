@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+#include "hardware/sync.h"
+#include "pico/platform.h"
+#include "pico/time.h"
+
+#include "ring_buffer.h"
+#include "rp2040_usb_trace.h"
+
+// The USB events are the driver's own (rp2040_usb_trace.h)
+enum TRACE_EVENT : uint8_t {
+    TRACE_EVENT_USB_BUS_RESET = USB_TRACE_EVENT_BUS_RESET,
+    TRACE_EVENT_USB_SETUP = USB_TRACE_EVENT_SETUP,
+    TRACE_EVENT_USB_TRANSMIT = USB_TRACE_EVENT_TRANSMIT,
+    TRACE_EVENT_USB_RECEIVED = USB_TRACE_EVENT_RECEIVED,
+    TRACE_EVENT_ON_HOOK = USB_TRACE_EVENT_NUM,
+    TRACE_EVENT_OFF_HOOK,       // -
+    TRACE_EVENT_RING,           // -
+    TRACE_EVENT_CONNECTING,     // arg0: port, arg1: IPv4 address
+    TRACE_EVENT_CONNECTED,      // -
+    TRACE_EVENT_CONNECT_FAILED, // -
+    TRACE_EVENT_DISCONNECTED,   // -
+    TRACE_EVENT_NET_READ,       // arg1: length
+    TRACE_EVENT_NET_WRITE,      // arg1: length
+    TRACE_EVENT_NUM,
+};
+
+struct trace_record {
+    uint32_t time_us;
+    uint8_t core;
+    uint8_t event;
+    uint16_t arg0;
+    uint32_t arg1;
+};
+
+// Fixed-size binary trace records, one lock-free ring per core. Writers on a
+// core (loop and IRQs) only mask local interrupts for the enqueue; the
+// drainer formats records to text later, outside the hot path.
+template <size_t N = 256>
+class tracer
+{
+    private:
+        spsc_ring_buffer<trace_record, N> rings[2];
+        uint32_t dropped[2];
+    public:
+        tracer();
+        void record(const uint8_t event, const uint16_t arg0 = 0, const uint32_t arg1 = 0);
+        bool pop(trace_record *rec);
+        uint32_t get_dropped(void) {return dropped[0] + dropped[1];}
+        static int format(const trace_record *rec, char *buf, size_t len);
+};
+
+template <size_t N>
+tracer<N>::tracer()
+{
+    dropped[0] = 0;
+    dropped[1] = 0;
+}
+
+template <size_t N>
+void tracer<N>::record(const uint8_t event, const uint16_t arg0, const uint32_t arg1)
+{
+    const auto core = get_core_num();
+    const trace_record rec = {time_us_32(), static_cast<uint8_t>(core), event, arg0, arg1};
+
+    const auto irq_status = save_and_disable_interrupts();
+    if (rings[core].enqueue(&rec, 1) == 0) {
+        dropped[core]++;
+    }
+    restore_interrupts(irq_status);
+}
+
+// Oldest record of both cores; only one context may drain
+template <size_t N>
+bool tracer<N>::pop(trace_record *rec)
+{
+    const trace_record *head[2];
+    const bool has[2] = {rings[0].peek_read_span(&head[0]) > 0, rings[1].peek_read_span(&head[1]) > 0};
+
+    if (!has[0] && !has[1]) {return false;}
+
+    int core;
+    if (has[0] && has[1]) {
+        core = static_cast<int32_t>(head[1]->time_us - head[0]->time_us) < 0 ? 1 : 0;
+    } else {
+        core = has[0] ? 0 : 1;
+    }
+
+    *rec = *head[core];
+    rings[core].consume(1);
+
+    return true;
+}
+
+template <size_t N>
+int tracer<N>::format(const trace_record *rec, char *buf, size_t len)
+{
+    static const char *const names[TRACE_EVENT_NUM] = {
+        "usb_bus_reset",
+        "usb_setup",
+        "usb_transmit",
+        "usb_received",
+        "on_hook",
+        "off_hook",
+        "ring",
+        "connecting",
+        "connected",
+        "connect_failed",
+        "disconnected",
+        "net_read",
+        "net_write",
+    };
+    const char *name = rec->event < TRACE_EVENT_NUM ? names[rec->event] : "unknown";
+
+    return snprintf(buf, len, "%10lu %u %-14s %04x %08lx\r\n",
+        static_cast<unsigned long>(rec->time_us), rec->core, name, rec->arg0, static_cast<unsigned long>(rec->arg1));
+}
@@ -0,0 +1,425 @@
+#include <algorithm>
+#include <string.h>
+
+#include <Arduino.h>
+
+#include "udp_transport.h"
+
+static_assert(udp_transport::WINDOW <= 16, "the SACK bitmap is 16 bits");
+static_assert(udp_transport::SEGMENT_SIZE <= UINT8_MAX, "segment lengths are 8 bits");
+
+static uint16_t get_uint16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static void put_uint16(uint8_t *p, const uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xff;
+}
+
+udp_transport::udp_transport(const uint8_t redundancy)
+{
+    this->redundancy = redundancy;
+    current = status::Closed;
+    peer_port = 0;
+    session = 0;
+    connect_time_ms = 0;
+    connect_timeout_ms = 0;
+    out_len = 0;
+    retransmit_count = 0;
+    duplicate_count = 0;
+    reset_session();
+}
+
+void udp_transport::reset_session(void)
+{
+    snd_una = snd_sent = snd_nxt = 0;
+    peer_limit = WINDOW;
+    delivered_time_us = micros();
+    srtt_us = 0;
+    rttvar_us = 0;
+    rto_us = INITIAL_RTO_US;
+
+    for (auto &slot : rx_segments) {
+        slot.present = false;
+    }
+    rcv_read = rcv_nxt = 0;
+    rcv_offset = 0;
+    advertised_window = WINDOW;
+    ack_pending = false;
+
+    last_recv_ms = last_send_ms = millis();
+}
+
+// Open the socket on port and wait for calls
+bool udp_transport::begin(const uint16_t port)
+{
+    if (udp.begin(port) == 0) {return false;}
+
+    reset_session();
+    current = status::Listening;
+
+    return true;
+}
+
+void udp_transport::stop(void)
+{
+    if (current == status::Closed) {return;}
+
+    close();
+    udp.stop();
+    current = status::Closed;
+}
+
+// SYN is repeated every SYN_INTERVAL_MS until the peer answers or timeout_ms passes
+void udp_transport::connect(const IPAddress &ip_addr, const uint16_t port, const unsigned long timeout_ms)
+{
+    reset_session();
+    peer_ip = ip_addr;
+    peer_port = port;
+    session = (micros() & 0xffff) | 1; // tells a new call from stray packets of an old one
+    current = status::Connecting;
+    connect_time_ms = millis();
+    connect_timeout_ms = timeout_ms;
+
+    send_control(PACKET_SYN, peer_ip, peer_port, session);
+    last_send_ms = connect_time_ms;
+}
+
+// Take the incoming call; the caller learns it is connected from SYN_ACK
+bool udp_transport::accept(void)
+{
+    if (current != status::Incoming) {return false;}
+
+    current = status::Connected;
+    send_control(PACKET_SYN_ACK, peer_ip, peer_port, session);
+    last_recv_ms = last_send_ms = millis();
+
+    return true;
+}
+
+// End the session (refusing it when still Incoming) and go back to listening.
+// FIN is sent once; if it is lost the peer notices the silence instead. A
+// caller that timed out sends it too: the callee may have taken the SYN even
+// though none of its answers came through, and would otherwise keep ringing.
+void udp_transport::close(void)
+{
+    if (current == status::Closed) {return;}
+
+    if (current == status::Incoming || current == status::Connecting || current == status::Connected || current == status::TimedOut) {
+        send_control(PACKET_FIN, peer_ip, peer_port, session);
+    }
+    reset_session();
+    current = status::Listening;
+}
+
+void udp_transport::send_control(const packet_type type, const IPAddress &ip_addr, const uint16_t port, const uint16_t session)
+{
+    uint8_t msg[HEADER_SIZE] = {MAGIC, type};
+    put_uint16(&msg[2], session);
+    msg[8] = WINDOW;
+
+    udp.beginPacket(ip_addr, port);
+    udp.write(msg, sizeof(msg));
+    udp.endPacket();
+}
+
+// Start a DATA datagram carrying the current ACK state
+void udp_transport::begin_datagram(void)
+{
+    uint16_t sack = 0;
+    for (int i = 0; i < WINDOW; i++) {
+        const uint16_t seq = rcv_nxt + 1 + i;
+        if (seq_diff(seq, rcv_read) >= WINDOW) {break;}
+        if (rx_segments[seq % WINDOW].present) {sack |= 1 << i;}
+    }
+    advertised_window = WINDOW - seq_diff(rcv_nxt, rcv_read);
+
+    out[0] = MAGIC;
+    out[1] = PACKET_DATA;
+    put_uint16(&out[2], session);
+    put_uint16(&out[4], rcv_nxt);
+    put_uint16(&out[6], sack);
+    out[8] = advertised_window;
+    out_len = HEADER_SIZE;
+}
+
+void udp_transport::append_segment(const uint16_t seq)
+{
+    const auto &seg = tx_segments[seq % WINDOW];
+    if (out_len + SEGMENT_HEADER_SIZE + seg.len > sizeof(out)) {
+        send_datagram();
+        begin_datagram();
+    }
+
+    put_uint16(&out[out_len], seq);
+    out[out_len + 2] = seg.len;
+    memcpy(&out[out_len + SEGMENT_HEADER_SIZE], seg.data, seg.len);
+    out_len += SEGMENT_HEADER_SIZE + seg.len;
+}
+
+void udp_transport::send_datagram(void)
+{
+    udp.beginPacket(peer_ip, peer_port);
+    udp.write(out, out_len);
+    udp.endPacket();
+
+    out_len = 0;
+    last_send_ms = millis();
+    ack_pending = false;
+}
+
+void udp_transport::update_rtt(const uint32_t sample_us)
+{
+    if (srtt_us == 0) {
+        srtt_us = sample_us;
+        rttvar_us = sample_us / 2;
+    } else {
+        const auto error = srtt_us > sample_us ? srtt_us - sample_us : sample_us - srtt_us;
+        rttvar_us = rttvar_us - rttvar_us / 4 + error / 4;
+        srtt_us = srtt_us - srtt_us / 8 + sample_us / 8;
+    }
+    // The variance term is floored so that a steady link does not fire on jitter
+    rto_us = std::min(srtt_us + std::max(4 * rttvar_us, MIN_RTO_US), MAX_RTO_US);
+}
+
+void udp_transport::process_ack(const uint16_t ack, const uint16_t sack, const uint8_t window)
+{
+    // Older than what we know (reordered) or acknowledging data never sent
+    if (seq_diff(ack, snd_una) < 0 || seq_diff(ack, snd_sent) > 0) {return;}
+
+    const auto now_us = micros();
+    auto delivered = [this, now_us](tx_segment &seg) {
+        // Karn: a retransmitted segment gives no RTT sample
+        if (seg.retransmits == 0 && !seg.sacked) {update_rtt(now_us - seg.sent_time_us);}
+        if (static_cast<int32_t>(seg.sent_time_us - delivered_time_us) > 0) {delivered_time_us = seg.sent_time_us;}
+    };
+
+    for (; snd_una != ack; snd_una++) {
+        delivered(tx_segments[snd_una % WINDOW]);
+    }
+    for (int i = 0; i < WINDOW; i++) {
+        const uint16_t seq = ack + 1 + i;
+        if (seq_diff(seq, snd_sent) >= 0) {break;}
+        auto &seg = tx_segments[seq % WINDOW];
+        if ((sack & (1 << i)) == 0 || seg.sacked) {continue;}
+        delivered(seg);
+        seg.sacked = true;
+    }
+
+    peer_limit = ack + std::min(window, static_cast<uint8_t>(WINDOW));
+}
+
+void udp_transport::process_segment(const uint16_t seq, const uint8_t *data, const uint8_t len)
+{
+    // Every segment is answered at once, duplicates included since they may
+    // mean our ACK was lost: latency matters more than the extra datagrams
+    ack_pending = true;
+
+    const auto offset = seq_diff(seq, rcv_read);
+    if (offset >= WINDOW) {return;} // no room, the peer sends it again
+    auto &slot = rx_segments[seq % WINDOW];
+    if (offset < 0 || seq_diff(seq, rcv_nxt) < 0 || slot.present) {
+        duplicate_count++;
+        return;
+    }
+
+    memcpy(slot.data, data, len);
+    slot.len = len;
+    slot.present = true;
+    while (seq_diff(rcv_nxt, rcv_read) < WINDOW && rx_segments[rcv_nxt % WINDOW].present) {
+        rcv_nxt++;
+    }
+}
+
+void udp_transport::process_datagram(const uint8_t *msg, const size_t len)
+{
+    if (len < HEADER_SIZE || msg[0] != MAGIC) {return;}
+
+    const auto from_ip = udp.remoteIP();
+    const auto from_port = udp.remotePort();
+    const auto from_session = get_uint16(&msg[2]);
+    const auto from_peer = current != status::Listening && from_ip == peer_ip && from_port == peer_port && from_session == session;
+
+    switch (msg[1]) {
+        case PACKET_SYN:
+            if (current == status::Listening) {
+                reset_session();
+                peer_ip = from_ip;
+                peer_port = from_port;
+                session = from_session;
+                current = status::Incoming;
+            } else if (from_peer && current == status::Connected) {
+                send_control(PACKET_SYN_ACK, peer_ip, peer_port, session); // ours was lost
+            } else if (!from_peer) {
+                send_control(PACKET_FIN, from_ip, from_port, from_session); // line busy
+            }
+            break;
+        case PACKET_SYN_ACK:
+            if (from_peer && current == status::Connecting) {
+                current = status::Connected;
+                last_recv_ms = millis();
+            }
+            break;
+        case PACKET_FIN:
+            if (!from_peer) {break;}
+            if (current == status::Connecting) {
+                current = status::Refused;
+            } else if (current == status::Incoming || current == status::Connected) {
+                current = status::Disconnected;
+            }
+            break;
+        case PACKET_DATA:
+            if (!from_peer) {break;}
+            // Data before SYN_ACK: the SYN_ACK was lost but the call was taken
+            if (current == status::Connecting) {current = status::Connected;}
+            if (current != status::Connected) {break;}
+            last_recv_ms = millis();
+            process_ack(get_uint16(&msg[4]), get_uint16(&msg[6]), msg[8]);
+            for (size_t pos = HEADER_SIZE; pos + SEGMENT_HEADER_SIZE <= len;) {
+                const auto seq = get_uint16(&msg[pos]);
+                const auto seg_len = msg[pos + 2];
+                pos += SEGMENT_HEADER_SIZE;
+                if (seg_len > SEGMENT_SIZE || pos + seg_len > len) {break;}
+                if (seg_len > 0) {process_segment(seq, &msg[pos], seg_len);}
+                pos += seg_len;
+            }
+            break;
+    }
+}
+
+// Handle every datagram waiting in the socket
+void udp_transport::receive(void)
+{
+    if (current == status::Closed) {return;}
+
+    while (udp.parsePacket() > 0) {
+        uint8_t msg[DATAGRAM_SIZE];
+        const auto len = udp.read(msg, sizeof(msg));
+        if (len > 0) {process_datagram(msg, len);}
+    }
+}
+
+// Send whatever is due: SYN retries, retransmissions, new data, ACKs and keepalives
+void udp_transport::flush(void)
+{
+    const auto now_ms = millis();
+    if (current == status::Connecting) {
+        if (now_ms - connect_time_ms >= connect_timeout_ms) {
+            current = status::TimedOut;
+        } else if (now_ms - last_send_ms >= SYN_INTERVAL_MS) {
+            send_control(PACKET_SYN, peer_ip, peer_port, session);
+            last_send_ms = now_ms;
+        }
+        return;
+    }
+    if (current != status::Connected) {return;}
+    if (now_ms - last_recv_ms >= LINK_TIMEOUT_MS) {
+        current = status::Disconnected;
+        return;
+    }
+
+    const auto now_us = micros();
+    out_len = 0;
+
+    // Segments whose timer expired, or that a later segment overtook
+    const auto reorder_us = std::max(srtt_us / 4, MIN_REORDER_US);
+    bool backoff = false;
+    for (uint16_t seq = snd_una; seq != snd_sent; seq++) {
+        auto &seg = tx_segments[seq % WINDOW];
+        if (seg.sacked) {continue;}
+        const auto overtaken = static_cast<int32_t>(delivered_time_us - seg.sent_time_us) > static_cast<int32_t>(reorder_us);
+        const auto timed_out = now_us - seg.sent_time_us >= rto_us;
+        if (!overtaken && !timed_out) {continue;}
+        if (seg.retransmits >= MAX_RETRANSMITS) {
+            current = status::Disconnected;
+            return;
+        }
+        if (!overtaken) {backoff = true;}
+        seg.retransmits++;
+        seg.sent_time_us = now_us;
+        retransmit_count++;
+        if (out_len == 0) {begin_datagram();}
+        append_segment(seq);
+    }
+    if (backoff) {rto_us = std::min(rto_us * 2, MAX_RTO_US);}
+
+    if (snd_sent != snd_nxt && seq_diff(snd_sent, peer_limit) < 0) {
+        if (out_len == 0) {begin_datagram();}
+
+        // Repeat the newest segments still in flight, unless already resent above
+        const auto in_flight = static_cast<uint16_t>(snd_sent - snd_una);
+        for (uint16_t seq = snd_sent - std::min(static_cast<uint16_t>(redundancy), in_flight); seq != snd_sent; seq++) {
+            const auto &seg = tx_segments[seq % WINDOW];
+            if (!seg.sacked && seg.sent_time_us != now_us) {append_segment(seq);}
+        }
+
+        while (snd_sent != snd_nxt && seq_diff(snd_sent, peer_limit) < 0) {
+            tx_segments[snd_sent % WINDOW].sent_time_us = now_us;
+            append_segment(snd_sent++);
+        }
+    }
+
+    if (out_len == 0 && (ack_pending || now_ms - last_send_ms >= KEEPALIVE_MS)) {begin_datagram();}
+    if (out_len > 0) {send_datagram();}
+}
+
+int udp_transport::read(char *buf, const size_t max_len)
+{
+    size_t n = 0;
+    while (n < max_len && rcv_read != rcv_nxt) {
+        auto &slot = rx_segments[rcv_read % WINDOW];
+        const auto len = std::min(max_len - n, static_cast<size_t>(slot.len - rcv_offset));
+        memcpy(buf + n, slot.data + rcv_offset, len);
+        n += len;
+        rcv_offset += len;
+        if (rcv_offset == slot.len) {
+            slot.present = false;
+            rcv_read++;
+            rcv_offset = 0;
+        }
+    }
+
+    // A peer that was running out of window hears about the room at once
+    if (n > 0 && advertised_window < WINDOW / 2) {ack_pending = true;}
+
+    return n;
+}
+
+// Copies into the segment being filled and new ones while the window allows;
+// flush() sends them
+int udp_transport::write(const char *buf, const size_t len)
+{
+    if (current != status::Connected) {return 0;}
+
+    size_t n = 0;
+    while (n < len) {
+        if (snd_nxt != snd_sent) {
+            auto &seg = tx_segments[static_cast<uint16_t>(snd_nxt - 1) % WINDOW];
+            if (seg.len < SEGMENT_SIZE) {
+                const auto copy_len = std::min(len - n, SEGMENT_SIZE - seg.len);
+                memcpy(seg.data + seg.len, buf + n, copy_len);
+                seg.len += copy_len;
+                n += copy_len;
+                continue;
+            }
+        }
+        if (seq_diff(snd_nxt, snd_una) >= WINDOW) {break;}
+        auto &seg = tx_segments[snd_nxt++ % WINDOW];
+        seg.len = 0;
+        seg.retransmits = 0;
+        seg.sacked = false;
+    }
+
+    return n;
+}
+
+// Stays true after the peer left while received data remains to be read
+bool udp_transport::connected(void)
+{
+    if (current == status::Incoming || current == status::Connected) {return true;}
+
+    return current == status::Disconnected && rcv_read != rcv_nxt;
+}
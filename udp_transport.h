@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <IPAddress.h>
+#include <EthernetUdp.h>
+
+// Byte stream over UDP for the online data path, as an alternative to TCP on
+// lossy links. Data is cut into numbered segments; the receiver reports the
+// next segment it expects plus a bitmap of the ones it already holds beyond
+// it (selective ACK), so a lost segment is resent as soon as a later one is
+// known to have arrived instead of after a retransmission timeout. Each
+// datagram may also repeat the most recent unacknowledged segments
+// (redundancy), which hides isolated losses completely at the cost of
+// bandwidth. One socket serves both directions: connect() dials out from it
+// and a SYN arriving while listening becomes an incoming call.
+// Single context (core1) only.
+class udp_transport
+{
+    public:
+        enum class status {
+            Closed,       // socket not open
+            Listening,
+            Incoming,     // SYN received, accept() or close() decides
+            Connecting,
+            Connected,
+            Refused,      // the peer answered the SYN with FIN
+            TimedOut,     // no answer to the SYN within the connect timeout
+            Disconnected, // FIN received, or the peer went silent
+        };
+        static constexpr int WINDOW = 16; // segments, also the SACK bitmap width
+        static constexpr size_t SEGMENT_SIZE = 240;
+    private:
+        static constexpr uint8_t MAGIC = 0xa5;
+        enum packet_type : uint8_t {
+            PACKET_SYN = 1,
+            PACKET_SYN_ACK = 2,
+            PACKET_DATA = 3, // also a bare ACK or keepalive when it holds no segment
+            PACKET_FIN = 4,
+        };
+        static constexpr size_t HEADER_SIZE = 9;         // magic, type, session, ack, sack, window
+        static constexpr size_t SEGMENT_HEADER_SIZE = 3; // seq, length
+        static constexpr size_t DATAGRAM_SIZE = 512;
+        static constexpr unsigned long SYN_INTERVAL_MS = 250;
+        static constexpr unsigned long KEEPALIVE_MS = 1000;
+        static constexpr unsigned long LINK_TIMEOUT_MS = 10000;
+        static constexpr uint32_t INITIAL_RTO_US = 200000;
+        static constexpr uint32_t MIN_RTO_US = 10000; // over the smoothed RTT
+        static constexpr uint32_t MAX_RTO_US = 1000000;
+        static constexpr uint32_t MIN_REORDER_US = 1000; // a segment sent srtt/4 (at least this) before a delivered one is lost
+        static constexpr uint8_t MAX_RETRANSMITS = 15;
+
+        struct tx_segment {
+            uint32_t sent_time_us;
+            uint8_t len;
+            uint8_t retransmits;
+            bool sacked;
+            char data[SEGMENT_SIZE];
+        };
+        struct rx_segment {
+            uint8_t len;
+            bool present;
+            char data[SEGMENT_SIZE];
+        };
+
+        EthernetUDP udp;
+        uint8_t redundancy;
+        status current;
+        IPAddress peer_ip;
+        uint16_t peer_port;
+        uint16_t session;
+        unsigned long connect_time_ms;
+        unsigned long connect_timeout_ms; // SYN retries stop after this
+        unsigned long last_recv_ms;
+        unsigned long last_send_ms;
+
+        // Sending: [snd_una, snd_sent) in flight, [snd_sent, snd_nxt) not sent yet
+        tx_segment tx_segments[WINDOW];
+        uint16_t snd_una, snd_sent, snd_nxt;
+        uint16_t peer_limit; // first segment the peer has no room for
+        uint32_t delivered_time_us; // send time of the latest segment known to be delivered
+        uint32_t srtt_us, rttvar_us, rto_us;
+
+        // Receiving: [rcv_read, rcv_nxt) complete, holes and SACKed segments beyond
+        rx_segment rx_segments[WINDOW];
+        uint16_t rcv_read, rcv_nxt;
+        uint8_t rcv_offset; // bytes of rcv_read already read
+        uint8_t advertised_window;
+        bool ack_pending;
+
+        uint8_t out[DATAGRAM_SIZE];
+        size_t out_len;
+
+        uint32_t retransmit_count;
+        uint32_t duplicate_count;
+
+        static int16_t seq_diff(const uint16_t a, const uint16_t b) {return static_cast<int16_t>(a - b);}
+        void reset_session(void);
+        void send_control(const packet_type type, const IPAddress &ip_addr, const uint16_t port, const uint16_t session);
+        void begin_datagram(void);
+        void append_segment(const uint16_t seq);
+        void send_datagram(void);
+        void process_ack(const uint16_t ack, const uint16_t sack, const uint8_t window);
+        void process_segment(const uint16_t seq, const uint8_t *data, const uint8_t len);
+        void process_datagram(const uint8_t *msg, const size_t len);
+        void update_rtt(const uint32_t sample_us);
+    public:
+        udp_transport(const uint8_t redundancy);
+        bool begin(const uint16_t port);
+        void stop(void);
+        bool is_open(void) {return current != status::Closed;}
+        status get_status(void) {return current;}
+        void connect(const IPAddress &ip_addr, const uint16_t port, const unsigned long timeout_ms);
+        bool accept(void);
+        void close(void);
+        void receive(void);
+        void flush(void);
+        int read(char *buf, const size_t max_len);
+        int write(const char *buf, const size_t len);
+        bool connected(void);
+        uint32_t get_rtt_us(void) {return srtt_us;}
+        uint32_t get_retransmit_count(void) {return retransmit_count;}
+        uint32_t get_duplicate_count(void) {return duplicate_count;}
+};
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <cstdint>
+
+#include "pico.h"
+
 enum USB_DIR {
     USB_DIR_BIT_MASK = 0x80,
     USB_DIR_OUT      = 0x00,